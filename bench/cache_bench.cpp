@@ -0,0 +1,84 @@
+// Cache hit throughput vs. thread count, single lock vs. sharded.
+//
+//   make cache-bench
+//   ./build/cache_bench [seconds_per_run] [value_bytes] [max_threads]
+
+#include "../include/cache_manager.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_KEYS 4096
+
+static double run(CacheManager& cache, const std::vector<std::string>& keys,
+                  int threads, double seconds) {
+    std::atomic<bool> go(false), stop(false);
+    std::atomic<unsigned long long> total(0);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t + 1);
+            CachedResponse out;
+            unsigned long long ops = 0;
+            while (!go) std::this_thread::yield();
+            while (!stop) {
+                for (int i = 0; i < 256; i++) {
+                    cache.get(keys[rng() % keys.size()], out);
+                }
+                ops += 256;
+            }
+            total += ops;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& w : workers) w.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return total.load() / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    size_t value_bytes = argc > 2 ? atoi(argv[2]) : 256;
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        keys.push_back("http://bench.example/object/" + std::to_string(i));
+    }
+    std::string value(value_bytes, 'x');
+
+    int max_threads = argc > 3 ? atoi(argv[3]) : (int)std::thread::hardware_concurrency();
+    max_threads = std::max(1, max_threads);
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    printf("%d keys, %zu-byte values, %.1fs per run\n\n", NUM_KEYS, value_bytes, seconds);
+    printf("%8s %8s %14s %10s\n", "shards", "threads", "hits/sec", "scaling");
+
+    for (size_t shards : {1, 16, 64}) {
+        CacheManager cache(NUM_KEYS * 2, 3600, shards);
+        cache.set_max_size((size_t)NUM_KEYS * value_bytes * 4);
+        for (const auto& key : keys) cache.put(key, value);
+
+        double base = 0;
+        for (int threads : thread_counts) {
+            double rate = run(cache, keys, threads, seconds);
+            if (threads == 1) base = rate;
+            printf("%8zu %8d %14.0f %9.2fx\n", shards, threads, rate, rate / base);
+        }
+        printf("\n");
+    }
+    return 0;
+}
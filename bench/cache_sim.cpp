@@ -0,0 +1,295 @@
+// Trace-driven cache simulator: replays an access trace through
+// CacheManager once per eviction policy and cache size, and reports the
+// object and byte hit ratios.
+//
+//   make cache-sim BENCH_ARGS="--trace logs/proxy.log"
+//   ./build/cache_sim [--trace FILE] [--policies lru,tinylfu,gdsf] [--sizes 1,2,5,10,20]
+//                     [--by entries|bytes] [--shards N] [--default-size BYTES]
+//
+// A policy of "gdsf:bytes" runs GDSF with GDSF_FAVOR=bytes.
+//
+// Cache sizes are percentages of the trace's distinct objects (--by
+// entries) or of their total bytes (--by bytes). A trace is either the
+// proxy's own log, where each GET's "URL_LOG:" line is paired with the
+// next result line from the same client for its size, or plain lines of
+// "<url> [bytes]". Without --trace a synthetic one is generated: Zipf
+// (s = 0.9) requests over 20k objects, with a burst of one-off URLs (a
+// crawler) after every 50k requests.
+//
+// Every request is a lookup followed by a put on a miss, as in the proxy;
+// TTLs never expire during a run.
+
+#include "../include/cache_manager.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Trace {
+    std::vector<std::string> urls;    // distinct objects
+    std::vector<size_t> sizes;        // per object
+    std::vector<uint32_t> requests;   // object ids in request order
+};
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+class TraceBuilder {
+private:
+    Trace& trace;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<bool> sized;
+
+public:
+    explicit TraceBuilder(Trace& out) : trace(out) {}
+
+    uint32_t request(const std::string& url) {
+        auto it = ids.find(url);
+        uint32_t id;
+        if (it == ids.end()) {
+            id = trace.urls.size();
+            ids.emplace(url, id);
+            trace.urls.push_back(url);
+            trace.sizes.push_back(0);
+            sized.push_back(false);
+        } else {
+            id = it->second;
+        }
+        trace.requests.push_back(id);
+        return id;
+    }
+
+    // The latest size seen for an object wins
+    void size(uint32_t id, size_t bytes) {
+        trace.sizes[id] = bytes;
+        sized[id] = true;
+    }
+
+    size_t finish(size_t default_size) {
+        size_t guessed = 0;
+        for (size_t id = 0; id < sized.size(); id++) {
+            if (sized[id]) continue;
+            trace.sizes[id] = default_size;
+            guessed++;
+        }
+        return guessed;
+    }
+};
+
+// "[ts] [INFO ] URL_LOG: <ip> GET <url>" starts a request;
+// "[ts] [INFO ] <ip> -> <host> [STATUS] (<n> bytes)" ends that client's
+// oldest one. Other lines are plain "<url> [bytes]" unless they look like
+// log lines.
+static bool load_trace(const std::string& path, size_t default_size, Trace& trace) {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    TraceBuilder builder(trace);
+    std::unordered_map<std::string, std::deque<uint32_t>> open;  // per client ip
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t marker = line.find("URL_LOG: ");
+        if (marker != std::string::npos) {
+            std::istringstream fields(line.substr(marker + 9));
+            std::string ip, method, url;
+            fields >> ip >> method >> url;
+            if (method == "GET" && !url.empty()) open[ip].push_back(builder.request(url));
+            continue;
+        }
+
+        size_t arrow = line.find(" -> ");
+        if (arrow != std::string::npos) {
+            size_t ip_start = line.rfind("] ", arrow);
+            ip_start = (ip_start == std::string::npos) ? 0 : ip_start + 2;
+            std::string ip = line.substr(ip_start, arrow - ip_start);
+            auto pending = open.find(ip);
+            if (pending == open.end() || pending->second.empty()) continue;
+            uint32_t id = pending->second.front();
+            pending->second.pop_front();
+            size_t bytes_at = line.find("] (", arrow);
+            if (bytes_at != std::string::npos) {
+                builder.size(id, strtoull(line.c_str() + bytes_at + 3, nullptr, 10));
+            }
+            continue;
+        }
+
+        if (line.empty() || line[0] == '[' || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string url;
+        size_t bytes = 0;
+        fields >> url >> bytes;
+        uint32_t id = builder.request(url);
+        if (bytes > 0) builder.size(id, bytes);
+    }
+
+    size_t guessed = builder.finish(default_size);
+    if (guessed > 0) {
+        fprintf(stderr, "%zu of %zu objects had no size in the trace, assumed %zu bytes\n",
+                guessed, trace.urls.size(), default_size);
+    }
+    return true;
+}
+
+static void synthetic_trace(Trace& trace) {
+    const size_t OBJECTS = 20000, REQUESTS = 1000000, SCAN_EVERY = 50000, SCAN_LENGTH = 5000;
+    std::mt19937 rng(7);
+
+    std::vector<double> cdf(OBJECTS);
+    double total = 0;
+    for (size_t k = 0; k < OBJECTS; k++) cdf[k] = total += 1.0 / std::pow(k + 1, 0.9);
+    for (double& c : cdf) c /= total;
+
+    // Sizes: mostly small, a few large
+    static const size_t SIZES[] = {1024, 4096, 16384, 65536, 262144};
+    static const int SIZE_WEIGHTS[] = {35, 30, 20, 12, 3};
+    std::discrete_distribution<int> size_class(std::begin(SIZE_WEIGHTS), std::end(SIZE_WEIGHTS));
+
+    TraceBuilder builder(trace);
+    std::vector<uint32_t> ids(OBJECTS, UINT32_MAX);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    size_t scanned = 0;
+    for (size_t i = 0; i < REQUESTS; i++) {
+        if (i > 0 && i % SCAN_EVERY == 0) {
+            for (size_t s = 0; s < SCAN_LENGTH; s++) {
+                uint32_t id = builder.request("http://crawl.example/page/" + std::to_string(scanned++));
+                builder.size(id, SIZES[size_class(rng)]);
+            }
+        }
+        size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        uint32_t id = builder.request("http://hot.example/object/" + std::to_string(rank));
+        if (ids[rank] == UINT32_MAX) {
+            ids[rank] = id;
+            builder.size(id, SIZES[size_class(rng)]);
+        }
+    }
+    builder.finish(0);
+}
+
+struct Result {
+    unsigned long long hits, hit_bytes, total_bytes;
+};
+
+// "name" or "name:bytes"
+static bool favors_bytes(const std::string& spec, std::string& name) {
+    size_t colon = spec.find(':');
+    name = spec.substr(0, colon);
+    return colon != std::string::npos && spec.substr(colon + 1) == "bytes";
+}
+
+static Result replay(const Trace& trace, const std::string& spec, size_t entries, size_t bytes,
+                     size_t shards) {
+    std::string policy;
+    bool favor_bytes = favors_bytes(spec, policy);
+    CacheManager cache(entries, INT_MAX / 2, shards, policy, favor_bytes);
+    cache.set_max_size(bytes);
+
+    std::string body;
+    Result result{0, 0, 0};
+    for (uint32_t id : trace.requests) {
+        size_t size = trace.sizes[id];
+        result.total_bytes += size;
+        CachedResponse out;
+        if (cache.get(trace.urls[id], out)) {
+            result.hits++;
+            result.hit_bytes += size;
+            continue;
+        }
+        body.assign(size, 'x');
+        cache.put(trace.urls[id], body);
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    std::string trace_path;
+    std::vector<std::string> policies = {"lru", "tinylfu", "gdsf", "gdsf:bytes"};
+    std::vector<std::string> sizes = {"1", "2", "5", "10", "20"};
+    bool by_bytes = false;
+    size_t shards = 1;
+    size_t default_size = 16384;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--trace") trace_path = value;
+        else if (arg == "--policies") policies = split(value);
+        else if (arg == "--sizes") sizes = split(value);
+        else if (arg == "--by") by_bytes = std::string(value) == "bytes";
+        else if (arg == "--shards") shards = std::max(1, atoi(value));
+        else if (arg == "--default-size") default_size = strtoull(value, nullptr, 10);
+        else {
+            fprintf(stderr, "usage: %s [--trace FILE] [--policies lru,tinylfu,gdsf,gdsf:bytes] [--sizes 1,2,5,10,20]\n"
+                            "          [--by entries|bytes] [--shards N] [--default-size BYTES]\n", argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    for (const std::string& spec : policies) {
+        std::string name;
+        bool favor_bytes = favors_bytes(spec, name);
+        CachePolicy* known = CachePolicy::create(name, favor_bytes);
+        if (!known) {
+            fprintf(stderr, "unknown policy %s\n", spec.c_str());
+            return 1;
+        }
+        delete known;
+    }
+
+    Trace trace;
+    if (trace_path.empty()) {
+        synthetic_trace(trace);
+    } else if (!load_trace(trace_path, default_size, trace)) {
+        fprintf(stderr, "cannot read %s\n", trace_path.c_str());
+        return 1;
+    }
+    if (trace.requests.empty()) {
+        fprintf(stderr, "no GET requests in the trace\n");
+        return 1;
+    }
+
+    size_t distinct_bytes = 0;
+    for (size_t size : trace.sizes) distinct_bytes += size;
+    fprintf(stderr, "%zu requests, %zu objects, %.1f MB distinct\n", trace.requests.size(),
+            trace.urls.size(), distinct_bytes / 1048576.0);
+
+    printf("policy,capacity_pct,max_entries,max_bytes,requests,hit_ratio,byte_hit_ratio\n");
+    for (const std::string& pct_text : sizes) {
+        double pct = atof(pct_text.c_str());
+        size_t entries = trace.urls.size() + 1;
+        size_t bytes = SIZE_MAX / 2;
+        if (by_bytes) {
+            bytes = std::max<size_t>(1, (size_t)(distinct_bytes * pct / 100));
+        } else {
+            entries = std::max<size_t>(1, (size_t)(trace.urls.size() * pct / 100));
+        }
+
+        for (const std::string& policy : policies) {
+            Result r = replay(trace, policy, entries, bytes, shards);
+            double hit_ratio = (double)r.hits / trace.requests.size();
+            double byte_ratio = r.total_bytes ? (double)r.hit_bytes / r.total_bytes : 0.0;
+            printf("%s,%g,%zu,%zu,%zu,%.4f,%.4f\n", policy.c_str(), pct, entries, bytes,
+                   trace.requests.size(), hit_ratio, byte_ratio);
+            fflush(stdout);
+            fprintf(stderr, "%-10s %5g%%  hit ratio %6.2f%%  byte hit ratio %6.2f%%\n",
+                    policy.c_str(), pct, hit_ratio * 100, byte_ratio * 100);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Block list lookups: compiled DomainMatcher vs. hash sets of names.
+//
+//   make domain-bench
+//   ./build/domain_bench [rules] [lookups]
+//
+// A quarter of the rules are "*.suffix" rules. The hash set baselines are
+// the old exact-only check and a suffix walk that probes the set once per
+// label, which is what suffix rules cost without a trie.
+
+#include "../include/domain_matcher.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+static const char* TLDS[] = {"com", "net", "org", "io", "de", "co.uk", "ru", "info", "app", "dev"};
+
+static std::string random_label(std::mt19937& rng) {
+    std::string label;
+    size_t length = 3 + rng() % 10;
+    for (size_t i = 0; i < length; i++) label.push_back('a' + rng() % 26);
+    return label;
+}
+
+static std::string random_domain(std::mt19937& rng) {
+    return random_label(rng) + "." + TLDS[rng() % (sizeof(TLDS) / sizeof(TLDS[0]))];
+}
+
+static volatile size_t sink;
+
+template <typename Lookup>
+static double ns_per_lookup(const std::vector<std::string>& hosts, Lookup lookup) {
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& host : hosts) hits += lookup(host);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sink += hits;
+    return elapsed * 1e9 / hosts.size();
+}
+
+static bool suffix_walk(const std::unordered_set<std::string>& exact,
+                        const std::unordered_set<std::string>& wildcard, const std::string& host) {
+    if (exact.count(host)) return true;
+    for (size_t dot = host.find('.'); dot != std::string::npos; dot = host.find('.', dot + 1)) {
+        if (wildcard.count(host.substr(dot + 1))) return true;
+    }
+    return false;
+}
+
+static void check(const DomainMatcher& matcher, const char* host, int port, bool expected) {
+    if (matcher.matches(host, port) != expected) {
+        fprintf(stderr, "mismatch: %s port %d should %smatch\n", host, port, expected ? "" : "not ");
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t rule_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000;
+
+    DomainMatcher sample({"facebook.com", "*.ads.example", ".tracker.net", "Host.Test:8080"});
+    check(sample, "facebook.com", 0, true);
+    check(sample, "FACEBOOK.COM.", 0, true);
+    check(sample, "facebook.com:443", 0, true);
+    check(sample, "www.facebook.com", 0, false);
+    check(sample, "x.ads.example", 0, true);
+    check(sample, "ads.example", 0, false);
+    check(sample, "tracker.net", 0, true);
+    check(sample, "a.b.tracker.net", 0, true);
+    check(sample, "host.test", 8080, true);
+    check(sample, "host.test:8080", 0, true);
+    check(sample, "host.test", 80, false);
+    check(sample, "nottracker.net", 0, false);
+
+    std::mt19937 rng(42);
+    std::vector<std::string> rules;
+    std::vector<std::string> exact_names, wildcard_names;
+    std::unordered_set<std::string> exact_set, wildcard_set;
+    rules.reserve(rule_count);
+    for (size_t i = 0; i < rule_count; i++) {
+        std::string domain = random_domain(rng);
+        if (i % 4 == 0) {
+            rules.push_back("*." + domain);
+            wildcard_names.push_back(domain);
+            wildcard_set.insert(domain);
+        } else {
+            rules.push_back(domain);
+            exact_names.push_back(domain);
+            exact_set.insert(domain);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    DomainMatcher matcher(rules);
+    double build_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::vector<std::string> exact_hits, subdomain_hits, misses;
+    for (size_t i = 0; i < lookups; i++) {
+        exact_hits.push_back(exact_names[rng() % exact_names.size()]);
+        subdomain_hits.push_back("www.cdn." + wildcard_names[rng() % wildcard_names.size()]);
+        misses.push_back(random_label(rng) + "." + random_domain(rng));
+    }
+
+    printf("%zu rules (%zu wildcard), %zu lookups per mix\n", matcher.rule_count(),
+           wildcard_names.size(), lookups);
+    printf("matcher: built in %.0f ms, %zu nodes, %.1f MB\n\n", build_ms, matcher.node_count(),
+           matcher.memory_bytes() / 1048576.0);
+
+    printf("%-14s %14s %14s %14s\n", "ns/lookup", "exact hit", "subdomain hit", "miss");
+    auto trie = [&](const std::string& host) { return matcher.matches(host); };
+    auto walk = [&](const std::string& host) { return suffix_walk(exact_set, wildcard_set, host); };
+    auto exact = [&](const std::string& host) { return exact_set.count(host) > 0; };
+
+    printf("%-14s %14.1f %14.1f %14.1f\n", "trie", ns_per_lookup(exact_hits, trie),
+           ns_per_lookup(subdomain_hits, trie), ns_per_lookup(misses, trie));
+    printf("%-14s %14.1f %14.1f %14.1f\n", "set walk", ns_per_lookup(exact_hits, walk),
+           ns_per_lookup(subdomain_hits, walk), ns_per_lookup(misses, walk));
+    printf("%-14s %14.1f %14s %14.1f\n", "set exact", ns_per_lookup(exact_hits, exact),
+           "n/a", ns_per_lookup(misses, exact));
+    return 0;
+}
@@ -0,0 +1,360 @@
+// End-to-end load through a running proxy, against bench/origin_stub.
+//
+//   make bench                 (starts both, see bench/run_bench.sh)
+//   ./build/load_bench --proxy 19190 --origin 18190 [--seconds 5]
+//       [--connections 64] [--size 4096] [--hit-keys 64]
+//       [--scenarios miss,hit,connect] [--label io_model=epoll ...]
+//
+// Every connection is a closed loop on its own thread: send a request,
+// read the whole response, repeat. Scenarios:
+//
+//   miss     GET of a URL never seen before, so every request goes to origin
+//   hit      GET of one of --hit-keys URLs fetched once beforehand
+//   connect  CONNECT tunnel to the origin, then keep-alive GETs through it;
+//            a tunnel the origin closes is set up again
+//
+// Results go to stdout as one JSON object, so runs of two builds can be
+// diffed. Latencies are per request in microseconds, tunnel setup included.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    int proxy_port = 19190;
+    int origin_port = 18190;
+    double seconds = 5.0;
+    int connections = 64;
+    size_t object_bytes = 4096;
+    int hit_keys = 64;
+    std::vector<std::string> scenarios = {"miss", "hit", "connect"};
+    std::vector<std::pair<std::string, std::string>> labels;
+};
+
+struct WorkerResult {
+    std::vector<uint32_t> latency_us;
+    unsigned long long bytes = 0;
+    unsigned long long errors = 0;
+    unsigned long long tunnels = 0;
+};
+
+static Options options;
+static std::string nonce;
+
+static int connect_proxy() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    timeval timeout{10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(options.proxy_port);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Reads one response, or only its header (a CONNECT reply). Chunked bodies
+// are not handled: the origin stub always sends Content-Length. Returns the
+// status code, or -1 on an I/O error. Bytes past the response stay in buffer.
+static int read_response(int fd, std::string& buffer, size_t& bytes, bool& keep_alive,
+                         bool header_only = false) {
+    char chunk[65536];
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return -1;
+        buffer.append(chunk, n);
+    }
+    header_end += 4;
+
+    std::string header = buffer.substr(0, header_end);
+    std::transform(header.begin(), header.end(), header.begin(),
+                   [](unsigned char ch) { return std::tolower(ch); });
+    int status = header.size() > 12 ? atoi(header.c_str() + 9) : 0;
+    keep_alive = header.find("\r\nconnection: close") == std::string::npos;
+
+    size_t length = 0;
+    size_t cl = header.find("\r\ncontent-length:");
+    bool framed = header_only || cl != std::string::npos;
+    if (!header_only && framed) length = strtoull(header.c_str() + cl + 17, nullptr, 10);
+
+    // Without a length the body runs to the end of the connection
+    size_t have = buffer.size() - header_end;
+    while (!framed || have < length) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0) return -1;
+        if (n == 0) {
+            if (framed) return -1;
+            keep_alive = false;
+            break;
+        }
+        buffer.append(chunk, n);
+        have += n;
+    }
+    if (!framed) length = buffer.size() - header_end;
+
+    bytes = header_end + length;
+    buffer.erase(0, header_end + length);
+    return status;
+}
+
+static std::string origin_host() {
+    return "127.0.0.1:" + std::to_string(options.origin_port);
+}
+
+static std::string object_path(const std::string& key) {
+    return "/obj/" + std::to_string(options.object_bytes) + "/" + key;
+}
+
+static std::string proxy_get(const std::string& key) {
+    return "GET http://" + origin_host() + object_path(key) + " HTTP/1.1\r\n"
+           "Host: " + origin_host() + "\r\n\r\n";
+}
+
+// Opens a tunnel to the origin; false if the proxy did not answer 200
+static bool open_tunnel(int fd, std::string& buffer) {
+    std::string request = "CONNECT " + origin_host() + " HTTP/1.1\r\nHost: " + origin_host() +
+                          "\r\n\r\n";
+    size_t bytes;
+    bool keep_alive;
+    return send_all(fd, request) && read_response(fd, buffer, bytes, keep_alive, true) == 200;
+}
+
+static void worker(const std::string& scenario, int id, std::atomic<bool>& go,
+                   std::atomic<bool>& stop, WorkerResult& result) {
+    std::mt19937 rng(id + 1);
+    std::string buffer;
+    unsigned long long sequence = 0;
+    int fd = -1;
+
+    while (!go) std::this_thread::yield();
+    while (!stop) {
+        auto start = Clock::now();
+
+        if (fd < 0) {
+            buffer.clear();
+            fd = connect_proxy();
+            if (fd < 0) {
+                result.errors++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            if (scenario == "connect") {
+                if (!open_tunnel(fd, buffer)) {
+                    result.errors++;
+                    close(fd);
+                    fd = -1;
+                    continue;
+                }
+                result.tunnels++;
+            }
+        }
+
+        std::string request;
+        if (scenario == "miss") {
+            request = proxy_get("miss-" + nonce + "-" + std::to_string(id) + "-" +
+                                std::to_string(sequence++));
+        } else if (scenario == "hit") {
+            request = proxy_get("hit-" + std::to_string(rng() % options.hit_keys));
+        } else {
+            request = "GET " + object_path("tunnel") + " HTTP/1.1\r\nHost: " + origin_host() +
+                      "\r\n\r\n";
+        }
+
+        size_t bytes = 0;
+        bool keep_alive = false;
+        int status = send_all(fd, request) ? read_response(fd, buffer, bytes, keep_alive) : -1;
+        if (status != 200 || !keep_alive) {
+            close(fd);
+            fd = -1;
+        }
+        if (stop) break;
+        if (status != 200) {
+            result.errors++;
+            continue;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+        result.latency_us.push_back((uint32_t)elapsed.count());
+        result.bytes += bytes;
+    }
+    if (fd >= 0) close(fd);
+}
+
+// Fetches every hit key once so the timed run only sees cache hits
+static bool warm_hit_keys() {
+    int fd = connect_proxy();
+    std::string buffer;
+    for (int key = 0; key < options.hit_keys; key++) {
+        if (fd < 0) fd = connect_proxy();
+        size_t bytes;
+        bool keep_alive;
+        if (fd < 0 || !send_all(fd, proxy_get("hit-" + std::to_string(key))) ||
+            read_response(fd, buffer, bytes, keep_alive) != 200) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        if (!keep_alive) {
+            close(fd);
+            fd = -1;
+            buffer.clear();
+        }
+    }
+    if (fd >= 0) close(fd);
+    return true;
+}
+
+static double percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t index = std::min(sorted.size() - 1, (size_t)(q * sorted.size()));
+    return sorted[index];
+}
+
+static void run_scenario(const std::string& scenario, bool last) {
+    std::atomic<bool> go(false), stop(false);
+    std::vector<WorkerResult> results(options.connections);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.connections; i++) {
+        workers.emplace_back(worker, scenario, i, std::ref(go), std::ref(stop), std::ref(results[i]));
+    }
+
+    auto start = Clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop = true;
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& w : workers) w.join();
+
+    std::vector<uint32_t> latency;
+    unsigned long long bytes = 0, errors = 0, tunnels = 0;
+    for (WorkerResult& result : results) {
+        latency.insert(latency.end(), result.latency_us.begin(), result.latency_us.end());
+        bytes += result.bytes;
+        errors += result.errors;
+        tunnels += result.tunnels;
+    }
+    std::sort(latency.begin(), latency.end());
+    double mean = 0;
+    for (uint32_t us : latency) mean += us;
+    if (!latency.empty()) mean /= latency.size();
+
+    fprintf(stderr, "%-8s %10.0f req/s %9.1f MB/s  p50 %6.0f us  p99 %6.0f us  errors %llu\n",
+            scenario.c_str(), latency.size() / elapsed, bytes / elapsed / 1e6,
+            percentile(latency, 0.50), percentile(latency, 0.99), errors);
+
+    printf("    {\"name\": \"%s\", \"requests\": %zu, \"errors\": %llu, \"seconds\": %.3f,\n"
+           "     \"requests_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"bytes\": %llu,",
+           scenario.c_str(), latency.size(), errors, elapsed, latency.size() / elapsed,
+           bytes / elapsed / 1e6, bytes);
+    if (scenario == "connect") printf(" \"tunnels\": %llu,", tunnels);
+    printf("\n     \"latency_us\": {\"mean\": %.1f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+           "\"p999\": %.0f, \"max\": %.0f}}%s\n",
+           mean, percentile(latency, 0.50), percentile(latency, 0.90), percentile(latency, 0.99),
+           percentile(latency, 0.999), latency.empty() ? 0.0 : (double)latency.back(),
+           last ? "" : ",");
+    fflush(stdout);
+}
+
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(separator, start);
+        if (end == std::string::npos) end = text.size();
+        if (end > start) parts.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: load_bench [--proxy port] [--origin port] [--seconds s] "
+                    "[--connections n] [--size bytes] [--hit-keys n] "
+                    "[--scenarios miss,hit,connect] [--label key=value]...\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage();
+        std::string value = argv[++i];
+        if (arg == "--proxy") options.proxy_port = atoi(value.c_str());
+        else if (arg == "--origin") options.origin_port = atoi(value.c_str());
+        else if (arg == "--seconds") options.seconds = atof(value.c_str());
+        else if (arg == "--connections") options.connections = std::max(1, atoi(value.c_str()));
+        else if (arg == "--size") options.object_bytes = strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--hit-keys") options.hit_keys = std::max(1, atoi(value.c_str()));
+        else if (arg == "--scenarios") options.scenarios = split(value, ',');
+        else if (arg == "--label") {
+            size_t eq = value.find('=');
+            if (eq == std::string::npos) usage();
+            options.labels.emplace_back(value.substr(0, eq), value.substr(eq + 1));
+        } else {
+            usage();
+        }
+    }
+    for (const std::string& scenario : options.scenarios) {
+        if (scenario != "miss" && scenario != "hit" && scenario != "connect") usage();
+    }
+    signal(SIGPIPE, SIG_IGN);
+    nonce = std::to_string(getpid()) + "." + std::to_string(time(nullptr));
+
+    if (std::find(options.scenarios.begin(), options.scenarios.end(), "hit") !=
+        options.scenarios.end() && !warm_hit_keys()) {
+        fprintf(stderr, "load_bench: could not fetch the hit keys through 127.0.0.1:%d\n",
+                options.proxy_port);
+        return 1;
+    }
+
+    printf("{\n  \"config\": {\"proxy_port\": %d, \"origin_port\": %d, \"seconds\": %.1f, "
+           "\"connections\": %d, \"object_bytes\": %zu, \"hit_keys\": %d",
+           options.proxy_port, options.origin_port, options.seconds, options.connections,
+           options.object_bytes, options.hit_keys);
+    for (const auto& label : options.labels) {
+        printf(", \"%s\": \"%s\"", label.first.c_str(), label.second.c_str());
+    }
+    printf("},\n  \"scenarios\": [\n");
+    for (size_t i = 0; i < options.scenarios.size(); i++) {
+        run_scenario(options.scenarios[i], i + 1 == options.scenarios.size());
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,253 @@
+// Hot-path microbenchmarks: cache, statistics, logger and request parsing,
+// each at 1..max_threads threads.
+//
+//   make microbench
+//   ./build/micro_bench [seconds_per_run] [max_threads] [name_filter]
+//
+// Inputs are drawn before timing starts: hosts and URLs follow a Zipf
+// distribution (s = 1.0 over 10k hosts / 50k URLs), object sizes a mix of
+// 512 B to 256 KB weighted towards small ones. Results go to stdout as CSV;
+// ns_per_op is per thread (threads * wall time / ops), ops_per_sec the
+// aggregate across threads.
+
+#include "../include/cache_manager.h"
+#include "../include/statistics.h"
+#include "../include/logger.h"
+#include "../include/request_parser.h"
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_HOSTS 10000
+#define NUM_URLS 50000
+#define NUM_CLIENTS 256
+#define DRAWS_PER_THREAD 65536
+
+// Draws ranks 0..n-1 with P(k) proportional to 1 / (k + 1)^s
+class Zipf {
+private:
+    std::vector<double> cdf;
+
+public:
+    Zipf(size_t n, double s) : cdf(n) {
+        double total = 0;
+        for (size_t k = 0; k < n; k++) cdf[k] = total += 1.0 / std::pow(k + 1, s);
+        for (double& c : cdf) c /= total;
+    }
+
+    size_t operator()(std::mt19937& rng) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+};
+
+struct Inputs {
+    std::vector<std::string> hosts;
+    std::vector<std::string> urls;
+    std::vector<std::string> clients;
+    std::vector<std::string> requests;   // one raw request header per URL
+    std::vector<std::string> bodies;     // one body per size class
+    std::vector<uint8_t> url_size;       // size class of each URL
+};
+
+// One op on thread `thread`; `draw` is that thread's next precomputed rank
+typedef std::function<void(int thread, uint32_t draw)> Op;
+
+struct Benchmark {
+    const char* name;
+    bool by_url;  // draws are URL ranks, else host ranks
+    std::function<void()> setup;
+    Op op;
+    std::function<void()> teardown;
+};
+
+static volatile size_t sink;
+
+static double run(const Op& op, const std::vector<std::vector<uint32_t>>& draws,
+                  int threads, double seconds, unsigned long long& total_ops) {
+    std::atomic<bool> go(false), stop(false);
+    std::atomic<unsigned long long> total(0);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            const std::vector<uint32_t>& mine = draws[t];
+            size_t next = 0;
+            unsigned long long ops = 0;
+            while (!go) std::this_thread::yield();
+            while (!stop) {
+                for (int i = 0; i < 256; i++) {
+                    op(t, mine[next]);
+                    next = (next + 1) % mine.size();
+                }
+                ops += 256;
+            }
+            total += ops;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& w : workers) w.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    total_ops = total.load();
+    return elapsed;
+}
+
+static Inputs make_inputs(std::mt19937& rng) {
+    Inputs in;
+    for (int i = 0; i < NUM_HOSTS; i++) {
+        in.hosts.push_back("host" + std::to_string(i) + ".example" + std::to_string(i % 7) + ".com");
+    }
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        in.clients.push_back("10.0." + std::to_string(i / 16) + "." + std::to_string(i % 16 + 2));
+    }
+
+    // Popular URLs sit on popular hosts
+    static const size_t SIZES[] = {512, 2048, 8192, 32768, 131072, 262144};
+    static const int SIZE_WEIGHTS[] = {30, 30, 20, 12, 6, 2};
+    std::discrete_distribution<int> size_class(std::begin(SIZE_WEIGHTS), std::end(SIZE_WEIGHTS));
+    Zipf host_rank(NUM_HOSTS, 1.0);
+    for (size_t s : SIZES) in.bodies.push_back(std::string(s, 'x'));
+    for (int i = 0; i < NUM_URLS; i++) {
+        uint32_t host = host_rank(rng);
+        const std::string& name = in.hosts[host];
+        std::string path = "/assets/" + std::to_string(i) + "/app.js?v=" + std::to_string(rng() % 1000);
+        in.url_size.push_back(size_class(rng));
+        in.urls.push_back("http://" + name + path);
+        in.requests.push_back(
+            "GET http://" + name + path + " HTTP/1.1\r\n"
+            "Host: " + name + "\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+            "Accept: */*\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Cookie: session=" + std::to_string(rng()) + "\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n");
+    }
+    return in;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    max_threads = std::max(1, max_threads);
+    std::string filter = argc > 3 ? argv[3] : "";
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    std::mt19937 rng(42);
+    Inputs in = make_inputs(rng);
+    Zipf host_rank(NUM_HOSTS, 1.0), url_rank(NUM_URLS, 1.0);
+    std::vector<std::vector<uint32_t>> host_draws(max_threads), url_draws(max_threads);
+    for (int t = 0; t < max_threads; t++) {
+        for (int i = 0; i < DRAWS_PER_THREAD; i++) {
+            host_draws[t].push_back(host_rank(rng));
+            url_draws[t].push_back(url_rank(rng));
+        }
+    }
+
+    // Shared state the benchmarks below set up and tear down per row
+    CacheManager* cache = nullptr;
+    Statistics* stats = nullptr;
+    Logger* logger = nullptr;
+    std::string log_path = "/tmp/micro_bench." + std::to_string(getpid()) + ".log";
+    std::vector<RequestParser> parsers(max_threads);
+
+    auto fill_cache = [&](size_t entries, size_t bytes, bool everything) {
+        cache = new CacheManager(entries, 3600, 16);
+        cache->set_max_size(bytes);
+        for (int i = 0; i < NUM_URLS && (everything || i < NUM_URLS / 10); i++) {
+            cache->put(in.urls[i], in.bodies[in.url_size[i]]);
+        }
+    };
+    auto drop_cache = [&]() { delete cache; cache = nullptr; };
+    auto new_stats = [&]() { stats = new Statistics(); };
+    auto drop_stats = [&]() { delete stats; stats = nullptr; };
+    auto drop_logger = [&]() { delete logger; logger = nullptr; unlink(log_path.c_str()); };
+
+    std::vector<Benchmark> benchmarks = {
+        // Every URL fits: all hits, the cost is lookup + shard lock + LRU touch
+        {"cache_get_hit", true, [&]() { fill_cache(NUM_URLS * 2, (size_t)8 << 30, true); },
+         [&](int, uint32_t url) {
+             CachedResponse out;
+             sink += cache->get(in.urls[url], out);
+         }, drop_cache},
+        // Proxy pattern with a cache a tenth the size of the URL set: look up,
+        // store the object on a miss (evicting others)
+        {"cache_get_or_put", true, [&]() { fill_cache(NUM_URLS / 10, (size_t)64 << 20, false); },
+         [&](int, uint32_t url) {
+             CachedResponse out;
+             if (!cache->get(in.urls[url], out)) cache->put(in.urls[url], in.bodies[in.url_size[url]]);
+         }, drop_cache},
+        {"stats_record_request", false, new_stats,
+         [&](int t, uint32_t host) { stats->record_request(in.hosts[host], in.clients[(host + t) % NUM_CLIENTS]); },
+         drop_stats},
+        {"stats_record_bytes", false, new_stats,
+         [&](int, uint32_t host) { stats->record_bytes(in.hosts[host], 4096, 512); }, drop_stats},
+        {"stats_record_latency", false, new_stats,
+         [&](int, uint32_t host) {
+             stats->record_latency(PHASE_TTFB, in.hosts[host], std::chrono::microseconds(host % 50000));
+         }, drop_stats},
+        // DEBUG lines go to the file only, never the console
+        {"logger_sync", false, [&]() { logger = new Logger(log_path, DEBUG); },
+         [&](int, uint32_t host) { logger->debug("10.0.0.2 -> " + in.hosts[host] + " [FETCHED] (4096 bytes)"); },
+         drop_logger},
+        {"logger_async", false,
+         [&]() {
+             logger = new Logger(log_path, DEBUG);
+             logger->start_async(16384, 200, false);
+         },
+         [&](int, uint32_t host) { logger->debug("10.0.0.2 -> " + in.hosts[host] + " [FETCHED] (4096 bytes)"); },
+         [&]() {
+             logger->stop_async();
+             fprintf(stderr, "  logger_async dropped %llu lines (LOG_OVERFLOW=drop)\n",
+                     logger->get_dropped_lines());
+             drop_logger();
+         }},
+        {"logger_filtered", false, [&]() { logger = new Logger(log_path, INFO); },
+         [&](int, uint32_t host) { logger->debug("10.0.0.2 -> " + in.hosts[host] + " [FETCHED] (4096 bytes)"); },
+         drop_logger},
+        // Parse plus the host and path lookups the handler does after it
+        {"parse_request", true, nullptr,
+         [&](int t, uint32_t url) {
+             RequestParser& parser = parsers[t];
+             parser.reset();
+             if (parser.parse(in.requests[url]) != RequestParser::COMPLETE) abort();
+             sink += parser.host().size() + parser.path().size();
+         }, nullptr},
+    };
+
+    printf("benchmark,threads,ops,seconds,ns_per_op,ops_per_sec\n");
+    for (const Benchmark& bench : benchmarks) {
+        if (std::string(bench.name).find(filter) == std::string::npos) continue;
+        for (int threads : thread_counts) {
+            if (bench.setup) bench.setup();
+            unsigned long long ops = 0;
+            double elapsed = run(bench.op, bench.by_url ? url_draws : host_draws, threads, seconds, ops);
+            if (bench.teardown) bench.teardown();
+
+            double ns_per_op = elapsed * 1e9 * threads / ops;
+            printf("%s,%d,%llu,%.3f,%.1f,%.0f\n", bench.name, threads, ops, elapsed, ns_per_op,
+                   ops / elapsed);
+            fflush(stdout);
+            fprintf(stderr, "%-22s %3d threads %10.1f ns/op %14.0f ops/s\n", bench.name, threads,
+                    ns_per_op, ops / elapsed);
+        }
+    }
+    return 0;
+}
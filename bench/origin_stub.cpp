@@ -0,0 +1,129 @@
+// Local origin server for the end-to-end benchmark (make bench).
+//
+//   ./build/origin_stub [port] [latency_ms] [keepalive 0|1]
+//
+// GET /obj/<bytes>[/anything] answers 200 with a <bytes>-long body,
+// Cache-Control: max-age=3600 and a fixed ETag and Last-Modified, after
+// sleeping latency_ms; a request carrying If-None-Match or
+// If-Modified-Since gets a 304 instead. Any other path is a 404.
+// With keepalive=0 every response carries Connection: close.
+// One thread per connection; nothing here is meant to be the bottleneck.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#define MAX_OBJECT (64 * 1024 * 1024)
+
+static int latency_ms = 0;
+static bool keepalive = true;
+static std::string payload;
+
+static bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Sends the response for one request header; false closes the connection
+static bool respond(int fd, const std::string& header) {
+    size_t sp = header.find(' ');
+    size_t end = sp == std::string::npos ? sp : header.find(' ', sp + 1);
+    if (end == std::string::npos) return false;
+    std::string path = header.substr(sp + 1, end - sp - 1);
+
+    if (latency_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms));
+
+    const char* connection = keepalive ? "" : "Connection: close\r\n";
+    if (path.compare(0, 5, "/obj/") != 0) {
+        std::string reply = std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n") +
+                            connection + "\r\n";
+        return send_all(fd, reply.data(), reply.size()) && keepalive;
+    }
+
+    // The objects never change, so any validator matches
+    size_t bytes = std::min<size_t>(strtoull(path.c_str() + 5, nullptr, 10), payload.size());
+    std::string validators = "ETag: \"obj-" + std::to_string(bytes) + "\"\r\n"
+                             "Last-Modified: Thu, 01 Jan 2026 00:00:00 GMT\r\n";
+    if (strcasestr(header.c_str(), "\r\nif-none-match:") ||
+        strcasestr(header.c_str(), "\r\nif-modified-since:")) {
+        std::string reply = "HTTP/1.1 304 Not Modified\r\n" + validators + connection + "\r\n";
+        return send_all(fd, reply.data(), reply.size()) && keepalive;
+    }
+
+    std::string reply = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/octet-stream\r\n"
+                        "Cache-Control: max-age=3600\r\n" + validators +
+                        "Content-Length: " + std::to_string(bytes) + "\r\n" +
+                        connection + "\r\n";
+    bool head = header.compare(0, 5, "HEAD ") == 0;
+    return send_all(fd, reply.data(), reply.size()) &&
+           (head || send_all(fd, payload.data(), bytes)) && keepalive;
+}
+
+static void serve(int fd) {
+    std::string buffer;
+    char chunk[16384];
+
+    while (true) {
+        size_t header_end;
+        while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            buffer.append(chunk, n);
+        }
+
+        std::string header = buffer.substr(0, header_end + 4);
+        buffer.erase(0, header_end + 4);
+        if (!respond(fd, header)) break;
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : 18080;
+    latency_ms = argc > 2 ? atoi(argv[2]) : 0;
+    keepalive = argc > 3 ? atoi(argv[3]) != 0 : true;
+    signal(SIGPIPE, SIG_IGN);
+
+    payload.assign(MAX_OBJECT, 'x');
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1024) < 0) {
+        perror("origin_stub: bind/listen");
+        return 1;
+    }
+    fprintf(stderr, "origin_stub on 127.0.0.1:%d, latency %d ms, keep-alive %s\n",
+            port, latency_ms, keepalive ? "on" : "off");
+
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        std::thread(serve, client).detach();
+    }
+}
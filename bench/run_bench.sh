@@ -0,0 +1,53 @@
+#!/bin/bash
+# End-to-end benchmark: origin stub + proxy + load generator on loopback.
+# Called by `make bench`; arguments go to build/load_bench (see its header).
+#
+# Environment:
+#   BENCH_CONFIG      base config file (default config.txt)
+#   BENCH_IO_MODEL    overrides IO_MODEL (threads, epoll or uring)
+#   BENCH_LATENCY_MS  origin think time per response (default 0)
+#   BENCH_KEEPALIVE   0 makes the origin close after every response
+#   BENCH_OUT         also write the JSON result to this file
+#   BENCH_PROXY_PORT, BENCH_ORIGIN_PORT (default 19190, 18190)
+
+set -e
+cd "$(dirname "$0")/.."
+
+CONFIG=${BENCH_CONFIG:-config.txt}
+PROXY_PORT=${BENCH_PROXY_PORT:-19190}
+ORIGIN_PORT=${BENCH_ORIGIN_PORT:-18190}
+WORK=$(mktemp -d)
+trap 'kill $ORIGIN_PID $PROXY_PID 2>/dev/null; wait 2>/dev/null; rm -rf "$WORK"' EXIT
+
+# Same settings as the base config, but on our port and with room for every
+# load connection
+sed -e "s/^PORT=.*/PORT=$PROXY_PORT/" -e "s/^MAX_CONNECTIONS=.*/MAX_CONNECTIONS=4096/" \
+    ${BENCH_IO_MODEL:+-e "s/^IO_MODEL=.*/IO_MODEL=$BENCH_IO_MODEL/"} "$CONFIG" > "$WORK/config.txt"
+IO_MODEL=$(sed -n 's/^IO_MODEL=//p' "$WORK/config.txt" | tail -1)
+
+./build/origin_stub "$ORIGIN_PORT" "${BENCH_LATENCY_MS:-0}" "${BENCH_KEEPALIVE:-1}" \
+    2> "$WORK/origin.log" &
+ORIGIN_PID=$!
+./proxy_server "$WORK/config.txt" > "$WORK/proxy.log" 2>&1 &
+PROXY_PID=$!
+
+for port in "$ORIGIN_PORT" "$PROXY_PORT"; do
+    for i in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+        sleep 0.1
+    done
+done
+if ! kill -0 $PROXY_PID 2>/dev/null || ! kill -0 $ORIGIN_PID 2>/dev/null; then
+    echo "bench: proxy or origin failed to start" >&2
+    cat "$WORK/proxy.log" "$WORK/origin.log" >&2
+    exit 1
+fi
+
+BUILD=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+./build/load_bench --proxy "$PROXY_PORT" --origin "$ORIGIN_PORT" \
+    --label build="$BUILD" --label io_model="$IO_MODEL" \
+    --label origin_latency_ms="${BENCH_LATENCY_MS:-0}" \
+    --label origin_keepalive="${BENCH_KEEPALIVE:-1}" "$@" > "$WORK/result.json"
+
+cat "$WORK/result.json"
+if [ -n "$BENCH_OUT" ]; then cp "$WORK/result.json" "$BENCH_OUT"; fi
@@ -3,54 +3,113 @@
 
 #include <string>
 #include <unordered_map>
-#include <list>
+#include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <ctime>
+#include "disk_cache.h"
+#include "cache_policy.h"
+
+// Cached responses are immutable once stored, so readers share them by
+// reference instead of copying; an entry evicted while being sent stays
+// alive until the last holder lets go.
+typedef std::shared_ptr<const std::string> CachedResponse;
 
 struct CacheEntry {
-    std::string data;
+    CachedResponse data;
     time_t timestamp;
     int ttl_seconds;
     size_t size;
+    PolicyNode* node;  // owned by the shard's policy
 };
 
+// Response cache split into independent shards by key hash. Each shard has
+// its own lock, eviction policy (LRU, W-TinyLFU or GDSF; cache_policy.h) and
+// an equal share of the entry and byte budgets, so lookups of different
+// keys rarely contend and a hit only reorders its own shard.
+//
+// An entry past its TTL is kept for up to max_stale more seconds as a
+// stale candidate: lookup() hands it out marked STALE so the caller can
+// revalidate it with the origin, and refresh() restarts its TTL on a 304.
 class CacheManager {
 private:
-    std::unordered_map<std::string, std::pair<CacheEntry, std::list<std::string>::iterator>> cache;
-    std::list<std::string> lru;
-    std::mutex cache_mutex;
-    
+    struct Shard {
+        std::unordered_map<std::string, CacheEntry> cache;
+        CachePolicy* policy;
+        std::mutex cache_mutex;
+        size_t total_size;
+        size_t max_entries;
+        size_t max_size_bytes;
+    };
+
+    typedef std::vector<std::pair<std::string, CacheEntry>> Evicted;
+
+    std::vector<Shard*> shards;
+    std::string policy_name;
+    DiskCache* disk;  // optional second tier, nullptr when disabled
+
+    std::atomic<int> default_ttl;
+    std::atomic<int> max_stale;
+    std::atomic<size_t> total_size;
     size_t max_entries;
-    int default_ttl;
-    size_t total_size;
     size_t max_size_bytes;
-    
+    std::mutex limits_mutex;
+
     // Statistics
-    unsigned long long cache_hits;
-    unsigned long long cache_misses;
+    std::atomic<unsigned long long> cache_hits;
+    std::atomic<unsigned long long> cache_misses;
 
+    Shard& shard_for(const std::string& key, size_t& hash);
     bool is_expired(const CacheEntry& entry);
-    void evict_oldest();
-    void evict_if_needed(size_t new_size);
+    bool is_past_stale(const CacheEntry& entry);
+    void erase_entry(Shard& shard, const std::string& key);
+    bool evict_victim(Shard& shard, Evicted* evicted);
+    void evict_if_needed(Shard& shard, Evicted* evicted);
+    void insert(Shard& shard, const std::string& key, size_t hash, CacheEntry entry,
+                Evicted* evicted);
+    void demote(Evicted& evicted);
+    void apply_limits();
 
 public:
-    CacheManager(size_t max_entries = 100, int default_ttl = 3600);
-    
-    bool get(const std::string& key, std::string& data);
-    void put(const std::string& key, const std::string& data, int ttl = -1);
+    // An unknown policy name falls back to "lru"; see policy()
+    CacheManager(size_t max_entries = 100, int default_ttl = 3600, size_t num_shards = 1,
+                 const std::string& policy = "lru", bool favor_bytes = false);
+    ~CacheManager();
+
+    // Entries evicted for space move to the disk tier; L1 misses found
+    // there are promoted back. The tier is owned by the caller.
+    void set_disk_tier(DiskCache* disk_cache) { disk = disk_cache; }
+
+    enum Freshness { MISS, FRESH, STALE };
+
+    // Fresh entries only
+    bool get(const std::string& key, CachedResponse& data);
+    // Also returns an expired entry still within max_stale, as STALE;
+    // stale_seconds is then how long it has been expired
+    Freshness lookup(const std::string& key, CachedResponse& data, int& stale_seconds);
+    // The origin confirmed data (304): restart its TTL. False if the entry
+    // was replaced or dropped in the meantime.
+    bool refresh(const std::string& key, const CachedResponse& data, int ttl = -1);
+    // Replaces any entry for key; data larger than a shard's byte budget
+    // is not stored
+    void put(const std::string& key, std::string data, int ttl = -1);
     void remove(const std::string& key);
     void clear();
-    
+
     void set_max_entries(size_t max);
     void set_default_ttl(int seconds);
+    void set_max_stale(int seconds) { max_stale = seconds; }
     void set_max_size(size_t bytes);
-    
+
     size_t size() const;
+    size_t shard_count() const { return shards.size(); }
+    const std::string& policy() const { return policy_name; }
     double get_hit_rate() const;
-    unsigned long long get_hits() const { return cache_hits; }
-    unsigned long long get_misses() const { return cache_misses; }
-    size_t get_total_size() const { return total_size; }
-    
+    unsigned long long get_hits() const { return cache_hits.load(); }
+    unsigned long long get_misses() const { return cache_misses.load(); }
+    size_t get_total_size() const { return total_size.load(); }
+
     void cleanup_expired();
 };
 
@@ -0,0 +1,170 @@
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Per-entry bookkeeping of an eviction policy. The cache keeps a pointer
+// to it next to the entry, so a hit reaches its node without a second
+// lookup; the node points back at the cache's own copy of the key.
+struct PolicyNode {
+    const std::string* key;
+    size_t hash;
+    size_t size;
+    int queue;  // which of the policy's lists holds the node (GDSF: heap slot)
+    PolicyNode* prev;
+    PolicyNode* next;
+    double priority;     // GDSF only
+    unsigned frequency;  // GDSF only
+};
+
+// Intrusive doubly-linked recency list, most recent first
+class NodeList {
+private:
+    PolicyNode head;  // sentinel
+    size_t count;
+    size_t total_bytes;
+
+public:
+    NodeList();
+
+    void push_front(PolicyNode* node);
+    void unlink(PolicyNode* node);
+    void move_to_front(PolicyNode* node);
+    PolicyNode* back() const { return count ? head.prev : nullptr; }
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t bytes() const { return total_bytes; }
+    // Unlinks and frees every node
+    void clear();
+};
+
+// Decides which entry a cache shard gives up when it is over budget. All
+// calls come from the shard under its lock.
+class CachePolicy {
+public:
+    virtual ~CachePolicy() {}
+
+    // Every lookup, found or not; frequency-based policies count both
+    virtual void record_access(size_t hash) { (void)hash; }
+    // A new entry; the returned node stays valid until remove()
+    virtual PolicyNode* add(const std::string* key, size_t hash, size_t size) = 0;
+    virtual void touch(PolicyNode* node) = 0;
+    virtual void remove(PolicyNode* node) = 0;
+    // The entry to evict next, nullptr when there is none. May reorder
+    // entries internally (e.g. admit a window entry to the main cache).
+    virtual PolicyNode* victim() = 0;
+    // The shard's budgets, for policies that split them into segments
+    virtual void set_capacity(size_t max_entries, size_t max_bytes) { (void)max_entries; (void)max_bytes; }
+    virtual void clear() = 0;
+
+    // "lru", "tinylfu" or "gdsf"; nullptr for anything else. favor_bytes
+    // picks GDSF's cost function.
+    static CachePolicy* create(const std::string& name, bool favor_bytes = false);
+};
+
+// Plain least-recently-used order
+class LruPolicy : public CachePolicy {
+private:
+    NodeList lru;
+
+public:
+    ~LruPolicy() override { lru.clear(); }
+
+    PolicyNode* add(const std::string* key, size_t hash, size_t size) override;
+    void touch(PolicyNode* node) override { lru.move_to_front(node); }
+    void remove(PolicyNode* node) override;
+    PolicyNode* victim() override { return lru.back(); }
+    void clear() override { lru.clear(); }
+};
+
+// Count-min sketch of 4-bit saturating counters (stored a byte each).
+// Every counter is halved once the sketch has counted sample_size
+// accesses, so old popularity fades.
+class FrequencySketch {
+private:
+    std::vector<uint8_t> table;  // ROWS rows of width counters
+    size_t width_mask;
+    int index_shift;
+    size_t additions;
+    size_t sample_size;
+
+    size_t index(size_t hash, int row) const;
+    void age();
+
+public:
+    FrequencySketch() : width_mask(0), index_shift(0), additions(0), sample_size(0) {}
+
+    void resize(size_t expected_entries);
+    void increment(size_t hash);
+    int frequency(size_t hash) const;
+};
+
+// W-TinyLFU (Einziger et al., "TinyLFU: A Highly Efficient Cache
+// Admission Policy"). New entries enter a small LRU window; an entry
+// leaving the window only joins the main cache if the sketch has seen it
+// more often than the main cache's coldest entry, so a one-off scan
+// cycles through the window instead of flushing the hot set. The main
+// cache is a segmented LRU: probation for entries admitted or demoted,
+// protected for those hit again while on probation.
+class TinyLfuPolicy : public CachePolicy {
+private:
+    enum Queue { WINDOW, PROBATION, PROTECTED };
+
+    NodeList window;
+    NodeList probation;
+    NodeList protected_;
+    FrequencySketch sketch;
+    size_t window_entries, window_bytes;
+    size_t protected_entries, protected_bytes;
+    size_t main_entries, main_bytes;
+
+    void move(PolicyNode* node, NodeList& to, int queue);
+    NodeList& list_of(PolicyNode* node);
+    void demote_protected();
+
+public:
+    TinyLfuPolicy();
+    ~TinyLfuPolicy() override { clear(); }
+
+    void record_access(size_t hash) override { sketch.increment(hash); }
+    PolicyNode* add(const std::string* key, size_t hash, size_t size) override;
+    void touch(PolicyNode* node) override;
+    void remove(PolicyNode* node) override;
+    PolicyNode* victim() override;
+    void set_capacity(size_t max_entries, size_t max_bytes) override;
+    void clear() override;
+};
+
+// Greedy-Dual-Size-Frequency (Cherkasova, "Improving WWW Proxies
+// Performance with Greedy-Dual-Size-Frequency Caching Policy"). An
+// entry's priority is L + frequency * cost / size and the lowest goes
+// first; L rises to each evicted priority, so entries nobody hits any
+// more age out. Cost 1 keeps many small objects (object hit ratio); cost
+// = size drops the size term, i.e. LFU with dynamic aging, which keeps
+// popular large objects too (byte hit ratio).
+class GdsfPolicy : public CachePolicy {
+private:
+    std::vector<PolicyNode*> heap;  // binary min-heap on priority
+    double inflation;
+    bool favor_bytes;
+
+    void set_priority(PolicyNode* node);
+    void place(PolicyNode* node, size_t slot);
+    void sift_up(size_t slot);
+    void sift_down(size_t slot);
+
+public:
+    explicit GdsfPolicy(bool favor_bytes) : inflation(0), favor_bytes(favor_bytes) {}
+    ~GdsfPolicy() override { clear(); }
+
+    PolicyNode* add(const std::string* key, size_t hash, size_t size) override;
+    void touch(PolicyNode* node) override;
+    void remove(PolicyNode* node) override;
+    PolicyNode* victim() override;
+    void clear() override;
+};
+
+#endif // CACHE_POLICY_H
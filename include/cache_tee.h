@@ -0,0 +1,34 @@
+#ifndef CACHE_TEE_H
+#define CACHE_TEE_H
+
+#include <string>
+#include <cstddef>
+
+// Copies a response that is being streamed to the client so it can be
+// cached afterwards. The copy is abandoned (and its memory released) as
+// soon as the response turns out to be uncacheable or larger than the
+// per-object limit, so big downloads are never buffered whole.
+class CacheTee {
+private:
+    std::string buffer;
+    size_t max_object_bytes;
+    size_t total_bytes;
+    bool active;
+    bool header_checked;
+
+    void check_header(size_t header_end);
+    void abandon();
+
+public:
+    explicit CacheTee(size_t max_bytes);
+
+    void feed(const char* data, size_t len);
+
+    bool is_cacheable() const { return active && header_checked; }
+    const std::string& data() const { return buffer; }
+    // Hand the copy over (e.g. to the cache) without duplicating it
+    std::string take_data() { return std::move(buffer); }
+    size_t bytes_seen() const { return total_bytes; }
+};
+
+#endif // CACHE_TEE_H
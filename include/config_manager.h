@@ -2,55 +2,142 @@
 #define CONFIG_MANAGER_H
 
 #include <string>
-#include <unordered_set>
-#include <unordered_map>
+#include <vector>
+#include <memory>
 #include <mutex>
 #include <atomic>
+#include <thread>
 #include <functional>
+#include "domain_matcher.h"
+
+// One complete, immutable configuration. A reload builds a new snapshot
+// and publishes it whole, so a reader never sees half of an update.
+struct ConfigSnapshot {
+    int port = 8080;
+    int cache_limit = 100;
+    int cache_ttl = 3600;
+    std::string log_level = "INFO";
+    bool log_async = true;
+    size_t log_buffer_lines = 16384;
+    int log_flush_ms = 200;
+    bool log_block_when_full = false;
+    size_t max_cache_size_mb = 100;
+    size_t max_cache_object_kb = 10240;
+    int cache_shards = 1;
+    std::string cache_policy = "lru";
+    bool gdsf_favor_bytes = false;
+    std::string disk_cache_dir;
+    size_t disk_cache_size_mb = 10240;
+    size_t disk_cache_segment_mb = 64;
+    int cache_max_stale = 3600;
+    int stale_while_revalidate = 0;
+    bool coalesce_misses = true;
+    int coalesce_timeout_ms = 5000;
+    int connection_timeout = 30;
+    int max_connections = 100;
+    int listen_backlog = 1024;
+    int accept_threads = 1;
+    bool cpu_pinning = false;
+    bool enable_stats = true;
+    int metrics_port = 0;
+    std::string io_model = "threads";
+    int event_loop_threads = 4;
+    bool upstream_keepalive = true;
+    int upstream_pool_per_host = 8;
+    int upstream_idle_timeout = 30;
+    std::string dns_server;
+    std::string dns_hosts_file = "/etc/hosts";
+    int dns_timeout_ms = 1000;
+    int dns_negative_ttl = 30;
+    int dns_max_ttl = 3600;
+
+    // Rules as written, and the matchers compiled from them
+    std::vector<std::string> blocked_rules;
+    std::vector<std::string> whitelist_rules;
+    DomainMatcher blocked_hosts;
+    DomainMatcher whitelisted_hosts;
+};
 
 class ConfigManager {
 private:
     std::string config_file;
     std::atomic<time_t> last_mtime;
-    std::mutex config_mutex;
-    
-    // Configuration values
-    int port;
-    int cache_limit;
-    int cache_ttl;
-    std::string log_level;
-    size_t max_cache_size_mb;
-    int connection_timeout;
-    int max_connections;
-    bool enable_stats;
-    
-    std::unordered_set<std::string> blocked_hosts;
-    std::unordered_set<std::string> whitelisted_hosts;
-    
+    std::mutex update_mutex;          // serializes writers
+    mutable std::mutex config_mutex;  // guards published
+
+    // The published snapshot; version changes with every publish
+    std::shared_ptr<const ConfigSnapshot> published;
+    std::atomic<uint64_t> version;
+
     // Callback for config changes
     std::function<void()> on_config_changed;
 
+    std::thread watcher;
+    int stop_fd;  // eventfd that wakes the watcher to exit
+    std::atomic<bool> watching;
+
+    void publish(std::shared_ptr<const ConfigSnapshot> snapshot);
+    const ConfigSnapshot& current() const;
+    void watch_inotify();
+    void watch_polling();
+
 public:
     ConfigManager(const std::string& filename);
-    
+    ~ConfigManager();
+
     bool load();
     void watch(std::function<void()> callback = nullptr);
     void stop_watching();
-    
-    // Getters
-    int get_port() const { return port; }
-    int get_cache_limit() const { return cache_limit; }
-    int get_cache_ttl() const { return cache_ttl; }
-    std::string get_log_level() const { return log_level; }
-    size_t get_max_cache_size_mb() const { return max_cache_size_mb; }
-    int get_connection_timeout() const { return connection_timeout; }
-    int get_max_connections() const { return max_connections; }
-    bool is_stats_enabled() const { return enable_stats; }
-    
-    bool is_blocked(const std::string& host) const;
-    bool is_whitelisted(const std::string& host) const;
-    
-    // Setters (thread-safe)
+
+    // A consistent view of every setting, for callers reading several
+    std::shared_ptr<const ConfigSnapshot> snapshot() const;
+
+    // Getters (lock-free: each thread keeps the snapshot it last saw and
+    // only takes the mutex to pick up a newer one)
+    int get_port() const { return current().port; }
+    int get_cache_limit() const { return current().cache_limit; }
+    int get_cache_ttl() const { return current().cache_ttl; }
+    std::string get_log_level() const { return current().log_level; }
+    bool is_log_async() const { return current().log_async; }
+    size_t get_log_buffer_lines() const { return current().log_buffer_lines; }
+    int get_log_flush_ms() const { return current().log_flush_ms; }
+    bool is_log_block_when_full() const { return current().log_block_when_full; }
+    size_t get_max_cache_size_mb() const { return current().max_cache_size_mb; }
+    size_t get_max_cache_object_kb() const { return current().max_cache_object_kb; }
+    int get_cache_shards() const { return current().cache_shards; }
+    std::string get_cache_policy() const { return current().cache_policy; }
+    bool is_gdsf_favoring_bytes() const { return current().gdsf_favor_bytes; }
+    std::string get_disk_cache_dir() const { return current().disk_cache_dir; }
+    size_t get_disk_cache_size_mb() const { return current().disk_cache_size_mb; }
+    size_t get_disk_cache_segment_mb() const { return current().disk_cache_segment_mb; }
+    int get_cache_max_stale() const { return current().cache_max_stale; }
+    int get_stale_while_revalidate() const { return current().stale_while_revalidate; }
+    bool is_coalescing_enabled() const { return current().coalesce_misses; }
+    int get_coalesce_timeout_ms() const { return current().coalesce_timeout_ms; }
+    int get_connection_timeout() const { return current().connection_timeout; }
+    int get_max_connections() const { return current().max_connections; }
+    int get_listen_backlog() const { return current().listen_backlog; }
+    int get_accept_threads() const { return current().accept_threads; }
+    bool is_cpu_pinning_enabled() const { return current().cpu_pinning; }
+    bool is_stats_enabled() const { return current().enable_stats; }
+    int get_metrics_port() const { return current().metrics_port; }
+    std::string get_io_model() const { return current().io_model; }
+    int get_event_loop_threads() const { return current().event_loop_threads; }
+    bool is_upstream_keepalive_enabled() const { return current().upstream_keepalive; }
+    int get_upstream_pool_per_host() const { return current().upstream_pool_per_host; }
+    int get_upstream_idle_timeout() const { return current().upstream_idle_timeout; }
+    std::string get_dns_server() const { return current().dns_server; }
+    std::string get_dns_hosts_file() const { return current().dns_hosts_file; }
+    int get_dns_timeout_ms() const { return current().dns_timeout_ms; }
+    int get_dns_negative_ttl() const { return current().dns_negative_ttl; }
+    int get_dns_max_ttl() const { return current().dns_max_ttl; }
+
+    // host may carry a ":port", which then wins over port
+    bool is_blocked(const std::string& host, int port = 0) const;
+    bool is_whitelisted(const std::string& host, int port = 0) const;
+    size_t get_blocked_count() const { return current().blocked_hosts.rule_count(); }
+
+    // Setters (thread-safe; each publishes a new snapshot)
     void set_port(int p);
     void set_cache_limit(int limit);
     void add_blocked_host(const std::string& host);
@@ -0,0 +1,42 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include "statistics.h"
+
+// Idle keep-alive connections to origin servers, keyed by "host:port".
+// The pool never dials: callers acquire() an idle socket or connect
+// themselves, and release() sockets whose last response was fully framed.
+class UpstreamPool {
+private:
+    struct IdleConnection {
+        int fd;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::mutex pool_mutex;
+    std::unordered_map<std::string, std::deque<IdleConnection>> idle;
+    size_t max_idle_per_host;
+    int idle_timeout_seconds;
+    Statistics* stats;
+
+    static bool is_alive(int fd);
+
+public:
+    UpstreamPool(size_t max_per_host, int idle_timeout, Statistics* stats_mgr);
+    ~UpstreamPool();
+
+    // Returns an idle connection to host:port, or -1 if none is usable
+    int acquire(const std::string& host, int port);
+    void release(const std::string& host, int port, int fd);
+
+    void set_limits(size_t max_per_host, int idle_timeout);
+    void cleanup_idle();
+    size_t idle_count();
+};
+
+#endif // CONNECTION_POOL_H
@@ -0,0 +1,77 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include "logger.h"
+#include "statistics.h"
+
+// Second cache tier on disk. Objects are appended to fixed-size segment
+// files and located through an in-memory index; reads copy straight out of
+// a read-only mmap of the segment. Space is reclaimed a whole segment at a
+// time, oldest first, so writes are always sequential. The index is rebuilt
+// from the segment files at startup, so the tier survives restarts.
+class DiskCache {
+private:
+    struct Segment {
+        uint32_t id;
+        int fd;
+        char* map;
+        size_t capacity;
+        std::string path;
+
+        ~Segment();
+    };
+
+    struct Location {
+        std::shared_ptr<Segment> segment;
+        size_t offset;      // start of the object's data
+        size_t length;
+        time_t expires;
+    };
+
+    Logger* logger;
+    Statistics* stats;
+    std::string directory;
+    size_t max_bytes;
+    size_t segment_bytes;
+
+    std::mutex disk_mutex;
+    std::unordered_map<std::string, Location> index;
+    std::map<uint32_t, std::shared_ptr<Segment>> segments;  // oldest first
+    std::shared_ptr<Segment> active;
+    size_t active_offset;
+    uint32_t next_segment_id;
+    std::atomic<size_t> stored_bytes;
+
+    std::string segment_path(uint32_t id) const;
+    std::shared_ptr<Segment> open_segment(uint32_t id, bool create);
+    void load_segment(const std::shared_ptr<Segment>& segment);
+    bool start_segment();
+    void drop_oldest_segment();
+
+public:
+    DiskCache(const std::string& dir, size_t max_size_bytes, size_t segment_size_bytes,
+              Logger* log, Statistics* stats_mgr);
+    ~DiskCache();
+
+    // Create the directory and index any segments left by a previous run
+    bool open();
+
+    bool get(const std::string& key, std::string& data, time_t& expires);
+    void put(const std::string& key, const std::string& data, time_t expires);
+    bool contains(const std::string& key);
+    void remove(const std::string& key);
+    void clear();
+
+    size_t entry_count();
+    size_t get_stored_bytes() const { return stored_bytes.load(); }
+};
+
+#endif // DISK_CACHE_H
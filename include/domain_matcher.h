@@ -0,0 +1,83 @@
+#ifndef DOMAIN_MATCHER_H
+#define DOMAIN_MATCHER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Compiled set of host rules, used for BLOCK and WHITELIST:
+//
+//   example.com         exactly that host
+//   *.example.com       any subdomain, not the name itself
+//   .example.com        the name and any subdomain
+//   example.com:8080    any of the above limited to one port
+//
+// Names are stored as a trie over reversed labels (com -> example -> www)
+// whose nodes sit directly in one open-addressing hash table keyed by
+// (parent, label). A lookup costs one probe per label of the host, whatever
+// the rule count. Matching is case-insensitive and ignores a trailing dot;
+// a ":port" suffix (and IPv6 brackets) on the host is split off first.
+// Instances are immutable once built, so a reload builds a new one and
+// swaps it in.
+class DomainMatcher {
+private:
+    enum Flags : uint8_t {
+        EXACT = 1,      // rule for the name itself
+        SUBDOMAINS = 2, // rule for names below it
+        PORTS = 4       // has port-limited rules in port_rules
+    };
+
+    static constexpr size_t INLINE_LABEL = 10;
+    static constexpr uint32_t ROOT = 0xFFFFFFFF;
+
+    // One trie node, i.e. the edge labelled `label` below `parent`
+    struct Entry {
+        uint32_t parent;           // table index of the parent node, or ROOT
+        uint8_t label_length;      // 0 = free slot
+        uint8_t flags;
+        char label[INLINE_LABEL];  // the label, or its offset into long_labels
+    };
+
+    struct PortRule {
+        uint32_t node;
+        uint16_t port;
+        uint8_t flags;
+    };
+
+    std::vector<Entry> table;
+    std::vector<uint32_t> order;       // nodes by insertion, parents first; build only
+    std::vector<PortRule> port_rules;  // sorted by node once built
+    std::string long_labels;
+    size_t rule_total;
+
+    static uint64_t hash_edge(uint32_t parent, const char* label, size_t length);
+    static bool split_port(std::string_view host, std::string_view& name, int& port);
+    const char* label_of(const Entry& entry) const;
+    uint32_t find_child(uint32_t parent, const char* label, size_t length) const;
+    uint32_t place(uint32_t parent, const char* label, size_t length);
+    void grow();
+    bool add_rule(const std::string& rule);
+    bool port_allows(uint32_t node, int port, uint8_t flag) const;
+
+public:
+    DomainMatcher();
+    // Rules that are not host names are skipped (see rule_count())
+    explicit DomainMatcher(const std::vector<std::string>& rules);
+
+    // port 0 means unknown: only rules without a port can match
+    bool matches(std::string_view host, int port = 0) const;
+
+    bool empty() const { return rule_total == 0; }
+    size_t rule_count() const { return rule_total; }
+    size_t node_count() const;
+    size_t memory_bytes() const;
+
+    // Lower-cases host into out, drops a trailing dot and splits off a
+    // ":port" (set to 0 if there is none). False if out is too small.
+    static bool normalize(std::string_view host, char* out, size_t out_size,
+                          size_t& length, int& port);
+};
+
+#endif // DOMAIN_MATCHER_H
@@ -0,0 +1,206 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include "logger.h"
+#include "cache_manager.h"
+#include "config_manager.h"
+#include "statistics.h"
+#include "request_handler.h"
+#include "relay.h"
+#include "http_framing.h"
+#include "connection_pool.h"
+#include "resolver.h"
+#include "request_parser.h"
+#include "uring.h"
+#include "request_coalescer.h"
+
+enum class ConnState {
+    READ_REQUEST,   // waiting for the next request header from the client
+    COALESCING,     // waiting for another request's fetch of the same URL
+    RESOLVING,      // waiting for the resolver to answer for the origin
+    CONNECTING,     // non-blocking connect() to the origin in progress
+    FETCH,          // HTTP: sending request upstream, relaying response back
+    TUNNEL,         // CONNECT: bidirectional relay
+    DRAIN           // flushing a complete response, then next request or close
+};
+
+struct Connection {
+    uint64_t id;              // tells a reused client fd apart in late DNS answers
+    int client_fd;
+    int upstream_fd;
+    ConnState state;
+    bool is_connect;
+    bool client_eof;          // io_uring: the client's multishot recv saw EOF
+    bool recv_armed;          // io_uring: a multishot recv owns the client's read side
+    bool upstream_eof;
+
+    std::string client_ip;
+    std::string host;
+    std::string origin;       // host and port actually dialed
+    int origin_port;
+    std::vector<ResolvedAddress> addresses;  // origin addresses not yet tried
+    size_t next_address;
+    std::string request;      // client bytes not yet consumed (may hold body or pipelined requests)
+    RequestParser parser;     // resumes on c->request, then points into c->header
+    std::string header;       // header block of the request being served
+    std::string to_client;    // pending bytes for the client
+    std::string to_upstream;  // pending bytes for the origin
+    CachedResponse cached;    // cache hit being sent from the shared buffer
+    CachedResponse stale;     // expired entry being revalidated with the origin
+    std::string held;         // origin bytes held until the revalidation's status is known
+    size_t cached_sent;
+    std::string cache_key;
+    bool flight_leader;       // this request's fetch is the one others wait for
+    std::string upstream_request;  // kept to retry on a fresh connection
+    size_t request_size;
+    bool upstream_reused;          // upstream_fd came from the keep-alive pool
+    bool trailing_data;            // origin sent bytes past the framed response
+    bool keep_alive;               // serve another request after this one
+    BodyFramer body;               // current request's body, streamed upstream or skipped
+    int served;                    // requests completed on this connection
+
+    CacheTee* tee;                     // HTTP fetches only
+    ResponseFramer* framer;
+
+    RelayChannel* client_to_upstream;  // CONNECT tunnels only
+    RelayChannel* upstream_to_client;
+
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point phase_start;  // start of the latency phase in progress
+    std::chrono::steady_clock::time_point last_activity;
+};
+
+// Fixed pool of edge-triggered epoll reactors. Each reactor thread owns the
+// connections it was handed and drives them through ConnState without ever
+// blocking on a socket.
+//
+// In io_uring mode (IO_MODEL=uring) the same state machine runs on
+// completions instead: multishot polls stand in for epoll registrations,
+// client requests arrive through a multishot recv into provided buffers,
+// and the reactors accept with multishot accept. SQEs queued while handling
+// one batch are submitted with the next wait, one io_uring_enter per loop.
+class EventLoop {
+private:
+    struct DnsAnswer {
+        int client_fd;
+        uint64_t conn_id;
+        std::vector<ResolvedAddress> addresses;
+    };
+
+    struct FlightLanded {
+        int client_fd;
+        uint64_t conn_id;
+        int served;  // which request on the connection was waiting
+    };
+
+    struct Listener {
+        int fd;
+        int index;   // position in the server's listener list, for stats
+        bool armed;  // a multishot accept is in flight
+    };
+
+    struct Reactor {
+        int epoll_fd;
+        IoUring* ring;  // set instead of epoll_fd in io_uring mode
+        int wake_fd;
+        std::vector<Listener> listeners;  // io_uring mode: accepted in this reactor
+        std::vector<int> parked;          // accepted while no connection slot was free
+        std::thread thread;
+        std::mutex pending_mutex;
+        std::vector<int> pending;
+        std::vector<DnsAnswer> answers;   // filled by the resolver thread
+        std::vector<FlightLanded> landed; // filled by the thread ending a fetch
+        std::unordered_map<int, Connection*> conns;  // client and upstream fd -> connection
+    };
+
+    Logger* logger;
+    CacheManager* cache;
+    ConfigManager* config;
+    Statistics* stats;
+    RequestHandler* handler;
+    UpstreamPool* pool;
+    Resolver* resolver;
+    RequestCoalescer* coalescer;  // nullptr until set_coalescer()
+
+    std::vector<Reactor*> reactors;
+    std::atomic<bool> running;
+    std::atomic<unsigned int> next_reactor;
+    std::atomic<uint64_t> next_conn_id;
+    std::function<void()> on_connection_closed;
+
+    bool use_uring;
+    std::vector<int> listen_fds;
+    std::function<bool()> admit_connection;
+
+    void run(Reactor* r);
+    void run_epoll(Reactor* r);
+    void run_uring(Reactor* r);
+    void drain_wake(Reactor* r);
+    void on_completion(Reactor* r, const io_uring_cqe& cqe);
+    Connection* find_connection(Reactor* r, int fd, uint32_t id);
+    void arm_accept(Reactor* r, size_t slot);
+    void accept_client(Reactor* r, int client, int listener);
+    void admit_parked(Reactor* r);
+    bool arm_recv(Reactor* r, Connection* c);
+    void stop_recv(Reactor* r, Connection* c);
+    bool watch(Reactor* r, Connection* c, int fd);
+    void close_fd(Reactor* r, int fd);
+    void register_client(Reactor* r, int client);
+    void handle_event(Reactor* r, Connection* c, bool from_upstream, uint32_t events);
+    void progress(Reactor* r, Connection* c);
+    bool read_request(Reactor* r, Connection* c);
+    void next_request(Connection* c);
+    void dispatch(Reactor* r, Connection* c);
+    void serve_or_fetch(Reactor* r, Connection* c, bool waited);
+    void on_landed(Reactor* r, const FlightLanded& landed);
+    void end_flight(Connection* c);
+    void begin_connect(Reactor* r, Connection* c, bool allow_pool);
+    void on_resolved(Reactor* r, const DnsAnswer& answer);
+    void connect_next_address(Reactor* r, Connection* c);
+    void wake(Reactor* r);
+    bool watch_upstream(Reactor* r, Connection* c, int sock);
+    void release_upstream(Reactor* r, Connection* c);
+    void finish_connect(Reactor* r, Connection* c);
+    bool relay(Reactor* r, Connection* c);
+    bool relay_tunnel(Connection* c);
+    void finish_fetch(Connection* c);
+    void end_phase(Connection* c, LatencyPhase phase);
+    void fail(Connection* c, const std::string& message);
+    void close_connection(Reactor* r, Connection* c);
+    void sweep_idle(Reactor* r);
+
+public:
+    EventLoop(Logger* log, CacheManager* cache_mgr, ConfigManager* config_mgr,
+              Statistics* stats_mgr, RequestHandler* request_handler,
+              Resolver* dns, UpstreamPool* upstream_pool, int num_threads, bool uring = false);
+    ~EventLoop();
+
+    // Used in io_uring mode only: the reactors accept on these sockets
+    // themselves (multishot accept), calling admit() for a connection slot
+    // first. Must be called before start(); see accepts_connections().
+    void set_listeners(const std::vector<int>& fds, std::function<bool()> admit);
+    void set_coalescer(RequestCoalescer* flights) { coalescer = flights; }
+
+    // pin_cpus pins reactor i to CPU i (modulo the online CPUs)
+    bool start(std::function<void()> on_closed = nullptr, bool pin_cpus = false);
+    void stop();
+
+    // Hand an accepted client socket to one of the reactors: round robin,
+    // or reactor (modulo the count) so a listener can keep its own reactor
+    void add_client(int client, int reactor = -1);
+    int thread_count() const { return (int)reactors.size(); }
+    bool uses_uring() const { return use_uring; }
+    bool accepts_connections() const { return use_uring && !listen_fds.empty(); }
+
+    static bool pin_to_cpu(std::thread& thread, int cpu);
+};
+
+#endif // EVENT_LOOP_H
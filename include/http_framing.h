@@ -0,0 +1,80 @@
+#ifndef HTTP_FRAMING_H
+#define HTTP_FRAMING_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Frames a message body whose length is known up front or given by chunked
+// transfer coding. Used for request bodies and by ResponseFramer. Only a
+// chunk-size or trailer line is ever buffered, so memory stays bounded.
+class BodyFramer {
+private:
+    enum Phase { LENGTH, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER, DONE, INVALID };
+
+    Phase phase;
+    uint64_t remaining;
+    std::string line;
+
+public:
+    // An empty body; complete until start_length() or start_chunked()
+    BodyFramer();
+
+    void start_length(uint64_t length);
+    void start_chunked();
+
+    // Returns how many of the len bytes belong to the body
+    size_t feed(const char* data, size_t len);
+
+    bool complete() const { return phase == DONE; }
+    // Malformed chunk framing; nothing after it can be trusted
+    bool failed() const { return phase == INVALID; }
+};
+
+// Incremental HTTP/1.x response framer. Bytes are fed as they arrive and
+// the framer reports how many belong to the current message, which lets a
+// persistent upstream connection be reused once the message is complete.
+// Handles Content-Length, chunked transfer coding (with trailers),
+// body-less statuses and read-until-close bodies.
+class ResponseFramer {
+private:
+    enum Phase {
+        HEADER,
+        BODY,
+        BODY_UNTIL_CLOSE,
+        DONE
+    };
+
+    Phase phase;
+    bool head_request;
+    bool keep_alive_allowed;
+    bool ended_by_close;
+    int status_code;
+    std::string line;  // header block
+    BodyFramer body;
+
+    void parse_header();
+
+public:
+    explicit ResponseFramer(bool is_head_request = false);
+
+    // Returns how many of the len bytes belong to this message
+    size_t feed(const char* data, size_t len);
+
+    // The origin closed the connection
+    void on_eof();
+
+    bool headers_done() const { return phase != HEADER; }
+    bool complete() const { return phase == DONE; }
+    bool keep_alive() const { return keep_alive_allowed && phase == DONE; }
+    int status() const { return status_code; }
+
+    // The message end was known without the origin closing the connection,
+    // so it can be forwarded on a persistent client connection
+    bool self_delimited() const { return phase == DONE && !ended_by_close; }
+
+    // Same check for a complete stored response (e.g. a cache entry)
+    static bool is_self_delimited(const std::string& response);
+};
+
+#endif // HTTP_FRAMING_H
@@ -0,0 +1,57 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Stages of a proxied request whose latency is tracked separately
+enum LatencyPhase {
+    PHASE_DNS,          // resolving the origin
+    PHASE_CONNECT,      // TCP connect to the origin
+    PHASE_TTFB,         // request sent -> first response byte
+    PHASE_TRANSFER,     // first response byte -> last
+    PHASE_CACHE_HIT,    // cache lookup -> response delivered
+    PHASE_COUNT
+};
+
+const char* latency_phase_name(LatencyPhase phase);
+
+// HDR-style histogram of microsecond latencies. Values below 2^SUB_BITS get
+// a bucket each; above that every power of two is split into 2^SUB_BITS
+// linear buckets, so any recorded value is off by at most ~3%. Memory is
+// fixed and recording is a couple of relaxed atomic adds, no lock.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXPONENT = 35;  // values are clamped to ~19 hours
+    static const int BUCKET_COUNT = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+    // Point-in-time copy used to answer several percentile queries
+    struct Snapshot {
+        uint64_t counts[BUCKET_COUNT];
+        uint64_t total;
+        uint64_t sum_us;
+        uint64_t max_us;
+
+        uint64_t percentile(double p) const;
+        double mean() const { return total ? (double)sum_us / total : 0.0; }
+    };
+
+    LatencyHistogram();
+
+    void record(uint64_t us);
+    void snapshot(Snapshot& out) const;
+    void reset();
+
+    static size_t bucket_index(uint64_t us);
+    static uint64_t bucket_upper_bound(size_t index);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> sum_us;
+    std::atomic<uint64_t> max_us;
+};
+
+#endif // LATENCY_HISTOGRAM_H
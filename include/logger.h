@@ -2,8 +2,11 @@
 #define LOGGER_H
 
 #include <string>
-#include <fstream>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include "statistics.h"
 
 enum LogLevel {
     DEBUG,
@@ -12,29 +15,64 @@ enum LogLevel {
     ERROR
 };
 
+// Writes to the log file and echoes INFO+ to the console. Synchronous by
+// default; after start_async() callers only format the line and push it
+// onto a lock-free ring, and a writer thread batches lines into large
+// write() calls at least every flush interval.
 class Logger {
 private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        std::string line;
+    };
+
     std::string log_file;
-    LogLevel min_level;
-    std::mutex log_mutex;
-    std::ofstream file;
+    std::atomic<LogLevel> min_level;
+    std::mutex log_mutex;  // synchronous mode only
+    int fd;
+
+    // Async mode: bounded MPSC ring (Vyukov-style sequence numbers)
+    Slot* ring;
+    size_t ring_mask;
+    std::atomic<size_t> ring_tail;   // next slot producers claim
+    size_t ring_head;                // next slot the writer reads
+    std::atomic<bool> async_running;
+    std::thread writer;
+    int flush_interval_ms;
+    bool block_on_overflow;
+    std::atomic<unsigned long long> dropped_lines;
+    Statistics* stats;
 
     std::string get_timestamp();
     std::string level_to_string(LogLevel level);
+    bool enqueue(LogLevel level, std::string& line);
+    void write_line(LogLevel level, const std::string& line);
+    void run_writer();
+    size_t drain(std::string& file_batch, std::string& out_batch, std::string& err_batch);
 
 public:
     Logger(const std::string& filename, LogLevel level = INFO);
     ~Logger();
 
+    // ring_lines is rounded up to a power of two. With block_when_full the
+    // caller waits for space; otherwise the line is dropped and counted.
+    bool start_async(size_t ring_lines, int flush_ms, bool block_when_full);
+    void stop_async();
+    void set_statistics(Statistics* stats_mgr) { stats = stats_mgr; }
+
     void log(LogLevel level, const std::string& message);
     void debug(const std::string& message);
     void info(const std::string& message);
     void warn(const std::string& message);
     void error(const std::string& message);
-    
-    void log_request(const std::string& ip, const std::string& host, 
+
+    void log_request(const std::string& ip, const std::string& host,
                     const std::string& status, size_t bytes = 0);
-    void log_url(const std::string& ip, const std::string& url, const std::string& method);    void set_level(LogLevel level);
+    void log_url(const std::string& ip, const std::string& url, const std::string& method);
+    void set_level(LogLevel level);
+
+    unsigned long long get_dropped_lines() const { return dropped_lines.load(); }
 };
 
 #endif // LOGGER_H
@@ -0,0 +1,61 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <semaphore.h>
+#include "statistics.h"
+#include "cache_manager.h"
+#include "disk_cache.h"
+#include "resolver.h"
+#include "connection_pool.h"
+
+// Renders counters, gauges and latency histograms in the OpenMetrics text
+// format. Output goes into a buffer kept between scrapes and numbers are
+// formatted in place, so after the first scrape rendering allocates
+// nothing (no ostringstream, no temporary strings).
+class MetricsExporter {
+private:
+    Statistics* stats;
+    CacheManager* cache;
+    DiskCache* disk;          // may be nullptr
+    Resolver* resolver;
+    UpstreamPool* pool;       // may be nullptr
+
+    const std::atomic<long>* active_connections;
+    sem_t* connection_slots;
+    int max_connections;
+
+    std::mutex render_mutex;
+    std::string body;                    // reused between scrapes
+    uint64_t totals[Statistics::COUNTER_COUNT];
+    LatencyHistogram::Snapshot snap;
+
+    void append(const char* text);
+    void append(const std::string& text) { body.append(text); }
+    void append_uint(uint64_t value);
+    void append_double(double value);
+    void append_label_value(const std::string& value);
+    void family(const char* name, const char* type, const char* help);
+    void sample(const char* name, const char* suffix, uint64_t value);
+    void histogram(const char* name, const char* phase, const std::string* host);
+    void render();
+    int format_header(char* header, size_t size, bool keep_alive) const;
+
+public:
+    static const char* CONTENT_TYPE;
+
+    MetricsExporter(Statistics* stats_mgr, CacheManager* cache_mgr, DiskCache* disk_cache,
+                    Resolver* dns, UpstreamPool* upstream_pool);
+
+    void set_connection_gauges(const std::atomic<long>* active, sem_t* slots, int max_slots);
+
+    // Appends the HTTP response to out, e.g. a connection's reused output
+    // buffer in the event loop
+    void append_response(std::string& out, bool keep_alive);
+    // Renders and writes the HTTP response straight from the reusable buffer
+    bool send_response(int fd, bool keep_alive = false);
+};
+
+#endif // METRICS_EXPORTER_H
@@ -3,16 +3,23 @@
 
 #include <string>
 #include <atomic>
+#include <thread>
+#include <vector>
 #include <semaphore.h>
 #include "logger.h"
 #include "cache_manager.h"
 #include "config_manager.h"
 #include "statistics.h"
 #include "request_handler.h"
+#include "event_loop.h"
+#include "metrics_exporter.h"
 
 class ProxyServer {
 private:
-    int server_socket;
+    // One listening socket, or ACCEPT_THREADS of them bound to the same
+    // port with SO_REUSEPORT, each drained by its own accept thread
+    std::vector<int> listen_sockets;
+    std::vector<std::thread> acceptors;  // joined by stop()
     std::atomic<bool> running;
     
     Logger* logger;
@@ -20,12 +27,28 @@ private:
     ConfigManager* config;
     Statistics* stats;
     RequestHandler* handler;
+    UpstreamPool* upstream_pool;  // nullptr when UPSTREAM_KEEPALIVE=false
+    Resolver* resolver;
+    RequestCoalescer* coalescer;  // shared by both I/O models
+    DiskCache* disk_cache;  // nullptr unless DISK_CACHE_DIR is set
+    EventLoop* event_loop;  // Only set when IO_MODEL=epoll or uring
+    MetricsExporter* metrics;
     
     sem_t* connection_semaphore;  // Pointer for named semaphore (macOS compatible)
     int max_connections;
+    std::atomic<long> active_connections;
+    
+    // Optional scrape listener (METRICS_PORT), served by its own thread so
+    // scrapes neither wait for nor take a MAX_CONNECTIONS slot
+    int metrics_socket;
+    std::thread metrics_thread;
     
     bool setup_socket();
-    void accept_connections();
+    bool setup_metrics_socket();
+    void serve_metrics();
+    bool try_acquire_connection_slot();
+    void release_connection_slot();
+    void accept_connections(int listener);
     void handle_stats_request(int client);
 
 public:
@@ -0,0 +1,47 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+
+// One direction of a byte relay between two non-blocking sockets.
+// Data moves socket -> pipe -> socket with splice() so it never enters user
+// space; if the kernel refuses to splice these fds the channel falls back
+// to a recv/send copy through a small buffer.
+class RelayChannel {
+private:
+    int from;
+    int to;
+    int pipe_fds[2];
+    size_t pipe_capacity;
+    size_t pending;      // bytes sitting in the pipe or copy buffer
+    size_t copy_offset;  // start of unsent data in copy_buffer
+    bool use_splice;
+    bool source_eof;
+    bool write_shut;
+    size_t total_bytes;
+    std::string copy_buffer;
+
+    ssize_t pump_splice();
+    ssize_t pump_copy();
+
+public:
+    RelayChannel(int from_fd, int to_fd);
+    ~RelayChannel();
+
+    RelayChannel(const RelayChannel&) = delete;
+    RelayChannel& operator=(const RelayChannel&) = delete;
+
+    // Move as much data as possible without blocking.
+    // Returns bytes delivered to the destination, or -1 on error.
+    ssize_t pump();
+
+    bool wants_read() const;
+    bool wants_write() const { return pending > 0; }
+    bool finished() const { return source_eof && pending == 0; }
+    bool is_splicing() const { return use_splice; }
+    size_t bytes() const { return total_bytes; }
+};
+
+#endif // RELAY_H
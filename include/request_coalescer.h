@@ -0,0 +1,47 @@
+#ifndef REQUEST_COALESCER_H
+#define REQUEST_COALESCER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+// Single-flight table for cache misses. The first request to miss on a URL
+// leads: it fetches from the origin and calls finish() once the response
+// is stored (or has turned out not to be cacheable). Requests that miss on
+// the same URL meanwhile follow: they wait for the leader and then read
+// the cache again, fetching for themselves only if the object is still
+// not there or the wait timed out.
+class RequestCoalescer {
+private:
+    struct Flight {
+        bool landed = false;
+        std::vector<std::function<void()>> waiters;  // non-blocking followers
+        std::condition_variable cond;                 // blocking followers
+    };
+
+    std::mutex flights_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+
+public:
+    // Non-blocking. Returns true if the caller leads; otherwise done() is
+    // called from the leader's thread when its fetch is over.
+    bool join(const std::string& key, std::function<void()> done);
+
+    // Blocking, for thread-per-connection handlers. Returns true if the
+    // caller leads; otherwise waits up to timeout_ms for the leader and
+    // returns false (timed_out tells the two outcomes apart).
+    bool lead_or_wait(const std::string& key, int timeout_ms, bool& timed_out);
+
+    // Starts a flight only if none is in progress for key, e.g. for a
+    // background refresh that nobody waits on. Returns true if it did.
+    bool try_lead(const std::string& key);
+
+    // Called once by the leader; releases every follower
+    void finish(const std::string& key);
+};
+
+#endif // REQUEST_COALESCER_H
@@ -2,34 +2,139 @@
 #define REQUEST_HANDLER_H
 
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
 #include "logger.h"
 #include "cache_manager.h"
 #include "config_manager.h"
 #include "statistics.h"
+#include "relay.h"
+#include "cache_tee.h"
+#include "http_framing.h"
+#include "connection_pool.h"
+#include "resolver.h"
+#include "metrics_exporter.h"
+#include "request_parser.h"
+#include "request_coalescer.h"
+
+struct FetchResult {
+    bool complete;        // the whole response was framed
+    bool self_delimited;  // its end was known without the origin closing
+    bool client_ok;       // every byte reached the client
+    bool body_complete;   // the whole request body was read from the client
+    size_t body_bytes;    // request body bytes sent upstream
+    bool not_modified;    // a revalidation was answered 304; nothing was sent
+};
 
 class RequestHandler {
 private:
+    // A stale-while-revalidate refresh waiting for a worker
+    struct RefreshJob {
+        std::string url;
+        std::string origin;
+        int port;
+        std::string upstream_request;
+        CachedResponse stale;
+    };
+
+    static const size_t REFRESH_WORKERS = 2;
+    static const size_t REFRESH_QUEUE = 64;  // further refreshes are dropped
+
     Logger* logger;
     CacheManager* cache;
     ConfigManager* config;
     Statistics* stats;
+    UpstreamPool* pool;  // nullptr when upstream keep-alive is disabled
+    Resolver* resolver;
+    MetricsExporter* metrics;  // nullptr until set_metrics_exporter()
+    RequestCoalescer* coalescer;  // nullptr until set_coalescer()
+
+    // Refresh workers start with the first refresh and are joined by the
+    // destructor; refresh_mutex guards the queue and refresh_stopping
+    std::mutex refresh_mutex;
+    std::condition_variable refresh_cond;
+    std::deque<RefreshJob> refresh_queue;
+    std::vector<std::thread> refresh_workers;
+    bool refresh_stopping;
     
-    void tunnel(int client, int remote);
-    bool handle_https_connect(int client, const std::string& request, const std::string& client_ip);
-    bool handle_http_request(int client, const std::string& request, const std::string& client_ip);
+    void tunnel(int client, int remote, const std::string& host);
+    bool handle_https_connect(int client, const RequestParser& request, const std::string& client_ip,
+                              const std::string& early_data);
+    // Returns true if the response was delivered in full and self-delimited,
+    // i.e. the client connection can carry another request
+    bool handle_http_request(int client, const RequestParser& request, const std::string& client_ip,
+                             BodyFramer& body, std::string& pending);
+    // client -1 fetches for the cache only. With revalidating set the
+    // response is held back until its status is known, and a 304 is
+    // never sent to the client.
+    bool fetch_upstream(int client, const std::string& origin, int port,
+                        const std::string& upstream_request, BodyFramer& body, std::string& pending,
+                        bool head_request, bool revalidating, CacheTee& tee, FetchResult& result);
+    bool forward_body(int client, int remote, BodyFramer& body, std::string& pending,
+                      size_t& forwarded, bool& upstream_ok);
     
-    std::string extract_host(const std::string& request);
-    std::string extract_path(const std::string& request);
     int connect_to_host(const std::string& host, int port);
+    void record_latency(LatencyPhase phase, const std::string& host,
+                        std::chrono::steady_clock::time_point since);
+    void run_refreshes();
+    void refresh(RefreshJob& job);
     
     void send_forbidden(int client);
     void send_error(int client, const std::string& message);
 
 public:
     RequestHandler(Logger* log, CacheManager* cache_mgr, 
-                   ConfigManager* config_mgr, Statistics* stats_mgr);
+                   ConfigManager* config_mgr, Statistics* stats_mgr, Resolver* dns,
+                   UpstreamPool* upstream_pool = nullptr);
+    ~RequestHandler();
     
     void handle_client(int client);
+    // Queues a revalidation (or refetch) of the stale entry for url on a
+    // refresh worker, then ends the url's flight in the coalescer, which
+    // the caller must have started with try_lead(). With the queue full
+    // the refresh is skipped and the flight ended at once.
+    void refresh_in_background(const std::string& url, const std::string& origin, int port,
+                               std::string upstream_request, CachedResponse stale);
+    // Joins the refresh workers and ends the flights of queued refreshes.
+    // Finishing a flight runs its followers' callbacks, so the event loop
+    // they point into must still exist; later refreshes are skipped.
+    void stop_refreshes();
+    void set_metrics_exporter(MetricsExporter* exporter) { metrics = exporter; }
+    void set_coalescer(RequestCoalescer* flights) { coalescer = flights; }
+    
+    // Shared with the epoll event loop
+    static void split_host_port(const std::string& hostport, int default_port,
+                                std::string& host, int& port);
+    static bool is_stats_request(const RequestParser& request);
+    static bool is_latency_request(const RequestParser& request);
+    static bool is_metrics_request(const RequestParser& request);
+    static std::string forbidden_response();
+    static std::string error_response(const std::string& message);
+    static std::string parse_error_response(RequestParser::Status status);
+    // Request line and end-to-end headers for the origin, Host rewritten
+    // and hop-by-hop headers replaced by our own Connection header
+    static std::string upstream_request_header(const RequestParser& request,
+                                               const std::string& host, bool keep_alive);
+    static void frame_body(const RequestParser& request, BodyFramer& body);
+    static bool expects_continue(const RequestParser& request);
+    static bool is_cacheable_method(const RequestParser& request);
+    static bool invalidates_cache(const RequestParser& request);
+    // The client sent validators or a range of its own
+    static bool is_conditional(const RequestParser& request);
+    // Adds If-None-Match / If-Modified-Since from the stored response's
+    // ETag / Last-Modified; false if it carries neither
+    static bool add_validators(std::string& upstream_request, const std::string& stored);
+    std::string stats_response();
+    std::string latency_response();
+    // The /metrics response on the proxy port; rendered into the
+    // exporter's reused buffer rather than a fresh string
+    bool send_metrics(int client, bool keep_alive);
+    void append_metrics_response(std::string& out, bool keep_alive);
 };
 
 #endif // REQUEST_HANDLER_H
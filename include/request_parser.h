@@ -0,0 +1,106 @@
+#ifndef REQUEST_PARSER_H
+#define REQUEST_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental HTTP/1.x request header parser. The caller appends received
+// bytes to its own buffer and calls parse() with the whole buffer each
+// time; parsing resumes where it stopped, so a header split over many reads
+// is scanned once. Nothing is copied: results are offsets into the buffer,
+// exposed as string_views, and parse() itself never allocates.
+class RequestParser {
+public:
+    enum Status {
+        INCOMPLETE,    // need more bytes
+        COMPLETE,      // header block parsed; header_size() bytes consumed
+        TOO_LARGE,     // header block or header count over the limit
+        BAD_REQUEST    // malformed request line or header
+    };
+
+    static const size_t MAX_HEADERS = 64;
+
+private:
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Header {
+        Span name;
+        Span value;
+    };
+
+    enum State { REQUEST_LINE, HEADER_LINE, DONE };
+
+    const char* base;
+    size_t max_header_bytes;
+    State state;
+    Status result;
+    size_t scanned;       // bytes examined so far
+    size_t line_start;
+
+    Span method_span;
+    Span target_span;
+    Span path_span;       // origin-form path, also for absolute-form targets
+    Span authority_span;  // from an absolute-form or CONNECT target
+    Span host_span;       // Host header
+    int minor_version;
+
+    Header headers[MAX_HEADERS];
+    size_t header_total;
+
+    bool has_content_length;
+    uint64_t content_length_value;
+    bool has_transfer_encoding;
+    bool chunked_body;  // final transfer coding is chunked
+    bool connection_close;
+    bool connection_keep_alive;
+
+    std::string_view view(Span span) const { return std::string_view(base + span.offset, span.length); }
+    Status parse_request_line(size_t start, size_t end);
+    Status parse_header_line(size_t start, size_t end);
+
+public:
+    explicit RequestParser(size_t max_header_bytes = 65536);
+
+    // Start over for the next request on the connection
+    void reset();
+
+    // buffer must begin at the request's first byte and only ever grow
+    // between calls until the parse is COMPLETE
+    Status parse(std::string_view buffer);
+    Status status() const { return result; }
+
+    // The header bytes were moved (e.g. copied out of the receive buffer)
+    void rebase(const char* new_base) { base = new_base; }
+
+    // Valid once COMPLETE, while the parsed bytes stay where they are
+    size_t header_size() const { return scanned; }
+    std::string_view method() const { return view(method_span); }
+    std::string_view target() const { return view(target_span); }
+    // Origin-form path, from an absolute-form target too; "/" is added when
+    // the target has none, so "http://h?x=1" gives "/?x=1"
+    std::string path() const;
+    // Authority of an absolute-form or CONNECT target, else the Host header
+    std::string_view host() const;
+    int http_minor() const { return minor_version; }
+    bool is_connect() const { return method() == "CONNECT"; }
+
+    size_t content_length() const { return chunked_body ? 0 : content_length_value; }
+    bool chunked() const { return chunked_body; }
+    // HTTP/1.1 default unless "Connection: close"; HTTP/1.0 needs keep-alive
+    bool keep_alive() const;
+
+    size_t header_count() const { return header_total; }
+    std::string_view header_name(size_t i) const { return view(headers[i].name); }
+    std::string_view header_value(size_t i) const { return view(headers[i].value); }
+    // Case-insensitive lookup; empty if absent
+    std::string_view header(std::string_view name) const;
+
+    static bool iequals(std::string_view a, std::string_view b);
+};
+
+#endif // REQUEST_PARSER_H
@@ -0,0 +1,115 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/socket.h>
+#include "logger.h"
+#include "statistics.h"
+
+struct ResolvedAddress {
+    int family;                 // AF_INET or AF_INET6
+    unsigned char bytes[16];    // network byte order, 4 or 16 used
+
+    // Fill a sockaddr for this address and port; returns its length
+    socklen_t to_sockaddr(int port, sockaddr_storage& out) const;
+};
+
+// Called with the addresses found; empty means the lookup failed
+typedef std::function<void(const std::vector<ResolvedAddress>&)> ResolveCallback;
+
+// Caching stub resolver. Answers come from a hosts file, an in-memory cache
+// that honours record TTLs (including negative answers), or A/AAAA queries
+// sent over UDP to the configured nameserver. Concurrent lookups of the
+// same name share one query. Without a usable nameserver it falls back to
+// getaddrinfo() on a helper thread, cached for a fixed TTL.
+//
+// Each query goes out from its own socket (a fresh ephemeral port) with
+// random IDs, and an answer is only taken if it arrives on that socket
+// and echoes the question asked.
+class Resolver {
+private:
+    struct CacheEntry {
+        std::vector<ResolvedAddress> addresses;  // empty = negative entry
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct PendingQuery {
+        std::string host;
+        int sock;  // connected to the nameserver; -1 for getaddrinfo
+        uint16_t id_a;
+        uint16_t id_aaaa;
+        bool a_done;
+        bool aaaa_done;
+        bool nxdomain;
+        std::vector<ResolvedAddress> v4;
+        std::vector<ResolvedAddress> v6;
+        uint32_t min_ttl;
+        uint32_t negative_ttl;
+        int attempts;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point last_sent;
+        std::vector<ResolveCallback> waiters;
+    };
+
+    Logger* logger;
+    Statistics* stats;
+
+    std::mutex resolver_mutex;
+    std::unordered_map<std::string, CacheEntry> cache;
+    std::unordered_map<std::string, std::vector<ResolvedAddress>> hosts;
+    std::unordered_map<std::string, PendingQuery*> inflight;
+    std::unordered_map<uint16_t, PendingQuery*> by_id;
+    // Only the worker polls query sockets, so only it closes them,
+    // between polls; a reused fd number is then never polled as the old one
+    std::vector<int> retired_sockets;
+    int wake_fd;  // eventfd: a new query socket joins the poll set
+    sockaddr_storage nameserver;
+    socklen_t nameserver_len;
+    int timeout_ms;
+    int max_attempts;
+    uint32_t negative_ttl;
+    uint32_t max_ttl;
+
+    std::atomic<bool> running;
+    std::atomic<int> fallback_threads;
+    std::thread worker;
+
+    bool configure_nameserver(const std::string& server);
+    int open_socket();
+    void load_hosts_file(const std::string& path);
+    bool send_queries(PendingQuery* query);
+    void run();
+    void handle_response(int fd, const unsigned char* buf, size_t len);
+    void check_timeouts();
+    void complete(PendingQuery* query, std::vector<ResolveCallback>& callbacks,
+                  std::vector<ResolvedAddress>& result);
+    void fallback_lookup(const std::string& host);
+
+public:
+    // server: "ip[:port]", or empty to use the first nameserver in /etc/resolv.conf
+    Resolver(Logger* log, Statistics* stats_mgr, const std::string& server,
+             const std::string& hosts_file, int timeout_milliseconds,
+             uint32_t negative_ttl_seconds, uint32_t max_ttl_seconds);
+    ~Resolver();
+
+    // Non-blocking. Returns true with `out` filled (empty on a cached
+    // failure) when the answer is known now; otherwise returns false and
+    // `done` is invoked later from the resolver thread.
+    bool lookup(const std::string& host, std::vector<ResolvedAddress>& out, ResolveCallback done);
+
+    // Blocking lookup for thread-per-connection handlers
+    bool resolve(const std::string& host, std::vector<ResolvedAddress>& out);
+
+    void stop();
+    size_t cache_size();
+};
+
+#endif // RESOLVER_H
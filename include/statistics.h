@@ -2,10 +2,13 @@
 #define STATISTICS_H
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <mutex>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include "latency_histogram.h"
 
 struct HostStats {
     unsigned long long requests;
@@ -14,45 +17,200 @@ struct HostStats {
     std::chrono::milliseconds total_time;
 };
 
+// Counters are sharded per thread: each recording thread owns a shard and
+// bumps plain relaxed atomics in it, so recording takes no lock and touches
+// no cache line another core writes. Per-host and per-client maps live in
+// the shard too. Readers sum all shards on demand. A thread's shard is
+// recycled for the next thread when it exits, so short-lived handler
+// threads don't grow the shard list.
 class Statistics {
+public:
+    enum Counter {
+        REQUESTS, CACHED, BLOCKED, ERRORS, BYTES_SENT, BYTES_RECEIVED,
+        POOL_HITS, POOL_MISSES,
+        CLIENT_CONNECTIONS, CLIENT_REQUESTS, CLIENT_REUSED_REQUESTS,
+        DNS_HITS, DNS_MISSES, DNS_COALESCED, DNS_QUERIES, DNS_LOOKUP_US,
+        ZERO_COPY_RESPONSES, ZERO_COPY_BYTES,
+        DISK_READS, DISK_READ_BYTES, DISK_WRITES, DISK_WRITTEN_BYTES,
+        LOG_DROPPED,
+        COALESCED, COALESCE_FALLBACKS,
+        REVALIDATED, STALE_SERVED,
+        CACHE_HIT_BYTES, CACHE_MISSES, CACHE_MISS_BYTES,
+        COUNTER_COUNT
+    };
+
 private:
-    mutable std::mutex stats_mutex;  // Made mutable for const methods
-    
-    std::atomic<unsigned long long> total_requests;
-    std::atomic<unsigned long long> total_cached;
-    std::atomic<unsigned long long> total_blocked;
-    std::atomic<unsigned long long> total_errors;
-    std::atomic<unsigned long long> total_bytes_sent;
-    std::atomic<unsigned long long> total_bytes_received;
-    
-    std::unordered_map<std::string, HostStats> per_host_stats;
-    std::unordered_map<std::string, unsigned long long> ip_request_count;
-    
+
+    // Nodes are only ever appended, and only by the owning thread, so
+    // readers can walk the published list without locking
+    struct HostCounters {
+        std::string host;
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> bytes_sent{0};
+        std::atomic<uint64_t> bytes_received{0};
+        std::atomic<uint64_t> time_ms{0};
+        HostCounters* next = nullptr;
+    };
+
+    struct ClientCounter {
+        std::string ip;
+        std::atomic<uint64_t> requests{0};
+        ClientCounter* next = nullptr;
+    };
+
+    struct alignas(64) ThreadShard {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        std::unordered_map<std::string, HostCounters*> host_index;    // owner thread only
+        std::unordered_map<std::string, ClientCounter*> client_index;  // owner thread only
+        std::atomic<HostCounters*> hosts{nullptr};
+        std::atomic<ClientCounter*> clients{nullptr};
+        // Nonzero while the owner records into a host latency slot: the
+        // latency epoch it started in
+        std::atomic<uint64_t> latency_epoch{0};
+    };
+
+    uint64_t instance_id;
+    mutable std::mutex registry_mutex;
+    std::vector<ThreadShard*> shards;       // every shard ever handed out
+    std::vector<ThreadShard*> free_shards;  // left behind by exited threads
+
+    std::atomic<unsigned long long> dns_max_lookup_us;
     std::chrono::system_clock::time_point start_time;
 
+    // Latency histograms are shared rather than per thread (they are too
+    // big to copy per shard); recording is still lock-free. A host hashes
+    // to a run of LATENCY_PROBE slots in a fixed table. A host with no slot
+    // only counts towards the global histograms and a count-min sketch;
+    // it takes a free slot in its run, or the run's least busy one once
+    // the sketch has seen it more than twice as often, so busy hosts that
+    // show up late still get one. Slot changes never block recording
+    // (try_lock; the sample just stays global). A replaced entry is freed
+    // once every thread recording at the time has finished
+    // (ThreadShard::latency_epoch).
+    static const int LATENCY_HOST_SLOTS = 64;
+    static const int LATENCY_PROBE = 8;
+    static const int LATENCY_SKETCH_ROWS = 4;
+    static const int LATENCY_SKETCH_WIDTH = 1024;
+    // Sketch and slot counts are halved after this many samples
+    static const uint64_t LATENCY_AGE_SAMPLES = 16 * LATENCY_SKETCH_WIDTH;
+    struct HostLatency {
+        std::string host;
+        size_t hash;
+        std::atomic<uint64_t> hits{0};  // samples, aged with the sketch
+        LatencyHistogram phases[PHASE_COUNT];
+    };
+    LatencyHistogram latency[PHASE_COUNT];
+    std::atomic<HostLatency*> host_latency[LATENCY_HOST_SLOTS];
+    std::atomic<uint32_t> host_sketch[LATENCY_SKETCH_ROWS * LATENCY_SKETCH_WIDTH];
+    std::atomic<uint64_t> latency_samples;
+    std::atomic<uint64_t> latency_epoch;
+    // Held to change a slot, to free retired entries and to read slots
+    mutable std::mutex latency_mutex;
+    std::vector<std::pair<uint64_t, HostLatency*>> retired_latency;  // (epoch, entry)
+
+    // Accepts per listening socket (ACCEPT_THREADS). Each listener's thread
+    // is the only writer of its slot; slots are padded apart.
+    static constexpr int MAX_LISTENERS = 256;
+    struct alignas(64) ListenerCounter {
+        std::atomic<uint64_t> accepts{0};
+    };
+    ListenerCounter listener_accepts[MAX_LISTENERS];
+    std::atomic<int> listener_count;
+
+    ThreadShard& local();
+    void add(Counter counter, uint64_t amount = 1);
+    uint64_t sum(Counter counter) const;
+    HostCounters& host_counters(ThreadShard& shard, const std::string& host);
+    std::unordered_map<std::string, HostStats> collect_hosts() const;
+    HostLatency* find_host_latency(const std::string& host, size_t hash) const;
+    void admit_host_latency(const std::string& host, size_t hash, LatencyPhase phase, uint64_t us);
+    uint64_t sketch_increment(size_t hash);
+    void age_host_latency();
+    void reclaim_host_latency();
+
+    friend struct ThreadShardCache;
+    void release_shard(ThreadShard* shard);
+
 public:
     Statistics();
-    
+    ~Statistics();
+
     void record_request(const std::string& host, const std::string& client_ip);
-    void record_cached_request();
+    // A response served from cache, and one fetched for a cacheable
+    // request; together they give the object and byte hit ratios
+    void record_cached_request(size_t bytes);
+    void record_cache_miss(size_t bytes);
     void record_blocked_request();
     void record_error();
     void record_bytes(const std::string& host, size_t sent, size_t received);
     void record_time(const std::string& host, std::chrono::milliseconds duration);
-    
-    // Getters
-    unsigned long long get_total_requests() const { return total_requests.load(); }
-    unsigned long long get_cached_requests() const { return total_cached.load(); }
-    unsigned long long get_blocked_requests() const { return total_blocked.load(); }
-    unsigned long long get_error_count() const { return total_errors.load(); }
-    unsigned long long get_bytes_sent() const { return total_bytes_sent.load(); }
-    unsigned long long get_bytes_received() const { return total_bytes_received.load(); }
-    
+    void record_pool_hit();
+    void record_pool_miss();
+    void record_client_connection();
+    void record_client_request(bool reused_connection);
+    void record_dns_lookup(bool cache_hit);
+    void record_dns_coalesced();
+    void record_dns_latency(std::chrono::microseconds duration);
+    void record_zero_copy_response(size_t bytes);
+    void record_disk_cache_read(size_t bytes);
+    void record_disk_cache_write(size_t bytes);
+    void record_log_dropped();
+    // A cache miss that waited for another request's fetch of the URL; a
+    // fallback is one that then had to fetch anyway (timeout, not cached)
+    void record_coalesced_request();
+    void record_coalesce_fallback();
+    // An expired entry the origin confirmed with a 304; a stale response is
+    // one served past expiry while a background refresh ran
+    void record_revalidated();
+    void record_stale_served();
+    void record_latency(LatencyPhase phase, const std::string& host,
+                        std::chrono::microseconds duration);
+    void set_listener_count(int count);
+    void record_accept(int listener);
+
+    // Getters (aggregated across threads on each call)
+    unsigned long long get_total_requests() const { return sum(REQUESTS); }
+    unsigned long long get_cached_requests() const { return sum(CACHED); }
+    unsigned long long get_blocked_requests() const { return sum(BLOCKED); }
+    unsigned long long get_error_count() const { return sum(ERRORS); }
+    unsigned long long get_bytes_sent() const { return sum(BYTES_SENT); }
+    unsigned long long get_bytes_received() const { return sum(BYTES_RECEIVED); }
+    unsigned long long get_pool_hits() const { return sum(POOL_HITS); }
+    unsigned long long get_pool_misses() const { return sum(POOL_MISSES); }
+    unsigned long long get_client_connections() const { return sum(CLIENT_CONNECTIONS); }
+    unsigned long long get_client_requests() const { return sum(CLIENT_REQUESTS); }
+    unsigned long long get_client_reused_requests() const { return sum(CLIENT_REUSED_REQUESTS); }
+    unsigned long long get_dns_hits() const { return sum(DNS_HITS); }
+    unsigned long long get_dns_misses() const { return sum(DNS_MISSES); }
+
     std::string get_summary() const;
     std::string get_json_stats() const;
     std::string get_top_hosts(int limit = 10) const;
     std::string get_client_stats() const;
-    
+    // Percentiles per phase, globally and for the busiest hosts
+    std::string get_latency_json(int top_hosts = 10) const;
+
+    // Raw access for exporters: totals has COUNTER_COUNT entries
+    void snapshot(uint64_t* totals) const;
+    void latency_snapshot(LatencyPhase phase, LatencyHistogram::Snapshot& out) const {
+        latency[phase].snapshot(out);
+    }
+    // visit(host, phases) for every host holding a latency slot
+    template <typename Visitor>
+    void for_each_host_latency(Visitor visit) const {
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        for (const auto& slot : host_latency) {
+            const HostLatency* entry = slot.load(std::memory_order_acquire);
+            if (entry) visit(entry->host, entry->phases);
+        }
+    }
+    unsigned long long get_dns_max_lookup_us() const { return dns_max_lookup_us.load(); }
+    int get_listener_count() const { return listener_count.load(std::memory_order_relaxed); }
+    uint64_t get_listener_accepts(int listener) const {
+        return listener_accepts[listener].accepts.load(std::memory_order_relaxed);
+    }
+
+    // Not synchronized with recording threads; meant for quiescent use
     void reset();
     double get_uptime_seconds() const;
 };
@@ -0,0 +1,98 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Minimal io_uring ring over the raw syscalls (no liburing), with one
+// provided-buffer ring for multishot receives. Owned and used by a single
+// thread. SQEs queued with the prep_* calls go to the kernel together on
+// the next submit() or wait(), so a whole loop iteration costs one
+// io_uring_enter.
+class IoUring {
+private:
+    int ring_fd;
+    unsigned features;
+
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    io_uring_sqe* sqes;
+    unsigned sqe_tail;     // next free SQE, published by submit()/wait()
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    // Provided buffers the kernel picks from for multishot receives. The
+    // ring is addressed as a plain io_uring_buf array: in C++ the header's
+    // flex-array wrapper puts io_uring_buf_ring::bufs 8 bytes too far in.
+    io_uring_buf* buf_ring;
+    size_t buf_ring_size;
+    char* buffers;
+    unsigned buf_count;
+    size_t buf_size;
+    uint16_t buf_group;
+    uint16_t buf_tail;
+
+    io_uring_sqe* get_sqe();
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size);
+
+public:
+    IoUring();
+    ~IoUring();
+
+    // entries is rounded up to a power of two by the kernel
+    bool init(unsigned entries, std::string& error);
+    // count must be a power of two
+    bool setup_buffers(uint16_t group, unsigned count, size_t size, std::string& error);
+
+    // Multishot poll; edge-triggered like EPOLLET. The CQE's res is the mask.
+    bool prep_poll(int fd, uint32_t events, uint64_t user_data);
+    // Multishot accept; each CQE's res is an accepted fd
+    bool prep_accept(int fd, uint64_t user_data);
+    // Multishot recv into the provided buffers (see buffer())
+    bool prep_recv(int fd, uint64_t user_data);
+    bool prep_cancel(uint64_t target_user_data);
+    // Cancels every request on fd, then closes it (hard-linked, so the
+    // close runs even when there was nothing to cancel)
+    bool prep_cancel_and_close(int fd);
+
+    int submit();
+    // Submits and waits up to timeout_ms for at least one completion
+    int wait(int timeout_ms);
+
+    // Calls visit(cqe) for every completion ready now; returns the count
+    template <typename Visitor>
+    unsigned drain(Visitor visit) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            visit(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    const char* buffer(uint16_t id) const { return buffers + (size_t)id * buf_size; }
+    void recycle(uint16_t id);
+
+    // Checks that the running kernel has everything this ring relies on
+    // (setup, buffer rings, multishot recv) by exercising it on a socketpair
+    static bool supported(std::string& reason);
+};
+
+#endif // URING_H
@@ -1,10 +1,56 @@
 #include "../include/cache_manager.h"
 #include <algorithm>
+#include <functional>
 
-CacheManager::CacheManager(size_t max_entries, int default_ttl)
-    : max_entries(max_entries), default_ttl(default_ttl), 
-      total_size(0), max_size_bytes(100 * 1024 * 1024), // 100 MB default
+CacheManager::CacheManager(size_t max_entries, int default_ttl, size_t num_shards,
+                           const std::string& policy, bool favor_bytes)
+    : policy_name(policy), disk(nullptr), default_ttl(default_ttl), max_stale(0), total_size(0),
+      max_entries(max_entries), max_size_bytes(100 * 1024 * 1024), // 100 MB default
       cache_hits(0), cache_misses(0) {
+    num_shards = std::max<size_t>(1, num_shards);
+    for (size_t i = 0; i < num_shards; i++) {
+        Shard* shard = new Shard();
+        shard->total_size = 0;
+        shard->policy = CachePolicy::create(policy_name, favor_bytes);
+        if (!shard->policy) {
+            policy_name = "lru";
+            shard->policy = CachePolicy::create(policy_name);
+        }
+        shards.push_back(shard);
+    }
+    apply_limits();
+}
+
+CacheManager::~CacheManager() {
+    for (Shard* shard : shards) {
+        delete shard->policy;
+        delete shard;
+    }
+}
+
+CacheManager::Shard& CacheManager::shard_for(const std::string& key, size_t& hash) {
+    hash = std::hash<std::string>()(key);
+    return *shards[hash % shards.size()];
+}
+
+// Split the global budgets evenly so each shard enforces its share under
+// its own lock. Caller holds limits_mutex (or is the constructor).
+void CacheManager::apply_limits() {
+    size_t n = shards.size();
+    for (Shard* shard : shards) {
+        Evicted evicted;
+        {
+            std::lock_guard<std::mutex> lock(shard->cache_mutex);
+            shard->max_entries = std::max<size_t>(1, (max_entries + n - 1) / n);
+            shard->max_size_bytes = max_size_bytes / n;
+            shard->policy->set_capacity(shard->max_entries, shard->max_size_bytes);
+            while ((shard->cache.size() > shard->max_entries ||
+                    shard->total_size > shard->max_size_bytes)) {
+                if (!evict_victim(*shard, &evicted)) break;
+            }
+        }
+        demote(evicted);
+    }
 }
 
 bool CacheManager::is_expired(const CacheEntry& entry) {
@@ -12,102 +58,188 @@ bool CacheManager::is_expired(const CacheEntry& entry) {
     return (now - entry.timestamp) > entry.ttl_seconds;
 }
 
-void CacheManager::evict_oldest() {
-    if (lru.empty()) return;
-    
-    std::string oldest = lru.back();
-    lru.pop_back();
-    
-    auto it = cache.find(oldest);
-    if (it != cache.end()) {
-        total_size -= it->second.first.size;
-        cache.erase(it);
+// Too old even to revalidate
+bool CacheManager::is_past_stale(const CacheEntry& entry) {
+    time_t now = time(nullptr);
+    return (now - entry.timestamp) > (time_t)entry.ttl_seconds + max_stale.load();
+}
+
+// Caller holds the shard lock
+void CacheManager::erase_entry(Shard& shard, const std::string& key) {
+    auto it = shard.cache.find(key);
+    if (it == shard.cache.end()) return;
+
+    shard.policy->remove(it->second.node);
+    shard.total_size -= it->second.size;
+    total_size -= it->second.size;
+    shard.cache.erase(it);
+}
+
+bool CacheManager::evict_victim(Shard& shard, Evicted* evicted) {
+    PolicyNode* victim = shard.policy->victim();
+    if (!victim) return false;
+
+    auto it = shard.cache.find(*victim->key);
+    if (evicted && disk && !is_expired(it->second)) {
+        evicted->push_back({it->first, it->second});
     }
+    erase_entry(shard, it->first);
+    return true;
 }
 
-void CacheManager::evict_if_needed(size_t new_size) {
-    while ((cache.size() >= max_entries || total_size + new_size > max_size_bytes) 
-           && !lru.empty()) {
-        evict_oldest();
+// The entry just added may be the one to go (an admission policy can
+// turn it away), but a shard always keeps at least one entry
+void CacheManager::evict_if_needed(Shard& shard, Evicted* evicted) {
+    while ((shard.cache.size() > shard.max_entries ||
+            shard.total_size > shard.max_size_bytes)
+           && shard.cache.size() > 1) {
+        if (!evict_victim(shard, evicted)) break;
     }
 }
 
-bool CacheManager::get(const std::string& key, std::string& data) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    
-    auto it = cache.find(key);
-    if (it == cache.end()) {
-        cache_misses++;
-        return false;
+// Caller holds the shard lock
+void CacheManager::insert(Shard& shard, const std::string& key, size_t hash, CacheEntry entry,
+                          Evicted* evicted) {
+    erase_entry(shard, key);
+    // Would push out the whole shard and still not fit
+    if (entry.size > shard.max_size_bytes) return;
+
+    shard.total_size += entry.size;
+    total_size += entry.size;
+    auto it = shard.cache.emplace(key, std::move(entry)).first;
+    it->second.node = shard.policy->add(&it->first, hash, it->second.size);
+    evict_if_needed(shard, evicted);
+}
+
+// Write entries pushed out of memory to the disk tier. Called without any
+// shard lock held, since this does file I/O.
+void CacheManager::demote(Evicted& evicted) {
+    if (!disk) return;
+    for (auto& item : evicted) {
+        // Promoted entries still have their disk copy
+        if (disk->contains(item.first)) continue;
+        const CacheEntry& entry = item.second;
+        disk->put(item.first, *entry.data, entry.timestamp + entry.ttl_seconds);
     }
-    
-    // Check if expired
-    if (is_expired(it->second.first)) {
-        lru.erase(it->second.second);
-        total_size -= it->second.first.size;
-        cache.erase(it);
+}
+
+bool CacheManager::get(const std::string& key, CachedResponse& data) {
+    CachedResponse found;
+    int stale_seconds;
+    if (lookup(key, found, stale_seconds) != FRESH) return false;
+    data = std::move(found);
+    return true;
+}
+
+CacheManager::Freshness CacheManager::lookup(const std::string& key, CachedResponse& data,
+                                             int& stale_seconds) {
+    size_t hash;
+    Shard& shard = shard_for(key, hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        shard.policy->record_access(hash);
+
+        auto it = shard.cache.find(key);
+        if (it != shard.cache.end()) {
+            const CacheEntry& entry = it->second;
+            if (!is_past_stale(entry)) {
+                shard.policy->touch(entry.node);
+                data = entry.data;
+
+                if (!is_expired(entry)) {
+                    cache_hits++;
+                    return FRESH;
+                }
+                stale_seconds = (int)(time(nullptr) - entry.timestamp - entry.ttl_seconds);
+                cache_misses++;
+                return STALE;
+            }
+            erase_entry(shard, key);
+        }
+    }
+
+    // Try the disk tier and promote a hit back into memory
+    std::string body;
+    time_t expires;
+    if (!disk || !disk->get(key, body, expires)) {
         cache_misses++;
-        return false;
+        return MISS;
+    }
+
+    time_t now = time(nullptr);
+    size_t body_size = body.size();
+    data = std::make_shared<const std::string>(std::move(body));
+
+    Evicted evicted;
+    {
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        insert(shard, key, hash, CacheEntry{data, now, (int)(expires - now), body_size, nullptr},
+               &evicted);
     }
-    
-    // Move to front (most recently used)
-    lru.erase(it->second.second);
-    lru.push_front(key);
-    it->second.second = lru.begin();
-    
-    data = it->second.first.data;
+    demote(evicted);
+
     cache_hits++;
+    return FRESH;
+}
+
+bool CacheManager::refresh(const std::string& key, const CachedResponse& data, int ttl) {
+    size_t hash;
+    Shard& shard = shard_for(key, hash);
+    std::lock_guard<std::mutex> lock(shard.cache_mutex);
+
+    auto it = shard.cache.find(key);
+    if (it == shard.cache.end() || it->second.data != data) return false;
+    it->second.timestamp = time(nullptr);
+    it->second.ttl_seconds = (ttl < 0) ? default_ttl.load() : ttl;
     return true;
 }
 
-void CacheManager::put(const std::string& key, const std::string& data, int ttl) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    
-    int actual_ttl = (ttl < 0) ? default_ttl : ttl;
+void CacheManager::put(const std::string& key, std::string data, int ttl) {
+    int actual_ttl = (ttl < 0) ? default_ttl.load() : ttl;
     size_t data_size = data.size();
-    
-    // Remove existing entry if present
-    auto it = cache.find(key);
-    if (it != cache.end()) {
-        lru.erase(it->second.second);
-        total_size -= it->second.first.size;
-        cache.erase(it);
+    // Built outside the lock; the bytes are moved, not copied
+    CachedResponse response = std::make_shared<const std::string>(std::move(data));
+
+    // A fresh copy supersedes whatever the disk tier holds
+    if (disk) disk->remove(key);
+
+    size_t hash;
+    Shard& shard = shard_for(key, hash);
+    Evicted evicted;
+    {
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        insert(shard, key, hash,
+               CacheEntry{std::move(response), time(nullptr), actual_ttl, data_size, nullptr},
+               &evicted);
     }
-    
-    // Evict if necessary
-    evict_if_needed(data_size);
-    
-    // Add new entry
-    lru.push_front(key);
-    CacheEntry entry{data, time(nullptr), actual_ttl, data_size};
-    cache[key] = {entry, lru.begin()};
-    total_size += data_size;
+    demote(evicted);
 }
 
 void CacheManager::remove(const std::string& key) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    
-    auto it = cache.find(key);
-    if (it != cache.end()) {
-        lru.erase(it->second.second);
-        total_size -= it->second.first.size;
-        cache.erase(it);
+    size_t hash;
+    Shard& shard = shard_for(key, hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.cache_mutex);
+        erase_entry(shard, key);
     }
+    if (disk) disk->remove(key);
 }
 
 void CacheManager::clear() {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    cache.clear();
-    lru.clear();
-    total_size = 0;
+    for (Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+        total_size -= shard->total_size;
+        shard->cache.clear();
+        shard->policy->clear();
+        shard->total_size = 0;
+    }
+    if (disk) disk->clear();
 }
 
 void CacheManager::set_max_entries(size_t max) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::lock_guard<std::mutex> lock(limits_mutex);
     max_entries = max;
-    while (cache.size() > max_entries && !lru.empty()) {
-        evict_oldest();
-    }
+    apply_limits();
 }
 
 void CacheManager::set_default_ttl(int seconds) {
@@ -115,39 +247,40 @@ void CacheManager::set_default_ttl(int seconds) {
 }
 
 void CacheManager::set_max_size(size_t bytes) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::lock_guard<std::mutex> lock(limits_mutex);
     max_size_bytes = bytes;
-    while (total_size > max_size_bytes && !lru.empty()) {
-        evict_oldest();
-    }
+    apply_limits();
 }
 
 size_t CacheManager::size() const {
-    return cache.size();
+    size_t count = 0;
+    for (Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+        count += shard->cache.size();
+    }
+    return count;
 }
 
 double CacheManager::get_hit_rate() const {
-    unsigned long long total = cache_hits + cache_misses;
+    unsigned long long hits = cache_hits.load();
+    unsigned long long total = hits + cache_misses.load();
     if (total == 0) return 0.0;
-    return (double)cache_hits / total * 100.0;
+    return (double)hits / total * 100.0;
 }
 
 void CacheManager::cleanup_expired() {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    
-    auto it = lru.rbegin();
-    while (it != lru.rend()) {
-        auto cache_it = cache.find(*it);
-        if (cache_it != cache.end() && is_expired(cache_it->second.first)) {
-            std::string key = *it;
-            ++it;
-            
-            auto list_it = cache_it->second.second;
-            total_size -= cache_it->second.first.size;
-            cache.erase(cache_it);
-            lru.erase(list_it);
-        } else {
-            ++it;
+    // One shard at a time, so lookups elsewhere keep going
+    for (Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->cache_mutex);
+
+        std::vector<std::string> expired;
+        for (const auto& pair : shard->cache) {
+            if (is_past_stale(pair.second)) {
+                expired.push_back(pair.first);
+            }
+        }
+        for (const std::string& key : expired) {
+            erase_entry(*shard, key);
         }
     }
 }
@@ -0,0 +1,274 @@
+#include "../include/cache_policy.h"
+#include <algorithm>
+
+#define SKETCH_ROWS 4
+#define SKETCH_MAX_WIDTH (1 << 20)
+#define COUNTER_MAX 15
+
+NodeList::NodeList() : count(0), total_bytes(0) {
+    head.prev = head.next = &head;
+}
+
+void NodeList::push_front(PolicyNode* node) {
+    node->prev = &head;
+    node->next = head.next;
+    head.next->prev = node;
+    head.next = node;
+    count++;
+    total_bytes += node->size;
+}
+
+void NodeList::unlink(PolicyNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    count--;
+    total_bytes -= node->size;
+}
+
+void NodeList::move_to_front(PolicyNode* node) {
+    if (head.next == node) return;
+    unlink(node);
+    push_front(node);
+}
+
+void NodeList::clear() {
+    PolicyNode* node = head.next;
+    while (node != &head) {
+        PolicyNode* next = node->next;
+        delete node;
+        node = next;
+    }
+    head.prev = head.next = &head;
+    count = 0;
+    total_bytes = 0;
+}
+
+CachePolicy* CachePolicy::create(const std::string& name, bool favor_bytes) {
+    if (name == "lru") return new LruPolicy();
+    if (name == "tinylfu") return new TinyLfuPolicy();
+    if (name == "gdsf") return new GdsfPolicy(favor_bytes);
+    return nullptr;
+}
+
+PolicyNode* LruPolicy::add(const std::string* key, size_t hash, size_t size) {
+    PolicyNode* node = new PolicyNode{key, hash, size, 0, nullptr, nullptr, 0, 0};
+    lru.push_front(node);
+    return node;
+}
+
+void LruPolicy::remove(PolicyNode* node) {
+    lru.unlink(node);
+    delete node;
+}
+
+void FrequencySketch::resize(size_t expected_entries) {
+    size_t width = 16;
+    while (width < expected_entries && width < SKETCH_MAX_WIDTH) width <<= 1;
+
+    table.assign(SKETCH_ROWS * width, 0);
+    width_mask = width - 1;
+    index_shift = 64;
+    for (size_t w = width; w > 1; w >>= 1) index_shift--;
+    additions = 0;
+    sample_size = 10 * width;
+}
+
+// Multiplicative hashing with a different odd constant per row; the top
+// bits pick the counter
+size_t FrequencySketch::index(size_t hash, int row) const {
+    static const uint64_t SEEDS[SKETCH_ROWS] = {
+        0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+    };
+    uint64_t h = ((uint64_t)hash ^ (row + 1)) * SEEDS[row];
+    return row * (width_mask + 1) + (size_t)((h >> index_shift) & width_mask);
+}
+
+void FrequencySketch::increment(size_t hash) {
+    if (table.empty()) return;
+
+    bool added = false;
+    for (int row = 0; row < SKETCH_ROWS; row++) {
+        uint8_t& counter = table[index(hash, row)];
+        if (counter < COUNTER_MAX) {
+            counter++;
+            added = true;
+        }
+    }
+    if (added && ++additions >= sample_size) age();
+}
+
+int FrequencySketch::frequency(size_t hash) const {
+    if (table.empty()) return 0;
+
+    int lowest = COUNTER_MAX;
+    for (int row = 0; row < SKETCH_ROWS; row++) {
+        lowest = std::min<int>(lowest, table[index(hash, row)]);
+    }
+    return lowest;
+}
+
+void FrequencySketch::age() {
+    for (uint8_t& counter : table) counter >>= 1;
+    additions /= 2;
+}
+
+TinyLfuPolicy::TinyLfuPolicy()
+    : window_entries(1), window_bytes(0), protected_entries(0), protected_bytes(0),
+      main_entries(0), main_bytes(0) {
+    set_capacity(100, 100 * 1024 * 1024);
+}
+
+// 1% of the shard is window, the rest main; 80% of main is protected
+void TinyLfuPolicy::set_capacity(size_t max_entries, size_t max_bytes) {
+    window_entries = std::max<size_t>(1, max_entries / 100);
+    window_bytes = std::max<size_t>(1, max_bytes / 100);
+    main_entries = max_entries > window_entries ? max_entries - window_entries : 0;
+    main_bytes = max_bytes > window_bytes ? max_bytes - window_bytes : 0;
+    protected_entries = main_entries / 5 * 4;
+    protected_bytes = main_bytes / 5 * 4;
+    sketch.resize(max_entries);
+}
+
+NodeList& TinyLfuPolicy::list_of(PolicyNode* node) {
+    if (node->queue == WINDOW) return window;
+    return node->queue == PROBATION ? probation : protected_;
+}
+
+void TinyLfuPolicy::move(PolicyNode* node, NodeList& to, int queue) {
+    list_of(node).unlink(node);
+    node->queue = queue;
+    to.push_front(node);
+}
+
+void TinyLfuPolicy::demote_protected() {
+    while (protected_.size() > 1 &&
+           (protected_.size() > protected_entries || protected_.bytes() > protected_bytes)) {
+        move(protected_.back(), probation, PROBATION);
+    }
+}
+
+PolicyNode* TinyLfuPolicy::add(const std::string* key, size_t hash, size_t size) {
+    PolicyNode* node = new PolicyNode{key, hash, size, WINDOW, nullptr, nullptr, 0, 0};
+    window.push_front(node);
+    return node;
+}
+
+void TinyLfuPolicy::touch(PolicyNode* node) {
+    if (node->queue == PROBATION) {
+        move(node, protected_, PROTECTED);
+        demote_protected();
+    } else {
+        list_of(node).move_to_front(node);
+    }
+}
+
+void TinyLfuPolicy::remove(PolicyNode* node) {
+    list_of(node).unlink(node);
+    delete node;
+}
+
+PolicyNode* TinyLfuPolicy::victim() {
+    // Entries leaving the window join the main cache while it has room;
+    // after that each has to be seen more often than the entry it would
+    // replace, or it is the one evicted
+    while (window.size() > window_entries || window.bytes() > window_bytes) {
+        PolicyNode* candidate = window.back();
+        if (probation.size() + protected_.size() + 1 <= main_entries &&
+            probation.bytes() + protected_.bytes() + candidate->size <= main_bytes) {
+            move(candidate, probation, PROBATION);
+            continue;
+        }
+
+        PolicyNode* coldest = probation.empty() ? protected_.back() : probation.back();
+        if (!coldest) return candidate;
+        if (sketch.frequency(candidate->hash) > sketch.frequency(coldest->hash)) {
+            move(candidate, probation, PROBATION);
+            return coldest;
+        }
+        return candidate;
+    }
+
+    if (!probation.empty()) return probation.back();
+    if (!protected_.empty()) return protected_.back();
+    return window.back();
+}
+
+void TinyLfuPolicy::clear() {
+    window.clear();
+    probation.clear();
+    protected_.clear();
+}
+
+void GdsfPolicy::set_priority(PolicyNode* node) {
+    double per_byte = favor_bytes ? 1.0 : 1.0 / std::max<size_t>(1, node->size);
+    node->priority = inflation + node->frequency * per_byte;
+}
+
+void GdsfPolicy::place(PolicyNode* node, size_t slot) {
+    heap[slot] = node;
+    node->queue = (int)slot;
+}
+
+void GdsfPolicy::sift_up(size_t slot) {
+    PolicyNode* node = heap[slot];
+    while (slot > 0) {
+        size_t parent = (slot - 1) / 2;
+        if (heap[parent]->priority <= node->priority) break;
+        place(heap[parent], slot);
+        slot = parent;
+    }
+    place(node, slot);
+}
+
+void GdsfPolicy::sift_down(size_t slot) {
+    PolicyNode* node = heap[slot];
+    size_t count = heap.size();
+    while (true) {
+        size_t child = 2 * slot + 1;
+        if (child >= count) break;
+        if (child + 1 < count && heap[child + 1]->priority < heap[child]->priority) child++;
+        if (node->priority <= heap[child]->priority) break;
+        place(heap[child], slot);
+        slot = child;
+    }
+    place(node, slot);
+}
+
+PolicyNode* GdsfPolicy::add(const std::string* key, size_t hash, size_t size) {
+    PolicyNode* node = new PolicyNode{key, hash, size, 0, nullptr, nullptr, 0, 1};
+    set_priority(node);
+    heap.push_back(node);
+    sift_up(heap.size() - 1);
+    return node;
+}
+
+// A hit only raises the priority, so the entry can only move down
+void GdsfPolicy::touch(PolicyNode* node) {
+    node->frequency++;
+    set_priority(node);
+    sift_down(node->queue);
+}
+
+void GdsfPolicy::remove(PolicyNode* node) {
+    size_t slot = node->queue;
+    PolicyNode* last = heap.back();
+    heap.pop_back();
+    if (last != node) {
+        place(last, slot);
+        sift_down(slot);
+        sift_up(last->queue);
+    }
+    delete node;
+}
+
+PolicyNode* GdsfPolicy::victim() {
+    if (heap.empty()) return nullptr;
+    // Everything admitted from now on starts at the evicted priority
+    inflation = heap[0]->priority;
+    return heap[0];
+}
+
+void GdsfPolicy::clear() {
+    for (PolicyNode* node : heap) delete node;
+    heap.clear();
+}
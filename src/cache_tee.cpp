@@ -0,0 +1,68 @@
+#include "../include/cache_tee.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+CacheTee::CacheTee(size_t max_bytes)
+    : max_object_bytes(max_bytes), total_bytes(0), active(max_bytes > 0), header_checked(false) {
+}
+
+void CacheTee::abandon() {
+    active = false;
+    std::string().swap(buffer);
+}
+
+void CacheTee::check_header(size_t header_end) {
+    header_checked = true;
+
+    std::string header = buffer.substr(0, header_end);
+    std::transform(header.begin(), header.end(), header.begin(),
+                   [](unsigned char ch) { return std::tolower(ch); });
+
+    // Only complete 200 responses are stored
+    size_t sp = header.find(' ');
+    if (header.compare(0, 5, "http/") != 0 || sp == std::string::npos ||
+        header.compare(sp + 1, 3, "200") != 0) {
+        abandon();
+        return;
+    }
+
+    size_t cc = header.find("\r\ncache-control:");
+    if (cc != std::string::npos) {
+        size_t eol = header.find("\r\n", cc + 2);
+        std::string value = header.substr(cc, eol - cc);
+        if (value.find("no-store") != std::string::npos || value.find("private") != std::string::npos) {
+            abandon();
+            return;
+        }
+    }
+
+    // A declared length over the limit is rejected before the body arrives
+    size_t cl = header.find("\r\ncontent-length:");
+    if (cl != std::string::npos) {
+        unsigned long long length = strtoull(header.c_str() + cl + 17, nullptr, 10);
+        if (header_end + length > max_object_bytes) {
+            abandon();
+        }
+    }
+}
+
+void CacheTee::feed(const char* data, size_t len) {
+    total_bytes += len;
+    if (!active) return;
+
+    if (buffer.size() + len > max_object_bytes) {
+        abandon();
+        return;
+    }
+
+    size_t scan_from = buffer.size() >= 3 ? buffer.size() - 3 : 0;
+    buffer.append(data, len);
+
+    if (!header_checked) {
+        size_t header_end = buffer.find("\r\n\r\n", scan_from);
+        if (header_end != std::string::npos) {
+            check_header(header_end + 4);
+        }
+    }
+}
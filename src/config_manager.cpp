@@ -1,15 +1,184 @@
 #include "../include/config_manager.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
-#include <thread>
 #include <unistd.h>
 
+// Shared by all instances, so a version never repeats across them
+static std::atomic<uint64_t> next_version(1);
+
+// Applies one trimmed "KEY=value" line; throws on a malformed number
+static void parse_line(const std::string& line, ConfigSnapshot* next) {
+    if (line.find("PORT=") == 0) {
+        next->port = std::stoi(line.substr(5));
+    }
+    else if (line.find("CACHE_LIMIT=") == 0) {
+        next->cache_limit = std::stoi(line.substr(12));
+    }
+    else if (line.find("CACHE_TTL=") == 0) {
+        next->cache_ttl = std::stoi(line.substr(10));
+    }
+    else if (line.find("LOG_LEVEL=") == 0) {
+        next->log_level = line.substr(10);
+    }
+    else if (line.find("LOG_ASYNC=") == 0) {
+        std::string val = line.substr(10);
+        next->log_async = (val == "true" || val == "1" || val == "yes");
+    }
+    else if (line.find("LOG_BUFFER_LINES=") == 0) {
+        next->log_buffer_lines = std::stoul(line.substr(17));
+    }
+    else if (line.find("LOG_FLUSH_MS=") == 0) {
+        next->log_flush_ms = std::stoi(line.substr(13));
+    }
+    else if (line.find("LOG_OVERFLOW=") == 0) {
+        next->log_block_when_full = (line.substr(13) == "block");
+    }
+    else if (line.find("MAX_CACHE_SIZE_MB=") == 0) {
+        next->max_cache_size_mb = std::stoi(line.substr(18));
+    }
+    else if (line.find("MAX_CACHE_OBJECT_KB=") == 0) {
+        next->max_cache_object_kb = std::stoul(line.substr(20));
+    }
+    else if (line.find("CACHE_SHARDS=") == 0) {
+        next->cache_shards = std::stoi(line.substr(13));
+    }
+    else if (line.find("CACHE_POLICY=") == 0) {
+        next->cache_policy = line.substr(13);
+    }
+    else if (line.find("GDSF_FAVOR=") == 0) {
+        next->gdsf_favor_bytes = (line.substr(11) == "bytes");
+    }
+    else if (line.find("DISK_CACHE_DIR=") == 0) {
+        next->disk_cache_dir = line.substr(15);
+    }
+    else if (line.find("DISK_CACHE_SIZE_MB=") == 0) {
+        next->disk_cache_size_mb = std::stoul(line.substr(19));
+    }
+    else if (line.find("DISK_CACHE_SEGMENT_MB=") == 0) {
+        next->disk_cache_segment_mb = std::stoul(line.substr(22));
+    }
+    else if (line.find("CACHE_MAX_STALE=") == 0) {
+        next->cache_max_stale = std::stoi(line.substr(16));
+    }
+    else if (line.find("STALE_WHILE_REVALIDATE=") == 0) {
+        next->stale_while_revalidate = std::stoi(line.substr(23));
+    }
+    else if (line.find("COALESCE_MISSES=") == 0) {
+        std::string val = line.substr(16);
+        next->coalesce_misses = (val == "true" || val == "1" || val == "yes");
+    }
+    else if (line.find("COALESCE_TIMEOUT_MS=") == 0) {
+        next->coalesce_timeout_ms = std::stoi(line.substr(20));
+    }
+    else if (line.find("CONNECTION_TIMEOUT=") == 0) {
+        next->connection_timeout = std::stoi(line.substr(19));
+    }
+    else if (line.find("MAX_CONNECTIONS=") == 0) {
+        next->max_connections = std::stoi(line.substr(16));
+    }
+    else if (line.find("LISTEN_BACKLOG=") == 0) {
+        next->listen_backlog = std::stoi(line.substr(15));
+    }
+    else if (line.find("ACCEPT_THREADS=") == 0) {
+        next->accept_threads = std::stoi(line.substr(15));
+    }
+    else if (line.find("CPU_PINNING=") == 0) {
+        std::string val = line.substr(12);
+        next->cpu_pinning = (val == "true" || val == "1" || val == "yes");
+    }
+    else if (line.find("ENABLE_STATS=") == 0) {
+        std::string val = line.substr(13);
+        next->enable_stats = (val == "true" || val == "1" || val == "yes");
+    }
+    else if (line.find("METRICS_PORT=") == 0) {
+        next->metrics_port = std::stoi(line.substr(13));
+    }
+    else if (line.find("IO_MODEL=") == 0) {
+        next->io_model = line.substr(9);
+    }
+    else if (line.find("EVENT_LOOP_THREADS=") == 0) {
+        next->event_loop_threads = std::stoi(line.substr(19));
+    }
+    else if (line.find("UPSTREAM_KEEPALIVE=") == 0) {
+        std::string val = line.substr(19);
+        next->upstream_keepalive = (val == "true" || val == "1" || val == "yes");
+    }
+    else if (line.find("UPSTREAM_POOL_PER_HOST=") == 0) {
+        next->upstream_pool_per_host = std::stoi(line.substr(23));
+    }
+    else if (line.find("UPSTREAM_IDLE_TIMEOUT=") == 0) {
+        next->upstream_idle_timeout = std::stoi(line.substr(22));
+    }
+    else if (line.find("DNS_SERVER=") == 0) {
+        next->dns_server = line.substr(11);
+    }
+    else if (line.find("DNS_HOSTS_FILE=") == 0) {
+        next->dns_hosts_file = line.substr(15);
+    }
+    else if (line.find("DNS_TIMEOUT_MS=") == 0) {
+        next->dns_timeout_ms = std::stoi(line.substr(15));
+    }
+    else if (line.find("DNS_NEGATIVE_TTL=") == 0) {
+        next->dns_negative_ttl = std::stoi(line.substr(17));
+    }
+    else if (line.find("DNS_MAX_TTL=") == 0) {
+        next->dns_max_ttl = std::stoi(line.substr(12));
+    }
+    else if (line.find("BLOCK=") == 0) {
+        next->blocked_rules.push_back(line.substr(6));
+    }
+    else if (line.find("WHITELIST=") == 0) {
+        next->whitelist_rules.push_back(line.substr(10));
+    }
+}
+
 ConfigManager::ConfigManager(const std::string& filename)
-    : config_file(filename), last_mtime(0),
-      port(8080), cache_limit(100), cache_ttl(3600),
-      log_level("INFO"), max_cache_size_mb(100),
-      connection_timeout(30), max_connections(100), enable_stats(true) {
+    : config_file(filename), last_mtime(0), version(0), stop_fd(-1), watching(false) {
+    publish(std::make_shared<const ConfigSnapshot>());
+}
+
+ConfigManager::~ConfigManager() {
+    stop_watching();
+}
+
+void ConfigManager::publish(std::shared_ptr<const ConfigSnapshot> snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        published.swap(snapshot);
+        version.store(next_version++, std::memory_order_release);
+    }
+    // The previous snapshot (if no reader still holds it) is freed here,
+    // outside the lock
+}
+
+// Each thread keeps a reference to the last snapshot it read. While the
+// version is unchanged that costs one atomic load; a new version is picked
+// up under the mutex and the old snapshot is released when no thread
+// holds it any more.
+const ConfigSnapshot& ConfigManager::current() const {
+    struct Seen {
+        uint64_t version = 0;
+        std::shared_ptr<const ConfigSnapshot> snapshot;
+    };
+    thread_local Seen seen;
+
+    if (seen.version != version.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        seen.snapshot = published;
+        seen.version = version.load(std::memory_order_relaxed);
+    }
+    return *seen.snapshot;
+}
+
+std::shared_ptr<const ConfigSnapshot> ConfigManager::snapshot() const {
+    std::lock_guard<std::mutex> lock(config_mutex);
+    return published;
 }
 
 bool ConfigManager::load() {
@@ -19,11 +188,19 @@ bool ConfigManager::load() {
         return false;
     }
     
-    std::unordered_set<std::string> new_blocked;
-    std::unordered_set<std::string> new_whitelist;
+    // Held from parse to publish: a setter either lands before the reload
+    // (and the file decides) or waits and applies on top of it, never in
+    // between where the publish would drop it
+    std::lock_guard<std::mutex> lock(update_mutex);
+
+    // Built from the defaults up, so a key removed from the file reverts
+    auto next = std::make_shared<ConfigSnapshot>();
     
     std::string line;
+    int line_number = 0;
     while (getline(file, line)) {
+        line_number++;
+        
         // Skip empty lines and comments
         if (line.empty() || line[0] == '#') continue;
         
@@ -33,112 +210,170 @@ bool ConfigManager::load() {
         if (start == std::string::npos) continue;
         line = line.substr(start, end - start + 1);
         
-        // Parse key=value
-        if (line.find("PORT=") == 0) {
-            port = std::stoi(line.substr(5));
-        }
-        else if (line.find("CACHE_LIMIT=") == 0) {
-            cache_limit = std::stoi(line.substr(12));
-        }
-        else if (line.find("CACHE_TTL=") == 0) {
-            cache_ttl = std::stoi(line.substr(10));
-        }
-        else if (line.find("LOG_LEVEL=") == 0) {
-            log_level = line.substr(10);
-        }
-        else if (line.find("MAX_CACHE_SIZE_MB=") == 0) {
-            max_cache_size_mb = std::stoi(line.substr(18));
-        }
-        else if (line.find("CONNECTION_TIMEOUT=") == 0) {
-            connection_timeout = std::stoi(line.substr(19));
-        }
-        else if (line.find("MAX_CONNECTIONS=") == 0) {
-            max_connections = std::stoi(line.substr(16));
-        }
-        else if (line.find("ENABLE_STATS=") == 0) {
-            std::string val = line.substr(13);
-            enable_stats = (val == "true" || val == "1" || val == "yes");
-        }
-        else if (line.find("BLOCK=") == 0) {
-            new_blocked.insert(line.substr(6));
-        }
-        else if (line.find("WHITELIST=") == 0) {
-            new_whitelist.insert(line.substr(10));
+        // A bad value keeps the running configuration as it is
+        try {
+            parse_line(line, next.get());
+        } catch (const std::exception&) {
+            std::cerr << "⚠️  Invalid value on line " << line_number << " of " << config_file
+                      << ", keeping the current configuration" << std::endl;
+            return false;
         }
     }
     
-    {
-        std::lock_guard<std::mutex> lock(config_mutex);
-        blocked_hosts = new_blocked;
-        whitelisted_hosts = new_whitelist;
+    // Compiled here, off the request path; requests keep using the old
+    // snapshot until the new one is published
+    next->blocked_hosts = DomainMatcher(next->blocked_rules);
+    next->whitelisted_hosts = DomainMatcher(next->whitelist_rules);
+    if (next->blocked_hosts.rule_count() < next->blocked_rules.size() ||
+        next->whitelisted_hosts.rule_count() < next->whitelist_rules.size()) {
+        std::cerr << "⚠️  Ignored malformed BLOCK/WHITELIST entries" << std::endl;
     }
     
-    std::cout << "✅ Config loaded: PORT=" << port 
-              << ", CACHE_LIMIT=" << cache_limit 
-              << ", TTL=" << cache_ttl << "s"
-              << ", BLOCKED=" << blocked_hosts.size() << std::endl;
+    publish(next);
+    
+    std::cout << "✅ Config loaded: PORT=" << next->port 
+              << ", CACHE_LIMIT=" << next->cache_limit 
+              << ", TTL=" << next->cache_ttl << "s"
+              << ", BLOCKED=" << next->blocked_hosts.rule_count() << std::endl;
     
     return true;
 }
 
 void ConfigManager::watch(std::function<void()> callback) {
+    if (watching) return;
     on_config_changed = callback;
     
-    std::thread([this]() {
-        struct stat st{};
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd < 0) {
+        std::cerr << "⚠️  Could not create config watcher" << std::endl;
+        return;
+    }
+    watching = true;
+    watcher = std::thread(&ConfigManager::watch_inotify, this);
+}
+
+// Watches the directory rather than the file, so a save that replaces
+// the file (write to a temp file, then rename) is seen as well
+void ConfigManager::watch_inotify() {
+    std::string dir = ".";
+    std::string name = config_file;
+    size_t slash = config_file.rfind('/');
+    if (slash != std::string::npos) {
+        dir = slash == 0 ? "/" : config_file.substr(0, slash);
+        name = config_file.substr(slash + 1);
+    }
+    
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        if (fd >= 0) close(fd);
+        std::cerr << "⚠️  inotify unavailable, polling " << config_file << std::endl;
+        watch_polling();
+        return;
+    }
+    
+    alignas(inotify_event) char buffer[4096];
+    while (watching) {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) break;
+        
+        bool changed = false;
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && name == event->name)) {
+                    changed = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        
+        if (changed && load() && on_config_changed) {
+            on_config_changed();
+        }
+    }
+    close(fd);
+}
+
+void ConfigManager::watch_polling() {
+    struct stat st{};
+    if (stat(config_file.c_str(), &st) == 0) last_mtime = st.st_mtime;
+    
+    while (watching) {
+        pollfd stop{stop_fd, POLLIN, 0};
+        if (poll(&stop, 1, 2000) > 0) break;
         
-        while (true) {
-            if (stat(config_file.c_str(), &st) == 0) {
-                if (st.st_mtime != last_mtime.load()) {
-                    last_mtime = st.st_mtime;
-                    
-                    if (load() && on_config_changed) {
-                        on_config_changed();
-                    }
+        if (stat(config_file.c_str(), &st) == 0) {
+            if (st.st_mtime != last_mtime.load()) {
+                last_mtime = st.st_mtime;
+                
+                if (load() && on_config_changed) {
+                    on_config_changed();
                 }
             }
-            sleep(2);
         }
-    }).detach();
+    }
 }
 
 void ConfigManager::stop_watching() {
-    // In a real implementation, you'd want a flag to stop the thread
+    if (!watching.exchange(false)) return;
+    
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) {
+        std::cerr << "⚠️  Could not wake config watcher" << std::endl;
+    }
+    if (watcher.joinable()) watcher.join();
+    close(stop_fd);
+    stop_fd = -1;
 }
 
-bool ConfigManager::is_blocked(const std::string& host) const {
-    // Since this is const, we can't lock. In a real implementation,
-    // you'd use a read-write lock or make the mutex mutable
-    // For now, we'll access without lock (safe for reading)
+bool ConfigManager::is_blocked(const std::string& host, int port) const {
+    const ConfigSnapshot& config = current();
     
     // If whitelist is not empty and host is whitelisted, allow it
-    if (!whitelisted_hosts.empty() && whitelisted_hosts.count(host)) {
+    if (config.whitelisted_hosts.matches(host, port)) {
         return false;
     }
     
-    return blocked_hosts.count(host) > 0;
+    return config.blocked_hosts.matches(host, port);
 }
 
-bool ConfigManager::is_whitelisted(const std::string& host) const {
-    return whitelisted_hosts.count(host) > 0;
+bool ConfigManager::is_whitelisted(const std::string& host, int port) const {
+    return current().whitelisted_hosts.matches(host, port);
 }
 
+// Setters copy the current snapshot, change it and publish the copy
 void ConfigManager::set_port(int p) {
-    std::lock_guard<std::mutex> lock(config_mutex);
-    port = p;
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto next = std::make_shared<ConfigSnapshot>(*snapshot());
+    next->port = p;
+    publish(next);
 }
 
 void ConfigManager::set_cache_limit(int limit) {
-    std::lock_guard<std::mutex> lock(config_mutex);
-    cache_limit = limit;
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto next = std::make_shared<ConfigSnapshot>(*snapshot());
+    next->cache_limit = limit;
+    publish(next);
 }
 
 void ConfigManager::add_blocked_host(const std::string& host) {
-    std::lock_guard<std::mutex> lock(config_mutex);
-    blocked_hosts.insert(host);
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto next = std::make_shared<ConfigSnapshot>(*snapshot());
+    next->blocked_rules.push_back(host);
+    next->blocked_hosts = DomainMatcher(next->blocked_rules);
+    publish(next);
 }
 
 void ConfigManager::remove_blocked_host(const std::string& host) {
-    std::lock_guard<std::mutex> lock(config_mutex);
-    blocked_hosts.erase(host);
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto next = std::make_shared<ConfigSnapshot>(*snapshot());
+    next->blocked_rules.erase(std::remove(next->blocked_rules.begin(), next->blocked_rules.end(), host),
+                              next->blocked_rules.end());
+    next->blocked_hosts = DomainMatcher(next->blocked_rules);
+    publish(next);
 }
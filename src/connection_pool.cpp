@@ -0,0 +1,109 @@
+#include "../include/connection_pool.h"
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+UpstreamPool::UpstreamPool(size_t max_per_host, int idle_timeout, Statistics* stats_mgr)
+    : max_idle_per_host(max_per_host), idle_timeout_seconds(idle_timeout), stats(stats_mgr) {
+}
+
+UpstreamPool::~UpstreamPool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (auto& pair : idle) {
+        for (const auto& conn : pair.second) {
+            close(conn.fd);
+        }
+    }
+}
+
+bool UpstreamPool::is_alive(int fd) {
+    // An idle connection must have nothing to read; readable means the
+    // origin closed it (EOF) or sent something we can't attribute
+    pollfd pfd{fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+int UpstreamPool::acquire(const std::string& host, int port) {
+    std::string key = host + ":" + std::to_string(port);
+    auto now = std::chrono::steady_clock::now();
+    int fd = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        auto it = idle.find(key);
+        if (it != idle.end()) {
+            auto& conns = it->second;
+            // Most recently used first: it is the least likely to have timed out
+            while (!conns.empty()) {
+                IdleConnection conn = conns.back();
+                conns.pop_back();
+                if (now - conn.since < std::chrono::seconds(idle_timeout_seconds) && is_alive(conn.fd)) {
+                    fd = conn.fd;
+                    break;
+                }
+                close(conn.fd);
+            }
+            if (conns.empty()) idle.erase(it);
+        }
+    }
+
+    if (stats) {
+        if (fd >= 0) stats->record_pool_hit();
+        else stats->record_pool_miss();
+    }
+    return fd;
+}
+
+void UpstreamPool::release(const std::string& host, int port, int fd) {
+    std::string key = host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    if (max_idle_per_host == 0) {
+        close(fd);
+        return;
+    }
+
+    // Over the per-host cap the longest-idle connection makes room
+    auto& conns = idle[key];
+    if (conns.size() >= max_idle_per_host) {
+        close(conns.front().fd);
+        conns.pop_front();
+    }
+    conns.push_back({fd, std::chrono::steady_clock::now()});
+}
+
+void UpstreamPool::set_limits(size_t max_per_host, int idle_timeout) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    max_idle_per_host = max_per_host;
+    idle_timeout_seconds = idle_timeout;
+}
+
+void UpstreamPool::cleanup_idle() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    for (auto it = idle.begin(); it != idle.end();) {
+        auto& conns = it->second;
+        // Oldest entries sit at the front
+        while (!conns.empty() &&
+               now - conns.front().since >= std::chrono::seconds(idle_timeout_seconds)) {
+            close(conns.front().fd);
+            conns.pop_front();
+        }
+        while (conns.size() > max_idle_per_host) {
+            close(conns.front().fd);
+            conns.pop_front();
+        }
+        if (conns.empty()) it = idle.erase(it);
+        else ++it;
+    }
+}
+
+size_t UpstreamPool::idle_count() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    size_t count = 0;
+    for (const auto& pair : idle) {
+        count += pair.second.size();
+    }
+    return count;
+}
@@ -0,0 +1,324 @@
+#include "../include/disk_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SEGMENT_MAGIC 0x31474553  // "SEG1"
+
+// On-disk record: header, key, data, padded to 8 bytes. A record with
+// expires == 0 is a tombstone for its key.
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t key_len;
+    uint64_t data_len;
+    int64_t expires;
+};
+
+static size_t record_size(size_t key_len, size_t data_len) {
+    return (sizeof(RecordHeader) + key_len + data_len + 7) & ~(size_t)7;
+}
+
+static bool write_at(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+DiskCache::Segment::~Segment() {
+    if (map) munmap(map, capacity);
+    if (fd >= 0) close(fd);
+}
+
+DiskCache::DiskCache(const std::string& dir, size_t max_size_bytes, size_t segment_size_bytes,
+                     Logger* log, Statistics* stats_mgr)
+    : logger(log), stats(stats_mgr), directory(dir),
+      max_bytes(max_size_bytes), segment_bytes(std::max<size_t>(segment_size_bytes, 1 << 20)),
+      active_offset(0), next_segment_id(0), stored_bytes(0) {
+}
+
+DiskCache::~DiskCache() {
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    index.clear();
+    segments.clear();
+    active.reset();
+}
+
+std::string DiskCache::segment_path(uint32_t id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "seg-%08u.cache", id);
+    return directory + "/" + name;
+}
+
+std::shared_ptr<DiskCache::Segment> DiskCache::open_segment(uint32_t id, bool create) {
+    std::string path = segment_path(id);
+    int fd = create ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                    : ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        logger->error("Failed to open cache segment: " + path);
+        return nullptr;
+    }
+
+    size_t capacity = segment_bytes;
+    if (create) {
+        if (ftruncate(fd, capacity) < 0) {
+            logger->error("Failed to size cache segment: " + path);
+            close(fd);
+            return nullptr;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+            close(fd);
+            return nullptr;
+        }
+        capacity = st.st_size;
+    }
+
+    // Writes go through pwrite(); the shared page cache makes them visible here
+    void* map = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        logger->error("Failed to map cache segment: " + path);
+        close(fd);
+        return nullptr;
+    }
+
+    auto segment = std::make_shared<Segment>();
+    segment->id = id;
+    segment->fd = fd;
+    segment->map = static_cast<char*>(map);
+    segment->capacity = capacity;
+    segment->path = path;
+    return segment;
+}
+
+bool DiskCache::open() {
+    if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        logger->error("Failed to create disk cache directory: " + directory);
+        return false;
+    }
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        logger->error("Failed to read disk cache directory: " + directory);
+        return false;
+    }
+    std::vector<uint32_t> ids;
+    while (dirent* entry = readdir(dir)) {
+        unsigned int id;
+        char tail;
+        if (sscanf(entry->d_name, "seg-%u.cache%c", &id, &tail) == 1) {
+            ids.push_back(id);
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    for (uint32_t id : ids) {
+        std::shared_ptr<Segment> segment = open_segment(id, false);
+        if (!segment) continue;
+        segments[id] = segment;
+        load_segment(segment);
+        next_segment_id = id + 1;
+    }
+
+    // The budget may have shrunk since the last run
+    size_t max_segments = std::max<size_t>(2, max_bytes / segment_bytes);
+    while (segments.size() > max_segments) {
+        drop_oldest_segment();
+    }
+
+    logger->info("Disk cache: " + std::to_string(index.size()) + " objects in " +
+                 std::to_string(segments.size()) + " segments under " + directory);
+    return true;
+}
+
+// Caller holds disk_mutex. Later records (and later segments) win.
+void DiskCache::load_segment(const std::shared_ptr<Segment>& segment) {
+    time_t now = time(nullptr);
+    size_t offset = 0;
+
+    while (offset + sizeof(RecordHeader) <= segment->capacity) {
+        RecordHeader header;
+        memcpy(&header, segment->map + offset, sizeof(header));
+        if (header.magic != SEGMENT_MAGIC) break;  // end of written data, or a torn write
+
+        // A corrupt length must neither wrap record_size() nor point the
+        // index past the mapping; the rest of the segment is unreadable
+        size_t room = segment->capacity - offset - sizeof(header);
+        if (header.key_len > room || header.data_len > room - header.key_len) break;
+        size_t size = record_size(header.key_len, header.data_len);
+        if (offset + size > segment->capacity) break;
+
+        std::string key(segment->map + offset + sizeof(header), header.key_len);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            stored_bytes -= it->second.length;
+            index.erase(it);
+        }
+        if (header.expires > now) {
+            index[key] = {segment, offset + sizeof(header) + header.key_len,
+                          (size_t)header.data_len, (time_t)header.expires};
+            stored_bytes += header.data_len;
+        }
+        offset += size;
+    }
+}
+
+// Caller holds disk_mutex
+bool DiskCache::start_segment() {
+    size_t max_segments = std::max<size_t>(2, max_bytes / segment_bytes);
+    while (segments.size() >= max_segments) {
+        drop_oldest_segment();
+    }
+
+    std::shared_ptr<Segment> segment = open_segment(next_segment_id++, true);
+    if (!segment) return false;
+
+    segments[segment->id] = segment;
+    active = segment;
+    active_offset = 0;
+    return true;
+}
+
+// Caller holds disk_mutex. Readers still holding the segment keep the
+// mapping alive until they finish copying.
+void DiskCache::drop_oldest_segment() {
+    if (segments.empty()) return;
+    std::shared_ptr<Segment> oldest = segments.begin()->second;
+    segments.erase(segments.begin());
+    if (active == oldest) active.reset();
+
+    for (auto it = index.begin(); it != index.end();) {
+        if (it->second.segment == oldest) {
+            stored_bytes -= it->second.length;
+            it = index.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    unlink(oldest->path.c_str());
+}
+
+bool DiskCache::get(const std::string& key, std::string& data, time_t& expires) {
+    Location location;
+    {
+        std::lock_guard<std::mutex> lock(disk_mutex);
+        auto it = index.find(key);
+        if (it == index.end()) return false;
+
+        if (it->second.expires <= time(nullptr)) {
+            stored_bytes -= it->second.length;
+            index.erase(it);
+            return false;
+        }
+        location = it->second;
+    }
+
+    // Copy outside the lock; the shared_ptr pins the mapping
+    data.assign(location.segment->map + location.offset, location.length);
+    expires = location.expires;
+    if (stats) stats->record_disk_cache_read(location.length);
+    return true;
+}
+
+void DiskCache::put(const std::string& key, const std::string& data, time_t expires) {
+    size_t size = record_size(key.size(), data.size());
+    if (size > segment_bytes || expires <= 0) return;
+
+    std::shared_ptr<Segment> segment;
+    size_t offset;
+    {
+        std::lock_guard<std::mutex> lock(disk_mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            stored_bytes -= it->second.length;
+            index.erase(it);
+        }
+
+        if (!active || active_offset + size > active->capacity) {
+            if (!start_segment()) return;
+        }
+        segment = active;
+        offset = active_offset;
+        active_offset += size;
+    }
+
+    // Body first, header last: a record only becomes valid once complete
+    RecordHeader header{SEGMENT_MAGIC, (uint32_t)key.size(), data.size(), (int64_t)expires};
+    size_t body = offset + sizeof(header);
+    if (!write_at(segment->fd, key.data(), key.size(), body) ||
+        !write_at(segment->fd, data.data(), data.size(), body + key.size()) ||
+        !write_at(segment->fd, (const char*)&header, sizeof(header), offset)) {
+        logger->error("Failed to write disk cache segment: " + segment->path);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    if (!segments.count(segment->id)) return;  // reclaimed while we were writing
+    auto it = index.find(key);
+    if (it != index.end()) stored_bytes -= it->second.length;
+    index[key] = {segment, body + key.size(), data.size(), expires};
+    stored_bytes += data.size();
+    if (stats) stats->record_disk_cache_write(data.size());
+}
+
+bool DiskCache::contains(const std::string& key) {
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    auto it = index.find(key);
+    return it != index.end() && it->second.expires > time(nullptr);
+}
+
+void DiskCache::remove(const std::string& key) {
+    std::shared_ptr<Segment> segment;
+    size_t offset;
+    size_t size = record_size(key.size(), 0);
+    {
+        std::lock_guard<std::mutex> lock(disk_mutex);
+        auto it = index.find(key);
+        if (it == index.end()) return;
+        stored_bytes -= it->second.length;
+        index.erase(it);
+
+        // Tombstone, so the old copy is not resurrected on the next startup
+        if (!active || active_offset + size > active->capacity) {
+            if (!start_segment()) return;
+        }
+        segment = active;
+        offset = active_offset;
+        active_offset += size;
+    }
+
+    RecordHeader header{SEGMENT_MAGIC, (uint32_t)key.size(), 0, 0};
+    if (!write_at(segment->fd, key.data(), key.size(), offset + sizeof(header)) ||
+        !write_at(segment->fd, (const char*)&header, sizeof(header), offset)) {
+        logger->error("Failed to write disk cache segment: " + segment->path);
+    }
+}
+
+void DiskCache::clear() {
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    while (!segments.empty()) {
+        drop_oldest_segment();
+    }
+    index.clear();
+    active.reset();
+    stored_bytes = 0;
+}
+
+size_t DiskCache::entry_count() {
+    std::lock_guard<std::mutex> lock(disk_mutex);
+    return index.size();
+}
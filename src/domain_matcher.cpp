@@ -0,0 +1,273 @@
+#include "../include/domain_matcher.h"
+#include <algorithm>
+#include <cstring>
+
+#define MAX_NAME 256
+
+static inline char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+DomainMatcher::DomainMatcher() : rule_total(0) {
+}
+
+DomainMatcher::DomainMatcher(const std::vector<std::string>& rules) : rule_total(0) {
+    for (const std::string& rule : rules) {
+        add_rule(rule);
+    }
+
+    // Port rules are few; sorted once so a lookup can binary search them
+    std::sort(port_rules.begin(), port_rules.end(),
+              [](const PortRule& a, const PortRule& b) { return a.node < b.node; });
+    order.clear();
+    order.shrink_to_fit();
+}
+
+// Eight bytes at a time; OR-ing in 0x20 folds case, so a host in any case
+// hashes like its lower-case rule
+uint64_t DomainMatcher::hash_edge(uint32_t parent, const char* label, size_t length) {
+    const uint64_t fold = 0x2020202020202020ULL;
+    uint64_t h = ((uint64_t)parent << 8 | length) * 0x9E3779B97F4A7C15ULL;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, label + i, 8);
+        h = (h ^ (word | fold)) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, label + i, length - i);
+        h = (h ^ (word | (fold >> (8 * (8 - (length - i)))))) * 0xFF51AFD7ED558CCDULL;
+    }
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+const char* DomainMatcher::label_of(const Entry& entry) const {
+    if (entry.label_length <= INLINE_LABEL) return entry.label;
+    uint32_t offset;
+    memcpy(&offset, entry.label, sizeof(offset));
+    return long_labels.data() + offset;
+}
+
+// Returns the child's table index, or ROOT if there is none
+uint32_t DomainMatcher::find_child(uint32_t parent, const char* label, size_t length) const {
+    if (table.empty()) return ROOT;
+
+    size_t mask = table.size() - 1;
+    for (size_t i = hash_edge(parent, label, length) & mask;; i = (i + 1) & mask) {
+        const Entry& entry = table[i];
+        if (entry.label_length == 0) return ROOT;
+        if (entry.parent != parent || entry.label_length != length) continue;
+
+        // Stored labels are lower case
+        const char* stored = label_of(entry);
+        size_t j = 0;
+        while (j < length && lower(label[j]) == stored[j]) j++;
+        if (j == length) return (uint32_t)i;
+    }
+}
+
+// Stores a new node in the first free slot of its probe sequence
+uint32_t DomainMatcher::place(uint32_t parent, const char* label, size_t length) {
+    size_t mask = table.size() - 1;
+    size_t i = hash_edge(parent, label, length) & mask;
+    while (table[i].label_length != 0) i = (i + 1) & mask;
+
+    Entry& entry = table[i];
+    entry.parent = parent;
+    entry.label_length = (uint8_t)length;
+    entry.flags = 0;
+    if (length <= INLINE_LABEL) {
+        memcpy(entry.label, label, length);
+    } else {
+        uint32_t offset = (uint32_t)long_labels.size();
+        memcpy(entry.label, &offset, sizeof(offset));
+        long_labels.append(label, length);
+    }
+    order.push_back((uint32_t)i);
+    return (uint32_t)i;
+}
+
+// Nodes move when the table grows, so they are re-placed in insertion
+// order: every parent gets its new index before its children look it up
+void DomainMatcher::grow() {
+    std::vector<Entry> old;
+    old.swap(table);
+    std::vector<uint32_t> old_order;
+    old_order.swap(order);
+
+    table.assign(std::max<size_t>(64, old.size() * 2), Entry{0, 0, 0, {}});
+    order.reserve(old_order.size());
+    std::vector<uint32_t> moved(old.size(), ROOT);
+
+    for (uint32_t index : old_order) {
+        const Entry& entry = old[index];
+        uint32_t parent = entry.parent == ROOT ? ROOT : moved[entry.parent];
+        size_t mask = table.size() - 1;
+        size_t i = hash_edge(parent, entry.label_length <= INLINE_LABEL ? entry.label
+                                                                        : label_of(entry),
+                             entry.label_length) & mask;
+        while (table[i].label_length != 0) i = (i + 1) & mask;
+        table[i] = entry;
+        table[i].parent = parent;
+        moved[index] = (uint32_t)i;
+        order.push_back((uint32_t)i);
+    }
+
+    for (PortRule& rule : port_rules) {
+        rule.node = moved[rule.node];
+    }
+}
+
+bool DomainMatcher::split_port(std::string_view host, std::string_view& name, int& port) {
+    port = 0;
+    name = host;
+    std::string_view port_text;
+
+    if (!host.empty() && host[0] == '[') {
+        size_t close = host.find(']');
+        if (close == std::string_view::npos) return false;
+        name = host.substr(1, close - 1);
+        port_text = host.substr(close + 1);
+        if (!port_text.empty() && port_text[0] != ':') return false;
+    } else {
+        // Only a single colon is a port; more means a bare IPv6 address
+        size_t colon = host.find(':');
+        if (colon != std::string_view::npos && host.find(':', colon + 1) == std::string_view::npos) {
+            name = host.substr(0, colon);
+            port_text = host.substr(colon);
+        }
+    }
+
+    if (!port_text.empty()) {
+        if (port_text.size() < 2 || port_text.size() > 6) return false;
+        for (size_t i = 1; i < port_text.size(); i++) {
+            if (port_text[i] < '0' || port_text[i] > '9') return false;
+            port = port * 10 + (port_text[i] - '0');
+        }
+        if (port > 65535) return false;
+    }
+
+    if (!name.empty() && name.back() == '.') name.remove_suffix(1);
+    return !name.empty() && name.size() < MAX_NAME;
+}
+
+bool DomainMatcher::normalize(std::string_view host, char* out, size_t out_size,
+                              size_t& length, int& port) {
+    std::string_view name;
+    if (!split_port(host, name, port) || name.size() >= out_size) return false;
+
+    for (size_t i = 0; i < name.size(); i++) {
+        out[i] = lower(name[i]);
+    }
+    length = name.size();
+    return true;
+}
+
+bool DomainMatcher::add_rule(const std::string& rule) {
+    std::string_view text = rule;
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+
+    uint8_t flags = EXACT;
+    if (text.substr(0, 2) == "*.") {
+        flags = SUBDOMAINS;
+        text.remove_prefix(2);
+    } else if (!text.empty() && text[0] == '.') {
+        flags = EXACT | SUBDOMAINS;
+        text.remove_prefix(1);
+    }
+
+    char name[MAX_NAME];
+    size_t length;
+    int port;
+    if (!normalize(text, name, sizeof(name) - 1, length, port)) return false;
+    name[length] = '\0';
+    for (size_t i = 0; i < length; i++) {
+        if (name[i] == '*' || name[i] == ' ' || name[i] == '/') return false;
+    }
+    if (name[0] == '.' || strstr(name, "..")) return false;
+
+    // Insert labels right to left: www.example.com -> com, example, www
+    uint32_t node = ROOT;
+    size_t end = length;
+    while (true) {
+        const char* dot = static_cast<const char*>(memrchr(name, '.', end));
+        size_t start = dot ? (dot - name) + 1 : 0;
+        size_t label_length = end - start;
+        uint32_t child = find_child(node, name + start, label_length);
+        if (child == ROOT) {
+            // Keep the table at most half full so probe runs stay short
+            if ((order.size() + 1) * 2 > table.size()) grow();
+            child = place(node, name + start, label_length);
+        }
+        node = child;
+        if (start == 0) break;
+        end = start - 1;
+    }
+
+    if (port == 0) {
+        table[node].flags |= flags;
+    } else {
+        table[node].flags |= PORTS;
+        port_rules.push_back(PortRule{node, (uint16_t)port, flags});
+    }
+    rule_total++;
+    return true;
+}
+
+bool DomainMatcher::port_allows(uint32_t node, int port, uint8_t flag) const {
+    auto it = std::lower_bound(port_rules.begin(), port_rules.end(), node,
+        [](const PortRule& rule, uint32_t id) { return rule.node < id; });
+    for (; it != port_rules.end() && it->node == node; ++it) {
+        if (it->port == port && (it->flags & flag)) return true;
+    }
+    return false;
+}
+
+bool DomainMatcher::matches(std::string_view host, int port) const {
+    if (rule_total == 0) return false;
+
+    // Walked in place; find_child folds case, so nothing is copied
+    std::string_view name;
+    int host_port;
+    if (!split_port(host, name, host_port)) return false;
+    if (host_port != 0) port = host_port;
+
+    const char* text = name.data();
+    uint32_t node = ROOT;
+    size_t end = name.size();
+    while (true) {
+        const char* dot = static_cast<const char*>(memrchr(text, '.', end));
+        size_t start = dot ? (dot - text) + 1 : 0;
+        node = find_child(node, text + start, end - start);
+        if (node == ROOT) return false;
+
+        // More labels to the left means host is below this node
+        uint8_t wanted = start > 0 ? SUBDOMAINS : EXACT;
+        const Entry& entry = table[node];
+        if (entry.flags & wanted) return true;
+        if ((entry.flags & PORTS) && port != 0 && port_allows(node, port, wanted)) return true;
+        if (start == 0) return false;
+        end = start - 1;
+    }
+}
+
+size_t DomainMatcher::node_count() const {
+    size_t count = 0;
+    for (const Entry& entry : table) {
+        if (entry.label_length != 0) count++;
+    }
+    return count;
+}
+
+size_t DomainMatcher::memory_bytes() const {
+    return table.capacity() * sizeof(Entry) + port_rules.capacity() * sizeof(PortRule) +
+           long_labels.capacity();
+}
@@ -0,0 +1,1259 @@
+#include "../include/event_loop.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#define BUFFER_SIZE 8192
+#define MAX_EVENTS 256
+#define URING_ENTRIES 512
+#define URING_RECV_BUFFERS 256
+// Past this much unread client data a multishot recv is paused, the
+// io_uring stand-in for not reading the socket
+#define URING_MAX_BUFFERED (256 * 1024)
+
+static const uint32_t WATCH_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+
+// io_uring user_data: operation, fd (or listener slot) and the low bits of
+// the connection id, so a completion for a closed connection whose fd was
+// reused is recognised as stale
+enum UringOp : uint64_t { OP_NONE, OP_WAKE, OP_ACCEPT, OP_POLL, OP_RECV };
+
+static uint64_t user_data(UringOp op, int fd, uint64_t id) {
+    return (uint64_t)op << 56 | (uint64_t)(fd & 0xFFFFFF) << 32 | (uint32_t)id;
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Write as much of buf as the socket accepts. Returns bytes written,
+// 0 if the socket would block, -1 on error.
+static ssize_t flush_some(int fd, std::string& buf) {
+    size_t total = 0;
+    while (total < buf.size()) {
+        ssize_t n = send(fd, buf.data() + total, buf.size() - total, MSG_NOSIGNAL);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return -1;
+    }
+    buf.erase(0, total);
+    return total;
+}
+
+// flush_some() for a shared cache buffer, which is never modified
+static ssize_t flush_shared(int fd, const std::string& buf, size_t& offset) {
+    size_t start = offset;
+    while (offset < buf.size()) {
+        ssize_t n = send(fd, buf.data() + offset, buf.size() - offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            offset += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return -1;
+    }
+    return offset - start;
+}
+
+EventLoop::EventLoop(Logger* log, CacheManager* cache_mgr, ConfigManager* config_mgr,
+                     Statistics* stats_mgr, RequestHandler* request_handler,
+                     Resolver* dns, UpstreamPool* upstream_pool, int num_threads, bool uring)
+    : logger(log), cache(cache_mgr), config(config_mgr), stats(stats_mgr),
+      handler(request_handler), pool(upstream_pool), resolver(dns), coalescer(nullptr), running(false),
+      next_reactor(0), next_conn_id(0), use_uring(uring) {
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < num_threads; i++) {
+        Reactor* r = new Reactor();
+        r->epoll_fd = -1;
+        r->ring = nullptr;
+        r->wake_fd = -1;
+        reactors.push_back(r);
+    }
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    for (Reactor* r : reactors) {
+        delete r;
+    }
+}
+
+bool EventLoop::start(std::function<void()> on_closed, bool pin_cpus) {
+    if (running) return false;
+    on_connection_closed = on_closed;
+
+    // Checked at runtime: the kernel may be too old, or io_uring disabled
+    // (e.g. by seccomp or kernel.io_uring_disabled)
+    if (use_uring) {
+        std::string reason;
+        bool ready = IoUring::supported(reason);
+        for (Reactor* r : reactors) {
+            if (!ready) break;
+            r->ring = new IoUring();
+            ready = r->ring->init(URING_ENTRIES, reason) &&
+                    r->ring->setup_buffers(0, URING_RECV_BUFFERS, BUFFER_SIZE, reason);
+        }
+        if (!ready) {
+            logger->warn("io_uring unavailable (" + reason + "), using epoll");
+            for (Reactor* r : reactors) {
+                delete r->ring;
+                r->ring = nullptr;
+            }
+            use_uring = false;
+        }
+    }
+
+    for (Reactor* r : reactors) {
+        r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!r->ring) r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (r->wake_fd < 0 || (!r->ring && r->epoll_fd < 0)) {
+            logger->error("Failed to create epoll reactor");
+            return false;
+        }
+        if (r->ring) continue;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = r->wake_fd;
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &ev);
+    }
+
+    // Listener i is accepted by reactor i (modulo the count)
+    if (use_uring) {
+        for (size_t i = 0; i < listen_fds.size(); i++) {
+            reactors[i % reactors.size()]->listeners.push_back(Listener{listen_fds[i], (int)i, false});
+        }
+    }
+
+    running = true;
+    for (size_t i = 0; i < reactors.size(); i++) {
+        reactors[i]->thread = std::thread(&EventLoop::run, this, reactors[i]);
+        if (pin_cpus && !pin_to_cpu(reactors[i]->thread, (int)i)) {
+            logger->warn("Failed to pin reactor " + std::to_string(i) + " to a CPU");
+        }
+    }
+
+    logger->info("Event loop started with " + std::to_string(reactors.size()) + " reactor threads" +
+                 (use_uring ? " (io_uring)" : ""));
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!running) return;
+    running = false;
+
+    for (Reactor* r : reactors) {
+        wake(r);
+    }
+
+    for (Reactor* r : reactors) {
+        if (r->thread.joinable()) r->thread.join();
+
+        // Each connection is present once per fd; only close via the client entry
+        std::vector<Connection*> open;
+        for (const auto& pair : r->conns) {
+            if (pair.first == pair.second->client_fd) open.push_back(pair.second);
+        }
+        for (Connection* c : open) {
+            close_connection(r, c);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(r->pending_mutex);
+            for (int fd : r->pending) {
+                close(fd);
+                if (on_connection_closed) on_connection_closed();
+            }
+            r->pending.clear();
+            r->answers.clear();
+            r->landed.clear();
+        }
+        // Parked sockets never got a connection slot
+        for (int fd : r->parked) {
+            close(fd);
+        }
+        r->parked.clear();
+
+        if (r->ring) {
+            // Runs the queued cancel-and-close requests before the ring goes
+            r->ring->submit();
+            delete r->ring;
+            r->ring = nullptr;
+        } else {
+            close(r->epoll_fd);
+        }
+        close(r->wake_fd);
+        r->epoll_fd = -1;
+        r->wake_fd = -1;
+    }
+}
+
+bool EventLoop::pin_to_cpu(std::thread& thread, int cpu) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 0) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % cpus, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+}
+
+void EventLoop::set_listeners(const std::vector<int>& fds, std::function<bool()> admit) {
+    listen_fds = fds;
+    admit_connection = admit;
+}
+
+void EventLoop::add_client(int client, int reactor) {
+    Reactor* r = reactor >= 0 ? reactors[reactor % reactors.size()]
+                              : reactors[next_reactor++ % reactors.size()];
+    {
+        std::lock_guard<std::mutex> lock(r->pending_mutex);
+        r->pending.push_back(client);
+    }
+    wake(r);
+}
+
+void EventLoop::wake(Reactor* r) {
+    uint64_t one = 1;
+    if (write(r->wake_fd, &one, sizeof(one)) < 0) {
+        logger->warn("Failed to wake reactor");
+    }
+}
+
+void EventLoop::run(Reactor* r) {
+    if (r->ring) {
+        run_uring(r);
+    } else {
+        run_epoll(r);
+    }
+}
+
+void EventLoop::drain_wake(Reactor* r) {
+    uint64_t value;
+    while (read(r->wake_fd, &value, sizeof(value)) > 0) {}
+
+    std::vector<int> accepted;
+    std::vector<DnsAnswer> answers;
+    std::vector<FlightLanded> landed;
+    {
+        std::lock_guard<std::mutex> lock(r->pending_mutex);
+        accepted.swap(r->pending);
+        answers.swap(r->answers);
+        landed.swap(r->landed);
+    }
+    for (int client : accepted) {
+        register_client(r, client);
+    }
+    for (const DnsAnswer& answer : answers) {
+        on_resolved(r, answer);
+    }
+    for (const FlightLanded& flight : landed) {
+        on_landed(r, flight);
+    }
+}
+
+void EventLoop::run_epoll(Reactor* r) {
+    epoll_event events[MAX_EVENTS];
+    auto last_sweep = std::chrono::steady_clock::now();
+
+    while (running) {
+        int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) {
+            logger->error("epoll_wait failed: " + std::string(strerror(errno)));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == r->wake_fd) {
+                drain_wake(r);
+                continue;
+            }
+
+            // The connection may have been closed by an earlier event in this batch
+            auto it = r->conns.find(fd);
+            if (it == r->conns.end()) continue;
+
+            Connection* c = it->second;
+            handle_event(r, c, fd == c->upstream_fd, events[i].events);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            sweep_idle(r);
+            last_sweep = now;
+        }
+    }
+}
+
+void EventLoop::run_uring(Reactor* r) {
+    auto last_sweep = std::chrono::steady_clock::now();
+    r->ring->prep_poll(r->wake_fd, EPOLLIN, user_data(OP_WAKE, r->wake_fd, 0));
+    for (size_t i = 0; i < r->listeners.size(); i++) {
+        arm_accept(r, i);
+    }
+
+    while (running) {
+        // Parked connections are retried every 10 ms until a slot frees up
+        if (r->ring->wait(r->parked.empty() ? 1000 : 10) < 0) {
+            logger->error("io_uring_enter failed: " + std::string(strerror(errno)));
+            break;
+        }
+        r->ring->drain([this, r](const io_uring_cqe& cqe) { on_completion(r, cqe); });
+        admit_parked(r);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            sweep_idle(r);
+            last_sweep = now;
+        }
+    }
+}
+
+Connection* EventLoop::find_connection(Reactor* r, int fd, uint32_t id) {
+    auto it = r->conns.find(fd);
+    if (it == r->conns.end() || (uint32_t)it->second->id != id) return nullptr;
+    return it->second;
+}
+
+void EventLoop::on_completion(Reactor* r, const io_uring_cqe& cqe) {
+    UringOp op = (UringOp)(cqe.user_data >> 56);
+    int fd = (cqe.user_data >> 32) & 0xFFFFFF;
+    uint32_t id = (uint32_t)cqe.user_data;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    switch (op) {
+        case OP_NONE:
+            return;
+
+        case OP_WAKE:
+            if (!more) r->ring->prep_poll(r->wake_fd, EPOLLIN, cqe.user_data);
+            drain_wake(r);
+            return;
+
+        case OP_ACCEPT: {
+            Listener& listener = r->listeners[fd];
+            if (!more) listener.armed = false;
+            if (cqe.res >= 0) {
+                accept_client(r, cqe.res, listener.index);
+            } else if (cqe.res == -EINVAL || cqe.res == -EBADF) {
+                // The listening socket was shut down
+                listener.fd = -1;
+            } else if (cqe.res != -ECANCELED) {
+                logger->error("Failed to accept connection: " + std::string(strerror(-cqe.res)));
+            }
+            return;
+        }
+
+        case OP_RECV: {
+            Connection* c = find_connection(r, fd, id);
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t buffer = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (c && cqe.res > 0) {
+                    // Bytes that raced a CONNECT's cancel belong to the tunnel
+                    (c->is_connect ? c->to_upstream : c->request).append(r->ring->buffer(buffer), cqe.res);
+                }
+                r->ring->recycle(buffer);
+            }
+            if (!c) return;
+            if (!more) c->recv_armed = false;
+            if (cqe.res == 0) {
+                c->client_eof = true;
+            } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                close_connection(r, c);
+                return;
+            }
+            if (c->recv_armed && c->state != ConnState::READ_REQUEST &&
+                c->request.size() > URING_MAX_BUFFERED) {
+                stop_recv(r, c);
+            }
+            handle_event(r, c, false, 0);
+            return;
+        }
+
+        case OP_POLL: {
+            Connection* c = find_connection(r, fd, id);
+            if (!c || (fd != c->client_fd && fd != c->upstream_fd)) return;
+            // A multishot poll the kernel ended (not one we cancelled) is
+            // re-armed before handling, which may close the connection
+            if (!more && cqe.res != -ECANCELED) r->ring->prep_poll(fd, WATCH_EVENTS, cqe.user_data);
+            if (cqe.res < 0) return;
+            handle_event(r, c, fd == c->upstream_fd, cqe.res);
+            return;
+        }
+    }
+}
+
+void EventLoop::arm_accept(Reactor* r, size_t slot) {
+    Listener& listener = r->listeners[slot];
+    if (listener.fd < 0 || listener.armed) return;
+    listener.armed = r->ring->prep_accept(listener.fd, user_data(OP_ACCEPT, (int)slot, 0));
+}
+
+void EventLoop::accept_client(Reactor* r, int client, int listener) {
+    if (stats) stats->record_accept(listener);
+
+    // Out of MAX_CONNECTIONS slots: hold the socket and stop accepting, so
+    // further connections wait in the listen backlog as they do in front
+    // of a blocked accept thread
+    if (!r->parked.empty() || (admit_connection && !admit_connection())) {
+        r->parked.push_back(client);
+        for (size_t i = 0; i < r->listeners.size(); i++) {
+            if (r->listeners[i].armed) r->ring->prep_cancel(user_data(OP_ACCEPT, (int)i, 0));
+        }
+        return;
+    }
+
+    // With fewer listeners than reactors, spread connections round robin
+    if (listen_fds.size() < reactors.size()) {
+        add_client(client);
+    } else {
+        register_client(r, client);
+    }
+}
+
+void EventLoop::admit_parked(Reactor* r) {
+    size_t admitted = 0;
+    while (admitted < r->parked.size() && (!admit_connection || admit_connection())) {
+        int client = r->parked[admitted++];
+        if (listen_fds.size() < reactors.size()) {
+            add_client(client);
+        } else {
+            register_client(r, client);
+        }
+    }
+    r->parked.erase(r->parked.begin(), r->parked.begin() + admitted);
+
+    if (r->parked.empty()) {
+        for (size_t i = 0; i < r->listeners.size(); i++) {
+            arm_accept(r, i);
+        }
+    }
+}
+
+bool EventLoop::arm_recv(Reactor* r, Connection* c) {
+    if (!r->ring->prep_recv(c->client_fd, user_data(OP_RECV, c->client_fd, c->id))) return false;
+    c->recv_armed = true;
+    return true;
+}
+
+// Hands the client's read side back to direct recv() calls once the
+// cancelled recv's last completion (recv_armed cleared) has been seen
+void EventLoop::stop_recv(Reactor* r, Connection* c) {
+    if (r->ring && c->recv_armed) {
+        r->ring->prep_cancel(user_data(OP_RECV, c->client_fd, c->id));
+    }
+}
+
+bool EventLoop::watch(Reactor* r, Connection* c, int fd) {
+    if (r->ring) {
+        return r->ring->prep_poll(fd, WATCH_EVENTS, user_data(OP_POLL, fd, c->id));
+    }
+    epoll_event ev{};
+    ev.events = WATCH_EVENTS | EPOLLET;
+    ev.data.fd = fd;
+    return epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+// close() also drops the fd from the epoll interest list. In-flight
+// io_uring requests hold their own reference to the socket, though, so in
+// that mode they are cancelled first and the close is queued behind them.
+void EventLoop::close_fd(Reactor* r, int fd) {
+    r->conns.erase(fd);
+    if (r->ring && r->ring->prep_cancel_and_close(fd)) return;
+    close(fd);
+}
+
+void EventLoop::register_client(Reactor* r, int client) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    if (getpeername(client, (sockaddr*)&addr, &len) < 0 || !set_nonblocking(client)) {
+        logger->error("Failed to get client address");
+        close(client);
+        if (on_connection_closed) on_connection_closed();
+        return;
+    }
+
+    Connection* c = new Connection();
+    c->id = next_conn_id++;
+    c->client_fd = client;
+    c->upstream_fd = -1;
+    c->state = ConnState::READ_REQUEST;
+    c->is_connect = false;
+    c->client_eof = false;
+    c->recv_armed = false;
+    c->upstream_eof = false;
+    c->client_ip = inet_ntoa(addr.sin_addr);
+    c->origin_port = 0;
+    c->next_address = 0;
+    c->cached_sent = 0;
+    c->flight_leader = false;
+    c->request_size = 0;
+    c->upstream_reused = false;
+    c->trailing_data = false;
+    c->framer = nullptr;
+    c->client_to_upstream = nullptr;
+    c->upstream_to_client = nullptr;
+    c->tee = nullptr;
+    c->keep_alive = false;
+    c->served = 0;
+    c->start_time = std::chrono::steady_clock::now();
+    c->phase_start = c->start_time;
+    c->last_activity = c->start_time;
+
+    if (!watch(r, c, client)) {
+        logger->error("Failed to register client with the event loop");
+        close(client);
+        delete c;
+        if (on_connection_closed) on_connection_closed();
+        return;
+    }
+    r->conns[client] = c;
+    if (stats) stats->record_client_connection();
+
+    // Data may already be waiting; edge-triggered mode will not report it again
+    progress(r, c);
+}
+
+void EventLoop::handle_event(Reactor* r, Connection* c, bool from_upstream, uint32_t events) {
+    c->last_activity = std::chrono::steady_clock::now();
+
+    if (from_upstream && c->state == ConnState::CONNECTING) {
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            finish_connect(r, c);
+        }
+        return;
+    }
+
+    if (!from_upstream && (events & EPOLLERR)) {
+        close_connection(r, c);
+        return;
+    }
+
+    progress(r, c);
+}
+
+void EventLoop::progress(Reactor* r, Connection* c) {
+    // Keep stepping while the state changes, so one event can carry a
+    // connection through several states (e.g. several pipelined requests)
+    while (true) {
+        ConnState before = c->state;
+
+        switch (c->state) {
+            case ConnState::READ_REQUEST:
+                if (!read_request(r, c)) {
+                    close_connection(r, c);
+                    return;
+                }
+                break;
+
+            case ConnState::COALESCING:
+            case ConnState::RESOLVING:
+            case ConnState::CONNECTING:
+                return;
+
+            case ConnState::FETCH:
+            case ConnState::TUNNEL:
+                if (!relay(r, c)) {
+                    close_connection(r, c);
+                    return;
+                }
+                break;
+
+            case ConnState::DRAIN:
+                if (flush_some(c->client_fd, c->to_client) < 0) {
+                    close_connection(r, c);
+                    return;
+                }
+                if (!c->to_client.empty()) return;
+                if (c->cached) {
+                    if (flush_shared(c->client_fd, *c->cached, c->cached_sent) < 0) {
+                        close_connection(r, c);
+                        return;
+                    }
+                    if (c->cached_sent < c->cached->size()) return;
+                    if (stats) stats->record_zero_copy_response(c->cached->size());
+                    end_phase(c, PHASE_CACHE_HIT);
+                    c->cached.reset();
+                }
+                if (!c->keep_alive) {
+                    close_connection(r, c);
+                    return;
+                }
+                next_request(c);
+                break;
+        }
+
+        if (c->state == before) return;
+    }
+}
+
+bool EventLoop::read_request(Reactor* r, Connection* c) {
+    char buffer[BUFFER_SIZE];
+
+    while (true) {
+        // Drop what is left of the previous request's body (not forwarded,
+        // or the origin answered before taking all of it)
+        if (!c->body.complete() && !c->request.empty()) {
+            c->request.erase(0, c->body.feed(c->request.data(), c->request.size()));
+            if (c->body.failed()) return false;
+        }
+
+        if (c->body.complete()) {
+            RequestParser::Status status = c->parser.parse(c->request);
+            if (status == RequestParser::COMPLETE) {
+                dispatch(r, c);
+                return true;
+            }
+            if (status != RequestParser::INCOMPLETE) {
+                logger->warn(std::string(status == RequestParser::TOO_LARGE ? "Request header too large"
+                                                                            : "Malformed request") +
+                             " from " + c->client_ip);
+                c->to_client = RequestHandler::parse_error_response(status);
+                c->keep_alive = false;
+                c->state = ConnState::DRAIN;
+                return true;
+            }
+        }
+
+        // io_uring: the multishot recv appends to c->request (on_completion)
+        if (r->ring) {
+            if (c->client_eof) return false;
+            return c->recv_armed || arm_recv(r, c);
+        }
+
+        ssize_t n = recv(c->client_fd, buffer, BUFFER_SIZE, 0);
+        if (n > 0) {
+            c->request.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+
+        return false;
+    }
+}
+
+void EventLoop::next_request(Connection* c) {
+    c->cached.reset();
+    c->cached_sent = 0;
+    c->stale.reset();
+    c->held.clear();
+    delete c->tee;
+    delete c->framer;
+    c->tee = nullptr;
+    c->framer = nullptr;
+    end_flight(c);
+    c->host.clear();
+    c->cache_key.clear();
+    c->upstream_request.clear();
+    c->to_upstream.clear();
+    c->request_size = 0;
+    c->upstream_eof = false;
+    c->upstream_reused = false;
+    c->trailing_data = false;
+    c->keep_alive = false;
+    c->served++;
+    c->parser.reset();
+    c->state = ConnState::READ_REQUEST;
+}
+
+void EventLoop::dispatch(Reactor* r, Connection* c) {
+    // Split the header off; anything behind it is body or the next request
+    RequestParser& request = c->parser;
+    c->header.assign(c->request, 0, request.header_size());
+    c->request.erase(0, request.header_size());
+    request.rebase(c->header.data());
+
+    c->keep_alive = request.keep_alive();
+    RequestHandler::frame_body(request, c->body);
+    if (stats) stats->record_client_request(c->served > 0);
+
+    if (RequestHandler::is_stats_request(request)) {
+        c->to_client = RequestHandler::is_latency_request(request) ? handler->latency_response()
+                                                                   : handler->stats_response();
+        c->state = ConnState::DRAIN;
+        return;
+    }
+
+    if (RequestHandler::is_metrics_request(request)) {
+        // Into the connection's own buffer, which keeps its capacity
+        c->to_client.clear();
+        handler->append_metrics_response(c->to_client, c->keep_alive);
+        c->state = ConnState::DRAIN;
+        return;
+    }
+
+    if (request.is_connect()) {
+        RequestHandler::split_host_port(std::string(request.host()), 443, c->host, c->origin_port);
+        if (c->host.empty()) {
+            fail(c, "Malformed CONNECT request");
+            return;
+        }
+        c->origin = c->host;
+        c->is_connect = true;
+        c->keep_alive = false;
+
+        if (config->is_blocked(c->host, c->origin_port)) {
+            logger->log_request(c->client_ip, c->host, "BLOCKED_HTTPS");
+            if (stats) stats->record_blocked_request();
+            c->to_client = RequestHandler::forbidden_response();
+            c->state = ConnState::DRAIN;
+            return;
+        }
+
+        // Anything the client pipelined after the CONNECT header belongs to the tunnel
+        c->to_upstream.swap(c->request);
+        stop_recv(r, c);
+
+        begin_connect(r, c, false);
+        return;
+    }
+
+    c->host = request.host();
+    if (c->host.empty()) {
+        c->to_client = RequestHandler::error_response("No Host header found");
+        c->keep_alive = false;
+        c->state = ConnState::DRAIN;
+        return;
+    }
+
+    std::string path(request.path());
+    std::string method(request.method());
+    c->cache_key = "http://" + c->host + path;
+    logger->log_url(c->client_ip, c->cache_key, method);
+
+    RequestHandler::split_host_port(c->host, 80, c->origin, c->origin_port);
+
+    if (config->is_blocked(c->origin, c->origin_port)) {
+        logger->log_request(c->client_ip, c->host, "BLOCKED_HTTP");
+        if (stats) stats->record_blocked_request();
+        c->to_client = RequestHandler::forbidden_response();
+        c->keep_alive = false;
+        c->state = ConnState::DRAIN;
+        return;
+    }
+
+    if (RequestHandler::invalidates_cache(request)) cache->remove(c->cache_key);
+    if (!RequestHandler::is_cacheable_method(request)) c->cache_key.clear();
+
+    c->phase_start = std::chrono::steady_clock::now();
+    serve_or_fetch(r, c, false);
+}
+
+// waited: the request already waited for another fetch of the URL and now
+// either finds it in the cache or fetches for itself
+void EventLoop::serve_or_fetch(Reactor* r, Connection* c, bool waited) {
+    RequestParser& request = c->parser;
+    int stale_seconds = 0;
+    CacheManager::Freshness found = c->cache_key.empty() ? CacheManager::MISS
+        : cache->lookup(c->cache_key, c->cached, stale_seconds);
+    int window = config->get_stale_while_revalidate();
+    bool serve_stale = found == CacheManager::STALE && window > 0 && stale_seconds <= window &&
+                       c->body.complete();
+    c->stale.reset();
+
+    if (found == CacheManager::FRESH || serve_stale) {
+        // Shortly past expiry the stale copy goes out while one request per
+        // URL revalidates it in the background
+        if (serve_stale) {
+            if (!coalescer || coalescer->try_lead(c->cache_key)) {
+                handler->refresh_in_background(
+                    c->cache_key, c->origin, c->origin_port,
+                    RequestHandler::upstream_request_header(request, c->host, pool != nullptr), c->cached);
+            }
+            if (stats) stats->record_stale_served();
+        }
+        logger->log_request(c->client_ip, c->host, serve_stale ? "STALE" : "CACHED", c->cached->size());
+        if (stats) {
+            stats->record_request(c->host, c->client_ip);
+            stats->record_cached_request(c->cached->size());
+            stats->record_bytes(c->host, c->cached->size(), 0);
+        }
+        c->keep_alive = c->keep_alive && ResponseFramer::is_self_delimited(*c->cached);
+        c->cached_sent = 0;
+        c->state = ConnState::DRAIN;
+        return;
+    }
+    if (found == CacheManager::STALE) c->stale = std::move(c->cached);
+
+    // One miss per URL goes to the origin; the rest wait for it here
+    if (waited) {
+        if (stats) stats->record_coalesce_fallback();
+    } else if (!c->cache_key.empty() && coalescer && c->body.complete() &&
+               config->is_coalescing_enabled()) {
+        Reactor* owner = r;
+        FlightLanded flight{c->client_fd, c->id, c->served};
+        bool leads = coalescer->join(c->cache_key, [this, owner, flight]() {
+            {
+                std::lock_guard<std::mutex> lock(owner->pending_mutex);
+                owner->landed.push_back(flight);
+            }
+            if (running) wake(owner);
+        });
+        if (!leads) {
+            if (stats) stats->record_coalesced_request();
+            c->state = ConnState::COALESCING;
+            return;
+        }
+        c->flight_leader = true;
+    }
+
+    c->upstream_request = RequestHandler::upstream_request_header(request, c->host, pool != nullptr);
+    // An expired copy is revalidated instead of fetched again
+    if (c->stale && (RequestHandler::is_conditional(request) ||
+                     !RequestHandler::add_validators(c->upstream_request, *c->stale))) {
+        c->stale.reset();
+    }
+    c->request_size = c->upstream_request.size();
+    c->tee = new CacheTee(config->get_max_cache_object_kb() * 1024);
+
+    // Goes out ahead of the response, since relay() only reads the origin
+    // once to_client is empty
+    if (!c->body.complete() && RequestHandler::expects_continue(request)) {
+        c->to_client = "HTTP/1.1 100 Continue\r\n\r\n";
+    }
+
+    // The body is read directly, with backpressure from the origin
+    if (!c->body.complete()) stop_recv(r, c);
+
+    // A body read from the client cannot be replayed on a fresh connection,
+    // so such requests never take a pooled one
+    begin_connect(r, c, c->body.complete());
+}
+
+void EventLoop::on_landed(Reactor* r, const FlightLanded& flight) {
+    // As with DNS answers, the waiter may be gone or on a later request
+    auto it = r->conns.find(flight.client_fd);
+    if (it == r->conns.end()) return;
+    Connection* c = it->second;
+    if (c->id != flight.conn_id || c->served != flight.served ||
+        c->state != ConnState::COALESCING) {
+        return;
+    }
+
+    serve_or_fetch(r, c, true);
+    progress(r, c);
+}
+
+// Releases the requests waiting on this connection's fetch
+void EventLoop::end_flight(Connection* c) {
+    if (!c->flight_leader) return;
+    c->flight_leader = false;
+    coalescer->finish(c->cache_key);
+}
+
+void EventLoop::begin_connect(Reactor* r, Connection* c, bool allow_pool) {
+    c->start_time = std::chrono::steady_clock::now();
+    c->phase_start = c->start_time;
+
+    if (!c->is_connect) {
+        c->to_upstream = c->upstream_request;
+        delete c->framer;
+        c->framer = new ResponseFramer(c->parser.method() == "HEAD");
+    }
+
+    // A pooled connection is already established: go straight to FETCH
+    if (allow_pool && pool) {
+        int sock = pool->acquire(c->origin, c->origin_port);
+        if (sock >= 0) {
+            if (set_nonblocking(sock) && watch_upstream(r, c, sock)) {
+                c->upstream_reused = true;
+                c->state = ConnState::FETCH;
+                return;
+            }
+            close(sock);
+        }
+    }
+    c->upstream_reused = false;
+
+    // Answers from the hosts file or the DNS cache arrive synchronously
+    Reactor* owner = r;
+    int client_fd = c->client_fd;
+    uint64_t conn_id = c->id;
+    bool ready = resolver->lookup(c->origin, c->addresses,
+        [this, owner, client_fd, conn_id](const std::vector<ResolvedAddress>& addresses) {
+            {
+                std::lock_guard<std::mutex> lock(owner->pending_mutex);
+                owner->answers.push_back({client_fd, conn_id, addresses});
+            }
+            wake(owner);
+        });
+
+    if (!ready) {
+        c->state = ConnState::RESOLVING;
+        return;
+    }
+    end_phase(c, PHASE_DNS);
+    c->next_address = 0;
+    connect_next_address(r, c);
+}
+
+void EventLoop::on_resolved(Reactor* r, const DnsAnswer& answer) {
+    // The client may have gone away (and its fd been reused) meanwhile
+    auto it = r->conns.find(answer.client_fd);
+    if (it == r->conns.end()) return;
+    Connection* c = it->second;
+    if (c->id != answer.conn_id || c->state != ConnState::RESOLVING) return;
+
+    c->addresses = answer.addresses;
+    c->next_address = 0;
+    end_phase(c, PHASE_DNS);
+    connect_next_address(r, c);
+    progress(r, c);
+}
+
+void EventLoop::connect_next_address(Reactor* r, Connection* c) {
+    if (c->addresses.empty()) {
+        logger->error("DNS lookup failed for: " + c->host);
+        fail(c, "Failed to connect to remote host");
+        return;
+    }
+
+    while (c->next_address < c->addresses.size()) {
+        const ResolvedAddress& address = c->addresses[c->next_address++];
+        sockaddr_storage addr;
+        socklen_t addr_len = address.to_sockaddr(c->origin_port, addr);
+
+        int sock = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0) continue;
+
+        if (connect(sock, (sockaddr*)&addr, addr_len) < 0 && errno != EINPROGRESS) {
+            close(sock);
+            continue;
+        }
+        if (!watch_upstream(r, c, sock)) {
+            close(sock);
+            fail(c, "Failed to connect to remote host");
+            return;
+        }
+        c->state = ConnState::CONNECTING;
+        return;
+    }
+
+    logger->error("Connection failed to: " + c->host);
+    fail(c, "Failed to connect to remote host");
+}
+
+bool EventLoop::watch_upstream(Reactor* r, Connection* c, int sock) {
+    if (!watch(r, c, sock)) {
+        logger->error("Failed to register upstream with the event loop");
+        return false;
+    }
+
+    c->upstream_fd = sock;
+    c->upstream_eof = false;
+    c->trailing_data = false;
+    r->conns[sock] = c;
+    return true;
+}
+
+void EventLoop::release_upstream(Reactor* r, Connection* c) {
+    if (c->upstream_fd < 0) return;
+
+    r->conns.erase(c->upstream_fd);
+    if (pool && c->framer && c->framer->keep_alive() && !c->trailing_data &&
+        c->body.complete() && c->to_upstream.empty()) {
+        if (r->ring) {
+            // Submitted now: another reactor may take the socket from the pool
+            r->ring->prep_cancel(user_data(OP_POLL, c->upstream_fd, c->id));
+            r->ring->submit();
+        } else {
+            epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, c->upstream_fd, nullptr);
+        }
+        pool->release(c->origin, c->origin_port, c->upstream_fd);
+    } else {
+        close_fd(r, c->upstream_fd);
+    }
+    c->upstream_fd = -1;
+}
+
+void EventLoop::finish_connect(Reactor* r, Connection* c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->upstream_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        close_fd(r, c->upstream_fd);
+        c->upstream_fd = -1;
+        // Try the origin's next address, if it has one
+        connect_next_address(r, c);
+        progress(r, c);
+        return;
+    }
+
+    end_phase(c, PHASE_CONNECT);
+
+    if (c->is_connect) {
+        c->to_client = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        logger->log_request(c->client_ip, c->host, "HTTPS_TUNNEL");
+        logger->log_url(c->client_ip, "https://" + c->host, "CONNECT");
+        if (stats) stats->record_request(c->host, c->client_ip);
+        c->client_to_upstream = new RelayChannel(c->client_fd, c->upstream_fd);
+        c->upstream_to_client = new RelayChannel(c->upstream_fd, c->client_fd);
+        c->state = ConnState::TUNNEL;
+    } else {
+        c->state = ConnState::FETCH;
+    }
+
+    progress(r, c);
+}
+
+bool EventLoop::relay(Reactor* r, Connection* c) {
+    if (c->state == ConnState::TUNNEL) {
+        return relay_tunnel(c);
+    }
+
+    char buffer[BUFFER_SIZE];
+    bool moved = true;
+    bool upstream_failed = false;
+
+    while (moved) {
+        moved = false;
+
+        if (!c->to_upstream.empty()) {
+            ssize_t n = flush_some(c->upstream_fd, c->to_upstream);
+            if (n < 0) {
+                upstream_failed = true;
+                break;
+            }
+            if (n > 0) moved = true;
+        }
+
+        // Stream the request body one buffer at a time: the client is only
+        // read once the origin has taken the previous buffer
+        if (c->to_upstream.empty() && !c->body.complete()) {
+            size_t used = 0;
+            if (!c->request.empty()) {
+                used = c->body.feed(c->request.data(), c->request.size());
+                c->to_upstream.assign(c->request, 0, used);
+                c->request.erase(0, used);
+            } else if (!c->recv_armed) {
+                ssize_t n = recv(c->client_fd, buffer, BUFFER_SIZE, 0);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    return false;
+                }
+                if (n > 0) {
+                    used = c->body.feed(buffer, n);
+                    c->to_upstream.assign(buffer, used);
+                    c->request.append(buffer + used, n - used);
+                }
+            }
+            if (c->body.failed()) return false;
+            if (used > 0) {
+                c->request_size += used;
+                moved = true;
+            }
+        }
+
+        if (!c->to_client.empty()) {
+            ssize_t n = flush_some(c->client_fd, c->to_client);
+            if (n < 0) return false;
+            if (n > 0) moved = true;
+        }
+
+        // Only read once the previous chunk has been delivered, so a slow
+        // client applies backpressure instead of growing the buffer
+        if (!c->upstream_eof && !c->framer->complete() && c->to_client.empty()) {
+            ssize_t n = recv(c->upstream_fd, buffer, BUFFER_SIZE, 0);
+            if (n > 0) {
+                if (c->tee->bytes_seen() == 0) end_phase(c, PHASE_TTFB);
+                size_t used = c->framer->feed(buffer, n);
+                c->trailing_data = used < (size_t)n;
+                c->tee->feed(buffer, used);
+                if (!c->stale) {
+                    c->to_client.append(buffer, used);
+                } else {
+                    // Revalidating: a 304 is never passed on, anything else is
+                    c->held.append(buffer, used);
+                    if (c->framer->headers_done() && c->framer->status() != 304) {
+                        c->to_client.swap(c->held);
+                        c->stale.reset();
+                    }
+                }
+                moved = true;
+            } else if (n == 0) {
+                c->framer->on_eof();
+                c->upstream_eof = true;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                upstream_failed = true;
+                break;
+            }
+        }
+    }
+
+    bool upstream_done = upstream_failed || c->upstream_eof || c->framer->complete();
+
+    // A pooled connection the origin had already closed: retry on a fresh one
+    if (upstream_done && c->upstream_reused && c->tee->bytes_seen() == 0) {
+        close_fd(r, c->upstream_fd);
+        c->upstream_fd = -1;
+        begin_connect(r, c, false);
+        return true;
+    }
+
+    if (upstream_failed && c->tee->bytes_seen() > 0) return false;
+
+    if (upstream_done && c->to_client.empty()) {
+        c->keep_alive = c->keep_alive && c->framer->self_delimited();
+        release_upstream(r, c);
+        finish_fetch(c);
+        // An empty response leaves an error page to deliver, a 304 the
+        // revalidated cache entry
+        if (!c->to_client.empty() || c->cached) {
+            c->state = ConnState::DRAIN;
+            return true;
+        }
+        if (!c->keep_alive) return false;
+        next_request(c);
+    }
+
+    return true;
+}
+
+bool EventLoop::relay_tunnel(Connection* c) {
+    // The 200 reply and any bytes pipelined behind CONNECT go out first
+    if (!c->to_client.empty() && flush_some(c->client_fd, c->to_client) < 0) return false;
+    if (!c->to_upstream.empty() && flush_some(c->upstream_fd, c->to_upstream) < 0) return false;
+    if (!c->to_client.empty() || !c->to_upstream.empty()) return true;
+    // The cancelled multishot recv may still hand over client bytes
+    if (c->recv_armed) return true;
+
+    if (c->client_to_upstream->pump() < 0 || c->upstream_to_client->pump() < 0) {
+        return false;
+    }
+
+    // The origin closing ends the tunnel; a client half-close is forwarded
+    return !c->upstream_to_client->finished();
+}
+
+void EventLoop::finish_fetch(Connection* c) {
+    if (c->tee->bytes_seen() == 0) {
+        c->to_client = RequestHandler::error_response("Empty response from server");
+        if (stats) stats->record_error();
+        return;
+    }
+
+    end_phase(c, PHASE_TRANSFER);
+
+    if (c->stale && c->framer->complete() && c->framer->status() == 304) {
+        cache->refresh(c->cache_key, c->stale, config->get_cache_ttl());
+        end_flight(c);
+        logger->log_request(c->client_ip, c->host, "REVALIDATED", c->stale->size());
+        if (stats) {
+            stats->record_revalidated();
+            stats->record_request(c->host, c->client_ip);
+            stats->record_cached_request(c->stale->size());
+            stats->record_bytes(c->host, c->stale->size(), c->request_size);
+        }
+        c->keep_alive = c->keep_alive && ResponseFramer::is_self_delimited(*c->stale);
+        c->cached = std::move(c->stale);
+        c->cached_sent = 0;
+        return;
+    }
+    // Cut off before the status line was complete
+    if (c->stale) {
+        c->to_client.swap(c->held);
+        c->stale.reset();
+    }
+
+    if (!c->cache_key.empty() && c->framer->complete() && c->tee->is_cacheable()) {
+        cache->put(c->cache_key, c->tee->take_data(), config->get_cache_ttl());
+    }
+    end_flight(c);
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - c->start_time);
+
+    logger->log_request(c->client_ip, c->host, "FETCHED", c->tee->bytes_seen());
+    if (stats) {
+        stats->record_request(c->host, c->client_ip);
+        if (!c->cache_key.empty()) stats->record_cache_miss(c->tee->bytes_seen());
+        stats->record_bytes(c->host, c->tee->bytes_seen(), c->request_size);
+        stats->record_time(c->host, duration);
+    }
+}
+
+// Records the time since the previous phase ended and starts the next one
+void EventLoop::end_phase(Connection* c, LatencyPhase phase) {
+    auto now = std::chrono::steady_clock::now();
+    if (stats) {
+        stats->record_latency(phase, c->origin,
+            std::chrono::duration_cast<std::chrono::microseconds>(now - c->phase_start));
+    }
+    c->phase_start = now;
+}
+
+void EventLoop::fail(Connection* c, const std::string& message) {
+    c->to_client = RequestHandler::error_response(message);
+    c->keep_alive = false;
+    c->state = ConnState::DRAIN;
+    if (stats) stats->record_error();
+}
+
+void EventLoop::close_connection(Reactor* r, Connection* c) {
+    if (c->state == ConnState::TUNNEL && stats) {
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - c->start_time);
+        stats->record_time(c->host, duration);
+        stats->record_bytes(c->host, c->upstream_to_client->bytes(),
+                            c->client_to_upstream->bytes());
+    }
+    end_flight(c);
+    delete c->client_to_upstream;
+    delete c->upstream_to_client;
+    delete c->tee;
+    delete c->framer;
+
+    close_fd(r, c->client_fd);
+    if (c->upstream_fd >= 0) {
+        close_fd(r, c->upstream_fd);
+    }
+    delete c;
+
+    if (on_connection_closed) on_connection_closed();
+}
+
+void EventLoop::sweep_idle(Reactor* r) {
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::seconds(config->get_connection_timeout());
+
+    auto wait_limit = std::chrono::milliseconds(config->get_coalesce_timeout_ms());
+
+    std::vector<Connection*> idle, waited_out;
+    for (const auto& pair : r->conns) {
+        Connection* c = pair.second;
+        if (pair.first != c->client_fd) continue;
+        if (c->state == ConnState::COALESCING && now - c->phase_start > wait_limit) {
+            waited_out.push_back(c);
+        } else if (now - c->last_activity > timeout) {
+            idle.push_back(c);
+        }
+    }
+
+    for (Connection* c : idle) {
+        logger->debug("Closing idle connection from " + c->client_ip);
+        close_connection(r, c);
+    }
+
+    // The fetch they waited for is taking too long: fetch for themselves
+    for (Connection* c : waited_out) {
+        serve_or_fetch(r, c, true);
+        progress(r, c);
+    }
+}
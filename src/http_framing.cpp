@@ -0,0 +1,201 @@
+#include "../include/http_framing.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#define MAX_CHUNK_LINE 4096
+
+static bool is_hex_digit(char ch) {
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+BodyFramer::BodyFramer() : phase(DONE), remaining(0) {
+}
+
+void BodyFramer::start_length(uint64_t length) {
+    line.clear();
+    remaining = length;
+    phase = length > 0 ? LENGTH : DONE;
+}
+
+void BodyFramer::start_chunked() {
+    line.clear();
+    remaining = 0;
+    phase = CHUNK_SIZE;
+}
+
+size_t BodyFramer::feed(const char* data, size_t len) {
+    size_t used = 0;
+
+    while (used < len && phase != DONE && phase != INVALID) {
+        switch (phase) {
+            case LENGTH:
+            case CHUNK_DATA: {
+                size_t take = (size_t)std::min<uint64_t>(remaining, len - used);
+                used += take;
+                remaining -= take;
+                if (remaining == 0) phase = (phase == LENGTH) ? DONE : CHUNK_END;
+                break;
+            }
+
+            case CHUNK_SIZE:
+            case CHUNK_END:
+            case TRAILER: {
+                const char* nl = static_cast<const char*>(memchr(data + used, '\n', len - used));
+                size_t take = nl ? (nl - (data + used)) + 1 : len - used;
+                line.append(data + used, take);
+                used += take;
+                if (line.size() > MAX_CHUNK_LINE) {
+                    phase = INVALID;
+                    break;
+                }
+                if (!nl) break;
+
+                if (phase == CHUNK_SIZE) {
+                    if (!is_hex_digit(line[0])) {
+                        phase = INVALID;
+                        break;
+                    }
+                    remaining = strtoull(line.c_str(), nullptr, 16);
+                    phase = remaining > 0 ? CHUNK_DATA : TRAILER;
+                } else if (phase == CHUNK_END) {
+                    phase = CHUNK_SIZE;
+                } else if (line == "\r\n" || line == "\n") {
+                    phase = DONE;
+                }
+                line.clear();
+                break;
+            }
+
+            case DONE:
+            case INVALID:
+                break;
+        }
+    }
+
+    return used;
+}
+
+ResponseFramer::ResponseFramer(bool is_head_request)
+    : phase(HEADER), head_request(is_head_request), keep_alive_allowed(false),
+      ended_by_close(false), status_code(0) {
+}
+
+void ResponseFramer::parse_header() {
+    std::string header = line;
+    std::transform(header.begin(), header.end(), header.begin(),
+                   [](unsigned char ch) { return std::tolower(ch); });
+    line.clear();
+
+    size_t sp = header.find(' ');
+    status_code = (sp != std::string::npos) ? atoi(header.c_str() + sp + 1) : 0;
+    bool http11 = header.compare(0, 8, "http/1.1") == 0;
+
+    // Interim responses are followed by the real one on the same connection
+    if (status_code >= 100 && status_code < 200 && status_code != 101) {
+        phase = HEADER;
+        return;
+    }
+
+    size_t conn = header.find("\r\nconnection:");
+    std::string connection_value;
+    if (conn != std::string::npos) {
+        size_t eol = header.find("\r\n", conn + 2);
+        connection_value = header.substr(conn, eol - conn);
+    }
+    if (http11) {
+        keep_alive_allowed = connection_value.find("close") == std::string::npos;
+    } else {
+        keep_alive_allowed = connection_value.find("keep-alive") != std::string::npos;
+    }
+
+    if (head_request || status_code == 204 || status_code == 304 || status_code == 101) {
+        phase = DONE;
+        if (status_code == 101) keep_alive_allowed = false;
+        return;
+    }
+
+    size_t te = header.find("\r\ntransfer-encoding:");
+    if (te != std::string::npos) {
+        size_t eol = header.find("\r\n", te + 2);
+        if (header.substr(te, eol - te).find("chunked") != std::string::npos) {
+            body.start_chunked();
+            phase = BODY;
+            return;
+        }
+    }
+
+    size_t cl = header.find("\r\ncontent-length:");
+    if (cl != std::string::npos) {
+        body.start_length(strtoull(header.c_str() + cl + 17, nullptr, 10));
+        phase = body.complete() ? DONE : BODY;
+        return;
+    }
+
+    phase = BODY_UNTIL_CLOSE;
+    keep_alive_allowed = false;
+}
+
+size_t ResponseFramer::feed(const char* data, size_t len) {
+    size_t used = 0;
+
+    while (used < len && phase != DONE) {
+        switch (phase) {
+            case HEADER: {
+                // Resume the terminator search a few bytes back in case it straddles reads
+                size_t scan_from = line.size() >= 3 ? line.size() - 3 : 0;
+                size_t take = len - used;
+                line.append(data + used, take);
+                size_t end = line.find("\r\n\r\n", scan_from);
+                if (end == std::string::npos) {
+                    used += take;
+                    break;
+                }
+                size_t header_bytes = end + 4;
+                size_t extra = line.size() - header_bytes;
+                used += take - extra;
+                line.resize(header_bytes);
+                parse_header();
+                break;
+            }
+
+            case BODY:
+                used += body.feed(data + used, len - used);
+                if (body.complete()) {
+                    phase = DONE;
+                } else if (body.failed()) {
+                    // Unframeable: pass the rest through and let the origin close
+                    phase = BODY_UNTIL_CLOSE;
+                    keep_alive_allowed = false;
+                }
+                break;
+
+            case BODY_UNTIL_CLOSE:
+                used = len;
+                break;
+
+            case DONE:
+                break;
+        }
+    }
+
+    return used;
+}
+
+void ResponseFramer::on_eof() {
+    if (phase == BODY_UNTIL_CLOSE) {
+        phase = DONE;
+        ended_by_close = true;
+    }
+    keep_alive_allowed = false;
+}
+
+bool ResponseFramer::is_self_delimited(const std::string& response) {
+    size_t header_end = response.find("\r\n\r\n");
+    if (header_end == std::string::npos) return false;
+
+    ResponseFramer framer;
+    framer.feed(response.data(), header_end + 4);
+    return framer.phase != BODY_UNTIL_CLOSE && framer.phase != HEADER;
+}
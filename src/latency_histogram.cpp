@@ -0,0 +1,85 @@
+#include "../include/latency_histogram.h"
+#include <cmath>
+
+const char* latency_phase_name(LatencyPhase phase) {
+    switch (phase) {
+        case PHASE_DNS:       return "dns";
+        case PHASE_CONNECT:   return "connect";
+        case PHASE_TTFB:      return "ttfb";
+        case PHASE_TRANSFER:  return "transfer";
+        case PHASE_CACHE_HIT: return "cache_hit";
+        default:              return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+size_t LatencyHistogram::bucket_index(uint64_t us) {
+    if (us < (uint64_t)SUB_BUCKETS) return us;
+
+    int exponent = 63 - __builtin_clzll(us);
+    if (exponent > MAX_EXPONENT) {
+        exponent = MAX_EXPONENT;
+        us = (2ULL << MAX_EXPONENT) - 1;
+    }
+    // The top SUB_BITS + 1 bits pick the bucket within this power of two
+    size_t sub = (us >> (exponent - SUB_BITS)) - SUB_BUCKETS;
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t index) {
+    if (index < (size_t)SUB_BUCKETS) return index;
+
+    size_t block = index / SUB_BUCKETS;
+    size_t sub = index % SUB_BUCKETS;
+    int shift = block - 1;
+    return ((SUB_BUCKETS + sub) << shift) + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    buckets[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t prev = max_us.load(std::memory_order_relaxed);
+    while (us > prev && !max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::snapshot(Snapshot& out) const {
+    out.total = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        out.counts[i] = buckets[i].load(std::memory_order_relaxed);
+        out.total += out.counts[i];
+    }
+    out.sum_us = sum_us.load(std::memory_order_relaxed);
+    out.max_us = max_us.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    sum_us.store(0, std::memory_order_relaxed);
+    max_us.store(0, std::memory_order_relaxed);
+}
+
+// Highest value equivalent to the bucket holding the p-th percentile,
+// capped at the largest value actually seen
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const {
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)std::ceil(p / 100.0 * total);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += counts[i];
+        if (seen >= target) {
+            uint64_t value = bucket_upper_bound(i);
+            return value < max_us ? value : max_us;
+        }
+    }
+    return max_us;
+}
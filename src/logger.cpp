@@ -1,27 +1,55 @@
 #include "../include/logger.h"
 #include <iostream>
+#include <algorithm>
 #include <ctime>
-#include <iomanip>
+#include <cerrno>
+#include <chrono>
 #include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
 
-Logger::Logger(const std::string& filename, LogLevel level) 
-    : log_file(filename), min_level(level) {
-    file.open(log_file, std::ios::app);
-    if (!file.is_open()) {
+#define WRITE_BATCH_BYTES (256 * 1024)
+
+static void write_fully(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        written += n;
+    }
+}
+
+Logger::Logger(const std::string& filename, LogLevel level)
+    : log_file(filename), min_level(level), ring(nullptr), ring_mask(0),
+      ring_tail(0), ring_head(0), async_running(false), flush_interval_ms(200),
+      block_on_overflow(false), dropped_lines(0), stats(nullptr) {
+    fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
         std::cerr << "Failed to open log file: " << log_file << std::endl;
     }
 }
 
 Logger::~Logger() {
-    if (file.is_open()) {
-        file.close();
+    stop_async();
+    delete[] ring;
+    if (fd >= 0) {
+        close(fd);
     }
 }
 
 std::string Logger::get_timestamp() {
+    // The text only changes once a second; reformat per thread when it does
+    thread_local time_t cached_second = 0;
+    thread_local char buf[64];
+
     time_t now = time(nullptr);
-    char buf[64];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    if (now != cached_second) {
+        struct tm local;
+        localtime_r(&now, &local);
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+        cached_second = now;
+    }
     return std::string(buf);
 }
 
@@ -35,24 +63,149 @@ std::string Logger::level_to_string(LogLevel level) {
     }
 }
 
-void Logger::log(LogLevel level, const std::string& message) {
-    if (level < min_level) return;
-    
+bool Logger::start_async(size_t ring_lines, int flush_ms, bool block_when_full) {
+    if (async_running || ring) return false;
+
+    size_t capacity = 2;
+    while (capacity < ring_lines) capacity <<= 1;
+
+    ring = new Slot[capacity];
+    for (size_t i = 0; i < capacity; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ring_mask = capacity - 1;
+    ring_tail = 0;
+    ring_head = 0;
+    flush_interval_ms = flush_ms > 0 ? flush_ms : 1;
+    block_on_overflow = block_when_full;
+
+    async_running = true;
+    writer = std::thread(&Logger::run_writer, this);
+    return true;
+}
+
+void Logger::stop_async() {
+    if (!async_running.exchange(false)) return;
+    if (writer.joinable()) writer.join();
+
+    // Lines queued after the writer's last pass
+    std::string file_batch, out_batch, err_batch;
+    while (drain(file_batch, out_batch, err_batch) > 0) {
+        if (fd >= 0) write_fully(fd, file_batch);
+        write_fully(STDOUT_FILENO, out_batch);
+        write_fully(STDERR_FILENO, err_batch);
+        file_batch.clear();
+        out_batch.clear();
+        err_batch.clear();
+    }
+    // The ring itself stays until destruction in case a late producer is mid-push
+}
+
+bool Logger::enqueue(LogLevel level, std::string& line) {
+    size_t pos = ring_tail.load(std::memory_order_relaxed);
+
+    while (true) {
+        Slot& slot = ring[pos & ring_mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (ring_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.level = level;
+                slot.line.swap(line);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Full: the writer has not consumed this slot's previous line yet
+            if (!block_on_overflow || !async_running) return false;
+            std::this_thread::yield();
+            pos = ring_tail.load(std::memory_order_relaxed);
+        } else {
+            pos = ring_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Writer thread only. Moves queued lines into the batches; returns the count.
+size_t Logger::drain(std::string& file_batch, std::string& out_batch, std::string& err_batch) {
+    size_t count = 0;
+    while (ring && file_batch.size() < WRITE_BATCH_BYTES) {
+        Slot& slot = ring[ring_head & ring_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != ring_head + 1) break;
+
+        file_batch += slot.line;
+        if (slot.level >= WARN) err_batch += slot.line;
+        else if (slot.level == INFO) out_batch += slot.line;
+        slot.line.clear();
+
+        slot.sequence.store(ring_head + ring_mask + 1, std::memory_order_release);
+        ring_head++;
+        count++;
+    }
+    return count;
+}
+
+void Logger::run_writer() {
+    std::string file_batch, out_batch, err_batch;
+    auto last_flush = std::chrono::steady_clock::now();
+
+    while (async_running) {
+        size_t drained = drain(file_batch, out_batch, err_batch);
+
+        auto now = std::chrono::steady_clock::now();
+        bool due = now - last_flush >= std::chrono::milliseconds(flush_interval_ms);
+        if (!file_batch.empty() && (due || file_batch.size() >= WRITE_BATCH_BYTES)) {
+            if (fd >= 0) write_fully(fd, file_batch);
+            write_fully(STDOUT_FILENO, out_batch);
+            write_fully(STDERR_FILENO, err_batch);
+            file_batch.clear();
+            out_batch.clear();
+            err_batch.clear();
+            last_flush = now;
+        }
+
+        if (drained == 0) {
+            // Idle: nap for a slice of the flush interval
+            std::this_thread::sleep_for(std::chrono::milliseconds(
+                std::max(1, std::min(flush_interval_ms, 20))));
+        }
+    }
+
+    if (fd >= 0) write_fully(fd, file_batch);
+    write_fully(STDOUT_FILENO, out_batch);
+    write_fully(STDERR_FILENO, err_batch);
+}
+
+void Logger::write_line(LogLevel level, const std::string& line) {
     std::lock_guard<std::mutex> lock(log_mutex);
-    
-    std::string entry = "[" + get_timestamp() + "] [" + 
-                       level_to_string(level) + "] " + message;
-    
-    if (file.is_open()) {
-        file << entry << std::endl;
-        file.flush();
+
+    if (fd >= 0) {
+        write_fully(fd, line);
     }
-    
+
     // Also print to console for important messages
     if (level >= WARN) {
-        std::cerr << entry << std::endl;
+        write_fully(STDERR_FILENO, line);
     } else if (level == INFO) {
-        std::cout << entry << std::endl;
+        write_fully(STDOUT_FILENO, line);
+    }
+}
+
+void Logger::log(LogLevel level, const std::string& message) {
+    if (level < min_level) return;
+
+    std::string entry = "[" + get_timestamp() + "] [" +
+                       level_to_string(level) + "] " + message + "\n";
+
+    if (!async_running) {
+        write_line(level, entry);
+        return;
+    }
+
+    if (!enqueue(level, entry)) {
+        dropped_lines++;
+        if (stats) stats->record_log_dropped();
     }
 }
 
@@ -72,8 +225,10 @@ void Logger::error(const std::string& message) {
     log(ERROR, message);
 }
 
-void Logger::log_request(const std::string& ip, const std::string& host, 
+void Logger::log_request(const std::string& ip, const std::string& host,
                         const std::string& status, size_t bytes) {
+    if (INFO < min_level) return;
+
     std::ostringstream oss;
     oss << ip << " -> " << host << " [" << status << "]";
     if (bytes > 0) {
@@ -83,6 +238,8 @@ void Logger::log_request(const std::string& ip, const std::string& host,
 }
 
 void Logger::log_url(const std::string& ip, const std::string& url, const std::string& method) {
+    if (INFO < min_level) return;
+
     std::ostringstream oss;
     oss << "URL_LOG: " << ip << " " << method << " " << url;
     info(oss.str());
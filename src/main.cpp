@@ -35,6 +35,9 @@ int main(int argc, char* argv[]) {
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    // splice() into a reset socket cannot be told MSG_NOSIGNAL; the write
+    // still fails with EPIPE and the connection is closed
+    signal(SIGPIPE, SIG_IGN);
     
     try {
         ProxyServer server(config_file);
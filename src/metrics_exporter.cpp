@@ -0,0 +1,300 @@
+#include "../include/metrics_exporter.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+
+const char* MetricsExporter::CONTENT_TYPE =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+struct CounterMetric {
+    Statistics::Counter counter;
+    const char* name;
+    const char* help;
+    double scale;  // applied to the raw value; 0 keeps it an integer
+};
+
+static const CounterMetric COUNTER_METRICS[] = {
+    {Statistics::REQUESTS, "proxy_requests", "Requests proxied or served from cache", 0},
+    {Statistics::CACHED, "proxy_cached_requests", "Requests served from cache", 0},
+    {Statistics::BLOCKED, "proxy_blocked_requests", "Requests refused by the block list", 0},
+    {Statistics::ERRORS, "proxy_errors", "Requests that failed", 0},
+    {Statistics::BYTES_SENT, "proxy_sent_bytes", "Response bytes sent to clients", 0},
+    {Statistics::BYTES_RECEIVED, "proxy_received_bytes", "Request bytes sent upstream", 0},
+    {Statistics::POOL_HITS, "proxy_upstream_pool_hits", "Requests sent on a pooled upstream connection", 0},
+    {Statistics::POOL_MISSES, "proxy_upstream_pool_misses", "Requests that needed a new upstream connection", 0},
+    {Statistics::CLIENT_CONNECTIONS, "proxy_client_connections", "Client connections accepted", 0},
+    {Statistics::CLIENT_REQUESTS, "proxy_client_requests", "Requests read from clients", 0},
+    {Statistics::CLIENT_REUSED_REQUESTS, "proxy_client_reused_requests", "Requests on an already used client connection", 0},
+    {Statistics::DNS_HITS, "proxy_dns_cache_hits", "Lookups answered from the DNS cache", 0},
+    {Statistics::DNS_MISSES, "proxy_dns_cache_misses", "Lookups that needed a DNS query", 0},
+    {Statistics::DNS_COALESCED, "proxy_dns_coalesced_lookups", "Lookups that joined a query in flight", 0},
+    {Statistics::DNS_QUERIES, "proxy_dns_queries", "DNS queries completed", 0},
+    {Statistics::DNS_LOOKUP_US, "proxy_dns_query_seconds", "Time spent waiting on DNS queries", 1e-6},
+    {Statistics::ZERO_COPY_RESPONSES, "proxy_zero_copy_responses", "Cache hits sent from the shared buffer", 0},
+    {Statistics::ZERO_COPY_BYTES, "proxy_zero_copy_bytes", "Bytes sent from shared cache buffers", 0},
+    {Statistics::DISK_READS, "proxy_disk_cache_hits", "Objects read from the disk cache", 0},
+    {Statistics::DISK_READ_BYTES, "proxy_disk_cache_read_bytes", "Bytes read from the disk cache", 0},
+    {Statistics::DISK_WRITES, "proxy_disk_cache_writes", "Objects written to the disk cache", 0},
+    {Statistics::DISK_WRITTEN_BYTES, "proxy_disk_cache_written_bytes", "Bytes written to the disk cache", 0},
+    {Statistics::LOG_DROPPED, "proxy_log_dropped_lines", "Log lines dropped on queue overflow", 0},
+    {Statistics::COALESCED, "proxy_coalesced_requests", "Cache misses that waited for a fetch in flight", 0},
+    {Statistics::COALESCE_FALLBACKS, "proxy_coalesce_fallbacks", "Coalesced misses that fetched anyway", 0},
+    {Statistics::REVALIDATED, "proxy_cache_revalidations", "Expired entries the origin confirmed with 304", 0},
+    {Statistics::STALE_SERVED, "proxy_stale_responses", "Stale entries served during a background refresh", 0},
+    {Statistics::CACHE_HIT_BYTES, "proxy_cache_hit_bytes", "Response bytes served from cache", 0},
+    {Statistics::CACHE_MISSES, "proxy_cache_misses", "Cacheable requests fetched from the origin", 0},
+    {Statistics::CACHE_MISS_BYTES, "proxy_cache_miss_bytes", "Response bytes of cacheable requests fetched from the origin", 0},
+};
+static_assert(sizeof(COUNTER_METRICS) / sizeof(COUNTER_METRICS[0]) == Statistics::COUNTER_COUNT,
+              "every statistics counter needs a metric");
+
+// Histogram bucket bounds, in microseconds and as label text
+static const uint64_t BOUNDS_US[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+static const char* BOUNDS_LABEL[] = {
+    "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1",
+    "0.25", "0.5", "1.0", "2.5", "5.0", "10.0", "30.0", "60.0"
+};
+static const size_t BOUND_COUNT = sizeof(BOUNDS_US) / sizeof(BOUNDS_US[0]);
+
+static bool send_all(int fd, const char* data, size_t len, int flags) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, flags | MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+MetricsExporter::MetricsExporter(Statistics* stats_mgr, CacheManager* cache_mgr,
+                                 DiskCache* disk_cache, Resolver* dns, UpstreamPool* upstream_pool)
+    : stats(stats_mgr), cache(cache_mgr), disk(disk_cache), resolver(dns), pool(upstream_pool),
+      active_connections(nullptr), connection_slots(nullptr), max_connections(0) {
+    body.reserve(64 * 1024);
+}
+
+void MetricsExporter::set_connection_gauges(const std::atomic<long>* active, sem_t* slots,
+                                            int max_slots) {
+    active_connections = active;
+    connection_slots = slots;
+    max_connections = max_slots;
+}
+
+void MetricsExporter::append(const char* text) {
+    body.append(text);
+}
+
+void MetricsExporter::append_uint(uint64_t value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    body.append(buf, result.ptr - buf);
+}
+
+void MetricsExporter::append_double(double value) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%.9g", value);
+    body.append(buf, len);
+}
+
+void MetricsExporter::append_label_value(const std::string& value) {
+    for (char ch : value) {
+        if (ch == '\\' || ch == '"') {
+            body.push_back('\\');
+            body.push_back(ch);
+        } else if (ch == '\n') {
+            body.append("\\n");
+        } else {
+            body.push_back(ch);
+        }
+    }
+}
+
+void MetricsExporter::family(const char* name, const char* type, const char* help) {
+    append("# TYPE ");
+    append(name);
+    append(" ");
+    append(type);
+    append("\n# HELP ");
+    append(name);
+    append(" ");
+    append(help);
+    append("\n");
+}
+
+void MetricsExporter::sample(const char* name, const char* suffix, uint64_t value) {
+    append(name);
+    append(suffix);
+    append(" ");
+    append_uint(value);
+    append("\n");
+}
+
+// Emits one series from `snap`, folding the fine-grained buckets into BOUNDS_US
+void MetricsExporter::histogram(const char* name, const char* phase, const std::string* host) {
+    auto series = [&](const char* suffix, const char* le) {
+        append(name);
+        append(suffix);
+        append("{phase=\"");
+        append(phase);
+        if (host) {
+            append("\",host=\"");
+            append_label_value(*host);
+        }
+        if (le) {
+            append("\",le=\"");
+            append(le);
+        }
+        append("\"} ");
+    };
+
+    uint64_t cumulative = 0;
+    size_t next = 0;
+    for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+        if (snap.counts[i] == 0) continue;
+        uint64_t upper = LatencyHistogram::bucket_upper_bound(i);
+        for (; next < BOUND_COUNT && upper > BOUNDS_US[next]; next++) {
+            series("_bucket", BOUNDS_LABEL[next]);
+            append_uint(cumulative);
+            append("\n");
+        }
+        cumulative += snap.counts[i];
+    }
+    for (; next < BOUND_COUNT; next++) {
+        series("_bucket", BOUNDS_LABEL[next]);
+        append_uint(cumulative);
+        append("\n");
+    }
+
+    series("_bucket", "+Inf");
+    append_uint(snap.total);
+    append("\n");
+    series("_count", nullptr);
+    append_uint(snap.total);
+    append("\n");
+    series("_sum", nullptr);
+    append_double(snap.sum_us / 1e6);
+    append("\n");
+}
+
+void MetricsExporter::render() {
+    body.clear();
+
+    if (stats) {
+        stats->snapshot(totals);
+        for (const CounterMetric& metric : COUNTER_METRICS) {
+            family(metric.name, "counter", metric.help);
+            if (metric.scale > 0) {
+                append(metric.name);
+                append("_total ");
+                append_double(totals[metric.counter] * metric.scale);
+                append("\n");
+            } else {
+                sample(metric.name, "_total", totals[metric.counter]);
+            }
+        }
+
+        if (stats->get_listener_count() > 0) {
+            family("proxy_listener_accepts", "counter", "Connections accepted per listening socket");
+            for (int i = 0; i < stats->get_listener_count(); i++) {
+                append("proxy_listener_accepts_total{listener=\"");
+                append_uint(i);
+                append("\"} ");
+                append_uint(stats->get_listener_accepts(i));
+                append("\n");
+            }
+        }
+
+        family("proxy_uptime_seconds", "gauge", "Seconds since statistics were reset");
+        sample("proxy_uptime_seconds", "", (uint64_t)stats->get_uptime_seconds());
+    }
+
+    if (active_connections) {
+        family("proxy_active_connections", "gauge", "Client connections currently open");
+        long active = active_connections->load();
+        sample("proxy_active_connections", "", active > 0 ? active : 0);
+    }
+    if (connection_slots) {
+        int free_slots = 0;
+        sem_getvalue(connection_slots, &free_slots);
+        family("proxy_connection_slots_free", "gauge", "Unused MAX_CONNECTIONS slots");
+        sample("proxy_connection_slots_free", "", free_slots > 0 ? free_slots : 0);
+        family("proxy_connection_slots", "gauge", "MAX_CONNECTIONS");
+        sample("proxy_connection_slots", "", max_connections);
+    }
+
+    family("proxy_cache_entries", "gauge", "Objects in the memory cache");
+    sample("proxy_cache_entries", "", cache->size());
+    family("proxy_cache_bytes", "gauge", "Bytes held by the memory cache");
+    sample("proxy_cache_bytes", "", cache->get_total_size());
+    family("proxy_cache_lookup_hits", "counter", "Memory cache lookups that hit");
+    sample("proxy_cache_lookup_hits", "_total", cache->get_hits());
+    family("proxy_cache_lookup_misses", "counter", "Memory cache lookups that missed");
+    sample("proxy_cache_lookup_misses", "_total", cache->get_misses());
+
+    if (disk) {
+        family("proxy_disk_cache_entries", "gauge", "Objects in the disk cache");
+        sample("proxy_disk_cache_entries", "", disk->entry_count());
+        family("proxy_disk_cache_bytes", "gauge", "Object bytes in the disk cache");
+        sample("proxy_disk_cache_bytes", "", disk->get_stored_bytes());
+    }
+    if (resolver) {
+        family("proxy_dns_cache_entries", "gauge", "Names in the DNS cache");
+        sample("proxy_dns_cache_entries", "", resolver->cache_size());
+    }
+    if (pool) {
+        family("proxy_upstream_idle_connections", "gauge", "Idle pooled upstream connections");
+        sample("proxy_upstream_idle_connections", "", pool->idle_count());
+    }
+
+    if (stats) {
+        family("proxy_latency_seconds", "histogram", "Request latency by phase");
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            stats->latency_snapshot((LatencyPhase)phase, snap);
+            histogram("proxy_latency_seconds", latency_phase_name((LatencyPhase)phase), nullptr);
+        }
+
+        family("proxy_host_latency_seconds", "histogram", "Request latency by origin host and phase");
+        stats->for_each_host_latency([this](const std::string& host, const LatencyHistogram* phases) {
+            for (int phase = 0; phase < PHASE_COUNT; phase++) {
+                phases[phase].snapshot(snap);
+                if (snap.total == 0) continue;
+                histogram("proxy_host_latency_seconds", latency_phase_name((LatencyPhase)phase), &host);
+            }
+        });
+    }
+
+    append("# EOF\n");
+}
+
+// Caller holds render_mutex
+int MetricsExporter::format_header(char* header, size_t size, bool keep_alive) const {
+    return snprintf(header, size,
+                    "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %zu\r\n"
+                    "%s"
+                    "\r\n", CONTENT_TYPE, body.size(), keep_alive ? "" : "Connection: close\r\n");
+}
+
+void MetricsExporter::append_response(std::string& out, bool keep_alive) {
+    std::lock_guard<std::mutex> lock(render_mutex);
+    render();
+
+    char header[192];
+    int len = format_header(header, sizeof(header), keep_alive);
+    out.append(header, len);
+    out.append(body);
+}
+
+bool MetricsExporter::send_response(int fd, bool keep_alive) {
+    std::lock_guard<std::mutex> lock(render_mutex);
+    render();
+
+    char header[192];
+    int len = format_header(header, sizeof(header), keep_alive);
+    return send_all(fd, header, len, MSG_MORE) && send_all(fd, body.data(), body.size(), 0);
+}
@@ -6,9 +6,12 @@
 #include <thread>
 #include <csignal>
 #include <fcntl.h>
+#include <fstream>
+#include <algorithm>
 
 ProxyServer::ProxyServer(const std::string& config_file, int max_conn)
-    : server_socket(-1), running(false), connection_semaphore(nullptr) {
+    : running(false), event_loop(nullptr), connection_semaphore(nullptr),
+      active_connections(0), metrics_socket(-1) {
     
     config = new ConfigManager(config_file);
     config->load();
@@ -32,12 +35,63 @@ ProxyServer::ProxyServer(const std::string& config_file, int max_conn)
     
     logger = new Logger("logs/proxy.log", level);
     
-    cache = new CacheManager(config->get_cache_limit(), config->get_cache_ttl());
+    cache = new CacheManager(config->get_cache_limit(), config->get_cache_ttl(),
+                             config->get_cache_shards(), config->get_cache_policy(),
+                             config->is_gdsf_favoring_bytes());
     cache->set_max_size(config->get_max_cache_size_mb() * 1024 * 1024);
+    cache->set_max_stale(config->get_cache_max_stale());
     
     stats = config->is_stats_enabled() ? new Statistics() : nullptr;
     
-    handler = new RequestHandler(logger, cache, config, stats);
+    logger->set_statistics(stats);
+    if (config->is_log_async()) {
+        logger->start_async(config->get_log_buffer_lines(), config->get_log_flush_ms(),
+                            config->is_log_block_when_full());
+    }
+    if (cache->policy() != config->get_cache_policy()) {
+        logger->warn("Unknown CACHE_POLICY " + config->get_cache_policy() + ", using " +
+                     cache->policy());
+    }
+    if ((size_t)config->get_max_cache_size_mb() * 1024 / cache->shard_count() <
+        (size_t)config->get_max_cache_object_kb()) {
+        logger->warn("MAX_CACHE_SIZE_MB/CACHE_SHARDS is below MAX_CACHE_OBJECT_KB; "
+                     "objects larger than a shard's share will not be cached");
+    }
+    
+    disk_cache = nullptr;
+    if (!config->get_disk_cache_dir().empty()) {
+        disk_cache = new DiskCache(config->get_disk_cache_dir(),
+                                   config->get_disk_cache_size_mb() * 1024 * 1024,
+                                   config->get_disk_cache_segment_mb() * 1024 * 1024,
+                                   logger, stats);
+        if (disk_cache->open()) {
+            cache->set_disk_tier(disk_cache);
+        } else {
+            logger->warn("Disk cache disabled");
+            delete disk_cache;
+            disk_cache = nullptr;
+        }
+    }
+    
+    upstream_pool = nullptr;
+    if (config->is_upstream_keepalive_enabled()) {
+        upstream_pool = new UpstreamPool(config->get_upstream_pool_per_host(),
+                                         config->get_upstream_idle_timeout(), stats);
+    }
+    
+    resolver = new Resolver(logger, stats, config->get_dns_server(), config->get_dns_hosts_file(),
+                            config->get_dns_timeout_ms(), config->get_dns_negative_ttl(),
+                            config->get_dns_max_ttl());
+    
+    handler = new RequestHandler(logger, cache, config, stats, resolver, upstream_pool);
+    coalescer = new RequestCoalescer();
+    handler->set_coalescer(coalescer);
+    
+    metrics = new MetricsExporter(stats, cache, disk_cache, resolver, upstream_pool);
+    metrics->set_connection_gauges(&active_connections,
+                                   connection_semaphore == SEM_FAILED ? nullptr : connection_semaphore,
+                                   max_connections);
+    handler->set_metrics_exporter(metrics);
     
     logger->info("Proxy server initialized with max " + std::to_string(max_connections) + " concurrent connections");
 }
@@ -52,22 +106,38 @@ ProxyServer::~ProxyServer() {
     }
     
     delete handler;
-    delete stats;
+    delete event_loop;
+    delete coalescer;
+    delete metrics;
+    delete resolver;
+    delete upstream_pool;
     delete cache;
+    delete disk_cache;
+    logger->set_statistics(nullptr);
+    delete stats;
     delete logger;
     delete config;
 }
 
 bool ProxyServer::setup_socket() {
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        logger->error("Failed to create socket");
-        return false;
+    int listeners = config->get_accept_threads();
+    if (listeners <= 0) {
+        // One per reactor in the event loop models; thread-per-connection
+        // gains nothing from more than one
+        if (config->get_io_model() == "threads") {
+            listeners = 1;
+        } else {
+            listeners = config->get_event_loop_threads();
+            if (listeners <= 0) listeners = std::max(1u, std::thread::hardware_concurrency());
+        }
     }
 
-    int opt = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        logger->warn("Failed to set SO_REUSEADDR");
+    int backlog = config->get_listen_backlog();
+    std::ifstream somaxconn("/proc/sys/net/core/somaxconn");
+    int kernel_limit = 0;
+    if (somaxconn >> kernel_limit && backlog > kernel_limit) {
+        logger->warn("LISTEN_BACKLOG=" + std::to_string(backlog) + " is capped by net.core.somaxconn=" +
+                     std::to_string(kernel_limit));
     }
 
     sockaddr_in addr{};
@@ -75,21 +145,99 @@ bool ProxyServer::setup_socket() {
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(config->get_port());
 
-    if (bind(server_socket, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        logger->error("Failed to bind to port " + std::to_string(config->get_port()));
-        close(server_socket);
+    for (int i = 0; i < listeners; i++) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) {
+            logger->error("Failed to create socket");
+            break;
+        }
+
+        int opt = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            logger->warn("Failed to set SO_REUSEADDR");
+        }
+        // The kernel hashes each incoming connection to one socket of the group
+        if (listeners > 1 && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            logger->warn("SO_REUSEPORT unavailable, using a single listener");
+            close(sock);
+            if (!listen_sockets.empty()) break;
+            listeners = 1;
+            i--;
+            continue;
+        }
+
+        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            logger->error("Failed to bind to port " + std::to_string(config->get_port()));
+            close(sock);
+            break;
+        }
+
+        if (listen(sock, backlog) < 0) {
+            logger->error("Failed to listen on socket");
+            close(sock);
+            break;
+        }
+        listen_sockets.push_back(sock);
+    }
+
+    // Without the first listener there is nothing to serve; a partial
+    // group still spreads accepts over the sockets it has
+    if (listen_sockets.empty()) return false;
+    if ((int)listen_sockets.size() < listeners) {
+        logger->warn("Opened " + std::to_string(listen_sockets.size()) + " of " +
+                     std::to_string(listeners) + " listeners");
+    }
+
+    if (stats) stats->set_listener_count((int)listen_sockets.size());
+    return true;
+}
+
+bool ProxyServer::setup_metrics_socket() {
+    metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics_socket < 0) {
+        logger->error("Failed to create metrics socket");
         return false;
     }
 
-    if (listen(server_socket, 50) < 0) {
-        logger->error("Failed to listen on socket");
-        close(server_socket);
+    int opt = 1;
+    setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(config->get_metrics_port());
+
+    if (bind(metrics_socket, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(metrics_socket, 16) < 0) {
+        logger->error("Failed to listen on metrics port " + std::to_string(config->get_metrics_port()));
+        close(metrics_socket);
+        metrics_socket = -1;
         return false;
     }
 
     return true;
 }
 
+void ProxyServer::serve_metrics() {
+    char buffer[4096];
+
+    while (running) {
+        int client = accept(metrics_socket, nullptr, nullptr);
+        if (client < 0) {
+            if (!running) break;
+            continue;
+        }
+
+        // Every path on this port answers with the metrics
+        timeval tv{2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (recv(client, buffer, sizeof(buffer), 0) > 0) {
+            metrics->send_response(client);
+        }
+        close(client);
+    }
+}
+
 void ProxyServer::handle_stats_request(int client) {
     if (!stats) {
         std::string response = "HTTP/1.1 404 Not Found\r\n\r\nStats not enabled";
@@ -107,31 +255,63 @@ void ProxyServer::handle_stats_request(int client) {
     close(client);
 }
 
-void ProxyServer::accept_connections() {
+// Non-blocking counterpart of the sem_wait() in accept_connections(), for
+// reactors that accept themselves and must not block
+bool ProxyServer::try_acquire_connection_slot() {
+    if (connection_semaphore != SEM_FAILED && connection_semaphore != nullptr &&
+        sem_trywait(connection_semaphore) != 0) {
+        return false;
+    }
+    active_connections++;
+    return true;
+}
+
+void ProxyServer::release_connection_slot() {
+    active_connections--;
+    if (connection_semaphore != SEM_FAILED && connection_semaphore != nullptr) {
+        sem_post(connection_semaphore);
+    }
+}
+
+void ProxyServer::accept_connections(int listener) {
+    int sock = listen_sockets[listener];
     while (running) {
         sockaddr_in client_addr;
         socklen_t len = sizeof(client_addr);
         
-        int client = accept(server_socket, (sockaddr*)&client_addr, &len);
+        int client = accept(sock, (sockaddr*)&client_addr, &len);
         if (client < 0) {
             if (running) {
                 logger->error("Failed to accept connection");
             }
             continue;
         }
+        if (stats) stats->record_accept(listener);
 
         // Wait for semaphore (blocks if max connections reached)
         if (connection_semaphore != SEM_FAILED && connection_semaphore != nullptr) {
             sem_wait(connection_semaphore);
         }
+        active_connections++;
+        if (!running) {
+            // Woken by stop()
+            close(client);
+            release_connection_slot();
+            break;
+        }
+
+        // Reactor mode: the event loop owns the socket from here on. With
+        // several listeners, listener i feeds reactor i (same CPU if pinned).
+        if (event_loop) {
+            event_loop->add_client(client, listen_sockets.size() > 1 ? listener : -1);
+            continue;
+        }
 
         // Launch handler in new thread
         std::thread([this, client]() {
             handler->handle_client(client);
             // Release semaphore when connection is done
-            if (connection_semaphore != SEM_FAILED && connection_semaphore != nullptr) {
-                sem_post(connection_semaphore);
-            }
+            release_connection_slot();
         }).detach();
     }
 }
@@ -146,14 +326,41 @@ bool ProxyServer::start() {
         return false;
     }
 
+    std::string io_model = config->get_io_model();
+    if (io_model == "epoll" || io_model == "uring") {
+        event_loop = new EventLoop(logger, cache, config, stats, handler, resolver,
+                                   upstream_pool, config->get_event_loop_threads(),
+                                   io_model == "uring");
+        // io_uring reactors accept themselves; epoll keeps the accept threads
+        event_loop->set_listeners(listen_sockets, [this]() { return try_acquire_connection_slot(); });
+        event_loop->set_coalescer(coalescer);
+        if (!event_loop->start([this]() { release_connection_slot(); },
+                               config->is_cpu_pinning_enabled())) {
+            logger->warn("Event loop failed to start, falling back to thread-per-connection");
+            delete event_loop;
+            event_loop = nullptr;
+        }
+    }
+
     running = true;
     
+    if (config->get_metrics_port() > 0 && setup_metrics_socket()) {
+        metrics_thread = std::thread(&ProxyServer::serve_metrics, this);
+    }
+    
     // Start config watcher
     config->watch([this]() {
         logger->info("Configuration reloaded");
-        cache->set_max_entries(config->get_cache_limit());
-        cache->set_default_ttl(config->get_cache_ttl());
-        cache->set_max_size(config->get_max_cache_size_mb() * 1024 * 1024);
+        // One snapshot, so the limits below all come from the same reload
+        auto settings = config->snapshot();
+        cache->set_max_entries(settings->cache_limit);
+        cache->set_default_ttl(settings->cache_ttl);
+        cache->set_max_stale(settings->cache_max_stale);
+        cache->set_max_size(settings->max_cache_size_mb * 1024 * 1024);
+        if (upstream_pool) {
+            upstream_pool->set_limits(settings->upstream_pool_per_host,
+                                      settings->upstream_idle_timeout);
+        }
     });
     
     // Start cache cleanup thread
@@ -164,12 +371,30 @@ bool ProxyServer::start() {
             logger->debug("Cache cleanup completed");
         }
     }).detach();
+    
+    // Close pooled upstream connections that outlived the idle timeout
+    if (upstream_pool) {
+        std::thread([this]() {
+            while (running) {
+                sleep(5);
+                upstream_pool->cleanup_idle();
+            }
+        }).detach();
+    }
 
     logger->info("🚀 Proxy server started on port " + std::to_string(config->get_port()));
     std::cout << "🚀 Proxy server running on port " << config->get_port() << std::endl;
+    std::cout << "⚙️  I/O model: "
+              << (event_loop ? (event_loop->uses_uring() ? "io_uring" : "epoll") : "threads") << std::endl;
+    std::cout << "🎧 Listeners: " << listen_sockets.size()
+              << (listen_sockets.size() > 1 ? " (SO_REUSEPORT)" : "")
+              << ", backlog " << config->get_listen_backlog() << std::endl;
+    if (metrics_socket >= 0) {
+        std::cout << "📈 Metrics on port " << config->get_metrics_port() << std::endl;
+    }
     std::cout << "📊 Cache limit: " << config->get_cache_limit() 
               << " entries, TTL: " << config->get_cache_ttl() << "s" << std::endl;
-    std::cout << "🔒 Blocked hosts: " << (config->is_blocked("test") ? "Enabled" : "0") << std::endl;
+    std::cout << "🔒 Blocked hosts: " << config->get_blocked_count() << std::endl;
     std::cout << "Press Ctrl+C to stop\n" << std::endl;
 
     return true;
@@ -180,11 +405,47 @@ void ProxyServer::stop() {
     
     running = false;
     
-    if (server_socket >= 0) {
-        close(server_socket);
-        server_socket = -1;
+    // Joins the watcher, so no reload runs while the server shuts down
+    config->stop_watching();
+    
+    // shutdown() wakes accept threads blocked on the sockets, and a post
+    // each wakes one waiting for a connection slot. The sockets are only
+    // closed once nothing accepts on them, so a late accept() cannot hit
+    // a reused fd number.
+    for (int sock : listen_sockets) {
+        shutdown(sock, SHUT_RDWR);
+    }
+    if (connection_semaphore != SEM_FAILED && connection_semaphore != nullptr) {
+        for (size_t i = 0; i < acceptors.size(); i++) sem_post(connection_semaphore);
+    }
+    for (std::thread& acceptor : acceptors) {
+        acceptor.join();
+    }
+    acceptors.clear();
+    
+    if (metrics_thread.joinable()) {
+        // shutdown() wakes the blocked accept()
+        shutdown(metrics_socket, SHUT_RDWR);
+        metrics_thread.join();
+        close(metrics_socket);
+        metrics_socket = -1;
+    }
+    
+    // Fails outstanding lookups so nothing waits on DNS during shutdown
+    resolver->stop();
+    
+    // Background refreshes end coalescer flights that reactors wait on
+    handler->stop_refreshes();
+    
+    if (event_loop) {
+        event_loop->stop();
     }
     
+    for (int sock : listen_sockets) {
+        close(sock);
+    }
+    listen_sockets.clear();
+    
     logger->info("Proxy server stopped");
     
     if (stats) {
@@ -193,5 +454,21 @@ void ProxyServer::stop() {
 }
 
 void ProxyServer::run() {
-    accept_connections();
+    // Accept threads are owned by the server so stop() can join them
+    // before closing their sockets. Threads created by a pinned acceptor
+    // (thread mode handlers) inherit its CPU, so a connection stays on the
+    // core that accepted it.
+    if (!event_loop || !event_loop->accepts_connections()) {
+        for (size_t i = 0; i < listen_sockets.size(); i++) {
+            acceptors.emplace_back(&ProxyServer::accept_connections, this, (int)i);
+            if (listen_sockets.size() > 1 && config->is_cpu_pinning_enabled() &&
+                !EventLoop::pin_to_cpu(acceptors.back(), (int)i)) {
+                logger->warn("Failed to pin acceptor " + std::to_string(i) + " to a CPU");
+            }
+        }
+    }
+
+    while (running) {
+        sleep(1);
+    }
 }
@@ -0,0 +1,124 @@
+#include "../include/relay.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define COPY_BUFFER_SIZE 16384
+#define SPLICE_CHUNK 65536
+
+RelayChannel::RelayChannel(int from_fd, int to_fd)
+    : from(from_fd), to(to_fd), pipe_fds{-1, -1}, pipe_capacity(COPY_BUFFER_SIZE),
+      pending(0), copy_offset(0), use_splice(false), source_eof(false), write_shut(false), total_bytes(0) {
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+        int size = fcntl(pipe_fds[0], F_GETPIPE_SZ);
+        pipe_capacity = (size > 0) ? size : SPLICE_CHUNK;
+        use_splice = true;
+    } else {
+        copy_buffer.resize(COPY_BUFFER_SIZE);
+    }
+}
+
+RelayChannel::~RelayChannel() {
+    if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+    if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+}
+
+bool RelayChannel::wants_read() const {
+    if (source_eof) return false;
+    return use_splice ? pending < pipe_capacity : pending == 0;
+}
+
+ssize_t RelayChannel::pump() {
+    ssize_t moved = use_splice ? pump_splice() : pump_copy();
+
+    // Propagate the half-close once everything read has been delivered
+    if (moved >= 0 && finished() && !write_shut) {
+        shutdown(to, SHUT_WR);
+        write_shut = true;
+    }
+    return moved;
+}
+
+ssize_t RelayChannel::pump_splice() {
+    ssize_t moved = 0;
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+
+        if (!source_eof && pending < pipe_capacity) {
+            ssize_t n = splice(from, nullptr, pipe_fds[1], nullptr, pipe_capacity - pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                pending += n;
+                progress = true;
+            } else if (n == 0) {
+                source_eof = true;
+            } else if (errno == EINVAL || errno == ENOSYS) {
+                // Nothing has gone through the pipe yet, so switching is lossless
+                if (pending != 0) return -1;
+                close(pipe_fds[0]);
+                close(pipe_fds[1]);
+                pipe_fds[0] = pipe_fds[1] = -1;
+                use_splice = false;
+                copy_buffer.resize(COPY_BUFFER_SIZE);
+                ssize_t copied = pump_copy();
+                return copied < 0 ? -1 : moved + copied;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+        }
+
+        if (pending > 0) {
+            ssize_t n = splice(pipe_fds[0], nullptr, to, nullptr, pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                pending -= n;
+                total_bytes += n;
+                moved += n;
+                progress = true;
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+        }
+    }
+
+    return moved;
+}
+
+ssize_t RelayChannel::pump_copy() {
+    ssize_t moved = 0;
+
+    while (true) {
+        if (pending == 0 && !source_eof) {
+            ssize_t n = recv(from, &copy_buffer[0], copy_buffer.size(), 0);
+            if (n > 0) {
+                pending = n;
+                copy_offset = 0;
+            } else if (n == 0) {
+                source_eof = true;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            } else {
+                return -1;
+            }
+        }
+
+        if (pending == 0) break;
+
+        ssize_t n = send(to, copy_buffer.data() + copy_offset, pending, MSG_NOSIGNAL);
+        if (n > 0) {
+            pending -= n;
+            copy_offset += n;
+            total_bytes += n;
+            moved += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    return moved;
+}
@@ -0,0 +1,52 @@
+#include "../include/request_coalescer.h"
+#include <chrono>
+
+bool RequestCoalescer::join(const std::string& key, std::function<void()> done) {
+    std::lock_guard<std::mutex> lock(flights_mutex);
+    auto it = flights.find(key);
+    if (it == flights.end()) {
+        flights.emplace(key, std::make_shared<Flight>());
+        return true;
+    }
+    it->second->waiters.push_back(done);
+    return false;
+}
+
+bool RequestCoalescer::lead_or_wait(const std::string& key, int timeout_ms, bool& timed_out) {
+    std::unique_lock<std::mutex> lock(flights_mutex);
+    timed_out = false;
+    auto it = flights.find(key);
+    if (it == flights.end()) {
+        flights.emplace(key, std::make_shared<Flight>());
+        return true;
+    }
+
+    // Held across the wait: finish() drops the table's reference
+    std::shared_ptr<Flight> flight = it->second;
+    timed_out = !flight->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                       [&flight]() { return flight->landed; });
+    return false;
+}
+
+bool RequestCoalescer::try_lead(const std::string& key) {
+    std::lock_guard<std::mutex> lock(flights_mutex);
+    return flights.emplace(key, std::make_shared<Flight>()).second;
+}
+
+void RequestCoalescer::finish(const std::string& key) {
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(flights_mutex);
+        auto it = flights.find(key);
+        if (it == flights.end()) return;
+        it->second->landed = true;
+        it->second->cond.notify_all();
+        waiters.swap(it->second->waiters);
+        flights.erase(it);
+    }
+
+    // Outside the lock: a callback may start the next flight for this key
+    for (auto& done : waiters) {
+        done();
+    }
+}
@@ -3,138 +3,380 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <sys/select.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <chrono>
+#include <algorithm>
+#include <thread>
 
 #define BUFFER_SIZE 8192
+#define MAX_HEADER_SIZE 65536
+
+static bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Ends a coalesced fetch when the leading handler returns, however it returns
+struct FlightLease {
+    RequestCoalescer* coalescer;
+    const std::string& key;
+
+    FlightLease(RequestCoalescer* flights, const std::string& url) : coalescer(flights), key(url) {}
+    ~FlightLease() {
+        if (coalescer) coalescer->finish(key);
+    }
+};
 
 RequestHandler::RequestHandler(Logger* log, CacheManager* cache_mgr, 
-                               ConfigManager* config_mgr, Statistics* stats_mgr)
-    : logger(log), cache(cache_mgr), config(config_mgr), stats(stats_mgr) {
+                               ConfigManager* config_mgr, Statistics* stats_mgr, Resolver* dns,
+                               UpstreamPool* upstream_pool)
+    : logger(log), cache(cache_mgr), config(config_mgr), stats(stats_mgr),
+      pool(upstream_pool), resolver(dns), metrics(nullptr), coalescer(nullptr),
+      refresh_stopping(false) {
 }
 
-void RequestHandler::tunnel(int client, int remote) {
-    char buffer[BUFFER_SIZE];
-    fd_set fds;
-    struct timeval timeout;
+RequestHandler::~RequestHandler() {
+    stop_refreshes();
+}
 
-    while (true) {
-        FD_ZERO(&fds);
-        FD_SET(client, &fds);
-        FD_SET(remote, &fds);
-        
-        timeout.tv_sec = config->get_connection_timeout();
-        timeout.tv_usec = 0;
-
-        int result = select(std::max(client, remote) + 1, &fds, nullptr, nullptr, &timeout);
+void RequestHandler::stop_refreshes() {
+    // One already running finishes, queued ones are dropped
+    std::deque<RefreshJob> dropped;
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        refresh_stopping = true;
+        dropped.swap(refresh_queue);
+    }
+    refresh_cond.notify_all();
+    for (std::thread& worker : refresh_workers) {
+        worker.join();
+    }
+    refresh_workers.clear();
+    if (coalescer) {
+        for (RefreshJob& job : dropped) coalescer->finish(job.url);
+    }
+}
+
+void RequestHandler::tunnel(int client, int remote, const std::string& host) {
+    // The relay channels need non-blocking sockets to interleave both directions
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(remote, F_SETFL, fcntl(remote, F_GETFL, 0) | O_NONBLOCK);
+
+    RelayChannel upstream(client, remote);
+    RelayChannel downstream(remote, client);
+    pollfd fds[2];
+    int timeout_ms = config->get_connection_timeout() * 1000;
+
+    while (!downstream.finished()) {
+        fds[0].fd = client;
+        fds[0].events = (upstream.wants_read() ? POLLIN : 0) | (downstream.wants_write() ? POLLOUT : 0);
+        fds[1].fd = remote;
+        fds[1].events = (downstream.wants_read() ? POLLIN : 0) | (upstream.wants_write() ? POLLOUT : 0);
+
+        int result = poll(fds, 2, timeout_ms);
         if (result <= 0) break;
 
-        if (FD_ISSET(client, &fds)) {
-            int n = recv(client, buffer, BUFFER_SIZE, 0);
-            if (n <= 0) break;
-            if (send(remote, buffer, n, 0) <= 0) break;
-        }
+        // A peer that is gone with nothing left to read ends the tunnel
+        if ((fds[0].revents & (POLLERR | POLLNVAL)) || (fds[1].revents & (POLLERR | POLLNVAL))) break;
+        if (((fds[0].revents | fds[1].revents) & POLLHUP) &&
+            !((fds[0].revents | fds[1].revents) & POLLIN)) break;
 
-        if (FD_ISSET(remote, &fds)) {
-            int n = recv(remote, buffer, BUFFER_SIZE, 0);
-            if (n <= 0) break;
-            if (send(client, buffer, n, 0) <= 0) break;
-        }
+        if (upstream.pump() < 0 || downstream.pump() < 0) break;
     }
-}
 
-std::string RequestHandler::extract_host(const std::string& request) {
-    size_t hpos = request.find("Host:");
-    if (hpos != std::string::npos) {
-        size_t s = hpos + 6;
-        while (s < request.size() && request[s] == ' ') s++;
-        size_t e = request.find("\r\n", s);
-        if (e != std::string::npos) {
-            return request.substr(s, e - s);
-        }
+    if (stats) {
+        stats->record_bytes(host, downstream.bytes(), upstream.bytes());
     }
-    return "";
 }
 
-std::string RequestHandler::extract_path(const std::string& request) {
-    size_t line_end = request.find("\r\n");
-    if (line_end == std::string::npos) return "/";
-    
-    std::string first = request.substr(0, line_end);
-    size_t p1 = first.find(" ");
-    size_t p2 = first.find(" ", p1 + 1);
-    
-    if (p1 == std::string::npos || p2 == std::string::npos) return "/";
-    
-    std::string path = first.substr(p1 + 1, p2 - p1 - 1);
-    
-    if (path.find("http://") == 0) {
-        size_t slash = path.find('/', 7);
-        path = (slash == std::string::npos) ? "/" : path.substr(slash);
+void RequestHandler::split_host_port(const std::string& hostport, int default_port,
+                                     std::string& host, int& port) {
+    size_t colon = hostport.find(':');
+    host = hostport.substr(0, colon);
+    port = default_port;
+    if (colon != std::string::npos) {
+        int parsed = atoi(hostport.c_str() + colon + 1);
+        if (parsed > 0 && parsed < 65536) port = parsed;
     }
-    
-    return path;
+}
+
+void RequestHandler::record_latency(LatencyPhase phase, const std::string& host,
+                                    std::chrono::steady_clock::time_point since) {
+    if (!stats) return;
+    stats->record_latency(phase, host, std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since));
 }
 
 int RequestHandler::connect_to_host(const std::string& host, int port) {
-    struct hostent* server = gethostbyname(host.c_str());
-    if (!server) {
+    auto started = std::chrono::steady_clock::now();
+    std::vector<ResolvedAddress> addresses;
+    resolver->resolve(host, addresses);
+    if (addresses.empty()) {
         logger->error("DNS lookup failed for: " + host);
         return -1;
     }
+    record_latency(PHASE_DNS, host, started);
+    started = std::chrono::steady_clock::now();
+
+    for (const ResolvedAddress& address : addresses) {
+        sockaddr_storage addr;
+        socklen_t addr_len = address.to_sockaddr(port, addr);
+
+        int sock = socket(address.family, SOCK_STREAM, 0);
+        if (sock < 0) continue;
+        if (connect(sock, (sockaddr*)&addr, addr_len) == 0) {
+            record_latency(PHASE_CONNECT, host, started);
+            return sock;
+        }
+        close(sock);
+    }
 
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        logger->error("Socket creation failed");
-        return -1;
+    logger->error("Connection failed to: " + host);
+    return -1;
+}
+
+std::string RequestHandler::forbidden_response() {
+    return "HTTP/1.1 403 Forbidden\r\n"
+           "Content-Type: text/html\r\n"
+           "Content-Length: 48\r\n"
+           "\r\n"
+           "<html><body><h1>403 Forbidden</h1></body></html>";
+}
+
+std::string RequestHandler::parse_error_response(RequestParser::Status status) {
+    if (status == RequestParser::TOO_LARGE) {
+        return "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+               "Content-Length: 0\r\n"
+               "Connection: close\r\n"
+               "\r\n";
     }
+    return "HTTP/1.1 400 Bad Request\r\n"
+           "Content-Length: 0\r\n"
+           "Connection: close\r\n"
+           "\r\n";
+}
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    memcpy(&addr.sin_addr, server->h_addr, server->h_length);
+// Hop-by-hop headers (RFC 7230 6.1) plus those we rewrite ourselves
+static const char* const DROPPED_HEADERS[] = {
+    "connection", "proxy-connection", "keep-alive", "te", "trailer", "upgrade",
+    "proxy-authorization", "proxy-authenticate", "host", "expect"
+};
+
+// Headers named in Connection are hop-by-hop too
+static bool listed_in_connection(const RequestParser& request, std::string_view name) {
+    for (size_t i = 0; i < request.header_count(); i++) {
+        if (!RequestParser::iequals(request.header_name(i), "connection")) continue;
+        std::string_view value = request.header_value(i);
+        while (!value.empty()) {
+            size_t comma = value.find(',');
+            std::string_view token = value.substr(0, comma);
+            while (!token.empty() && (token.front() == ' ' || token.front() == '\t')) token.remove_prefix(1);
+            while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) token.remove_suffix(1);
+            if (RequestParser::iequals(token, name)) return true;
+            if (comma == std::string_view::npos) break;
+            value.remove_prefix(comma + 1);
+        }
+    }
+    return false;
+}
 
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        logger->error("Connection failed to: " + host);
-        close(sock);
-        return -1;
+static bool is_forwarded_header(const RequestParser& request, std::string_view name) {
+    for (const char* dropped : DROPPED_HEADERS) {
+        if (RequestParser::iequals(name, dropped)) return false;
+    }
+    // A chunked body is relayed as is, so its framing wins (RFC 7230 3.3.3)
+    if (request.chunked() && RequestParser::iequals(name, "content-length")) return false;
+    return !listed_in_connection(request, name);
+}
+
+std::string RequestHandler::upstream_request_header(const RequestParser& request,
+                                                    const std::string& host, bool keep_alive) {
+    // A chunked body can only be sent to an HTTP/1.1 origin
+    bool http11 = keep_alive || request.chunked();
+
+    std::string header;
+    header.reserve(request.header_size() + 64);
+    header.append(request.method());
+    header.append(" ");
+    header.append(request.path());
+    header.append(http11 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+    header.append("Host: " + host + "\r\n");
+    for (size_t i = 0; i < request.header_count(); i++) {
+        std::string_view name = request.header_name(i);
+        if (!is_forwarded_header(request, name)) continue;
+        header.append(name);
+        header.append(": ");
+        header.append(request.header_value(i));
+        header.append("\r\n");
     }
+    header.append(keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    return header;
+}
+
+void RequestHandler::frame_body(const RequestParser& request, BodyFramer& body) {
+    if (request.chunked()) {
+        body.start_chunked();
+    } else {
+        body.start_length(request.content_length());
+    }
+}
+
+// We answer "Expect: 100-continue" ourselves and stream the body once it comes
+bool RequestHandler::expects_continue(const RequestParser& request) {
+    return request.http_minor() >= 1 && RequestParser::iequals(request.header("expect"), "100-continue");
+}
+
+bool RequestHandler::is_cacheable_method(const RequestParser& request) {
+    return request.method() == "GET";
+}
+
+// Unsafe methods invalidate the stored response for the URL (RFC 7234 4.4)
+bool RequestHandler::invalidates_cache(const RequestParser& request) {
+    std::string_view method = request.method();
+    return method != "GET" && method != "HEAD" && method != "OPTIONS" && method != "TRACE";
+}
+
+bool RequestHandler::is_conditional(const RequestParser& request) {
+    static const char* const CONDITIONAL_HEADERS[] = {
+        "if-none-match", "if-modified-since", "if-match", "if-unmodified-since", "if-range", "range"
+    };
+    for (const char* name : CONDITIONAL_HEADERS) {
+        if (!request.header(name).empty()) return true;
+    }
+    return false;
+}
+
+// Value of a header in a stored response, empty if it has none
+static std::string_view stored_header(const std::string& stored, std::string_view name) {
+    size_t end = stored.find("\r\n\r\n");
+    if (end == std::string::npos) return std::string_view();
+
+    std::string_view response(stored);
+    size_t eol = response.find("\r\n");
+    while (eol < end) {
+        size_t start = eol + 2;
+        eol = response.find("\r\n", start);
+        std::string_view line = response.substr(start, eol - start);
+        if (line.size() > name.size() && line[name.size()] == ':' &&
+            RequestParser::iequals(line.substr(0, name.size()), name)) {
+            std::string_view value = line.substr(name.size() + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+            return value;
+        }
+    }
+    return std::string_view();
+}
+
+bool RequestHandler::add_validators(std::string& upstream_request, const std::string& stored) {
+    std::string validators;
+    std::string_view etag = stored_header(stored, "etag");
+    std::string_view last_modified = stored_header(stored, "last-modified");
+    if (!etag.empty()) validators.append("If-None-Match: ").append(etag).append("\r\n");
+    if (!last_modified.empty()) validators.append("If-Modified-Since: ").append(last_modified).append("\r\n");
+    if (validators.empty()) return false;
+
+    // Ahead of the blank line that ends the header
+    upstream_request.insert(upstream_request.size() - 2, validators);
+    return true;
+}
+
+std::string RequestHandler::error_response(const std::string& message) {
+    return "HTTP/1.1 500 Internal Server Error\r\n"
+           "Content-Type: text/plain\r\n"
+           "Content-Length: " + std::to_string(message.size()) + "\r\n"
+           "\r\n" + message;
+}
 
-    return sock;
+// Local endpoints are origin-form GETs; proxied requests carry an absolute URL
+bool RequestHandler::is_stats_request(const RequestParser& request) {
+    return request.method() == "GET" && request.target().substr(0, 6) == "/stats";
+}
+
+bool RequestHandler::is_latency_request(const RequestParser& request) {
+    return request.method() == "GET" && request.target().substr(0, 14) == "/stats/latency";
+}
+
+bool RequestHandler::is_metrics_request(const RequestParser& request) {
+    return request.method() == "GET" && request.target() == "/metrics";
+}
+
+std::string RequestHandler::stats_response() {
+    if (!stats) {
+        return "HTTP/1.1 404 Not Found\r\n"
+               "Content-Length: 17\r\n"
+               "\r\n"
+               "Stats not enabled";
+    }
+    std::string stats_json = stats->get_json_stats();
+    return "HTTP/1.1 200 OK\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: " + std::to_string(stats_json.size()) + "\r\n"
+           "\r\n" + stats_json;
+}
+
+std::string RequestHandler::latency_response() {
+    if (!stats) {
+        return "HTTP/1.1 404 Not Found\r\n"
+               "Content-Length: 17\r\n"
+               "\r\n"
+               "Stats not enabled";
+    }
+    std::string latency_json = stats->get_latency_json();
+    return "HTTP/1.1 200 OK\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: " + std::to_string(latency_json.size()) + "\r\n"
+           "\r\n" + latency_json;
+}
+
+static const char METRICS_DISABLED[] = "HTTP/1.1 404 Not Found\r\n"
+                                       "Content-Length: 19\r\n"
+                                       "\r\n"
+                                       "Metrics not enabled";
+
+bool RequestHandler::send_metrics(int client, bool keep_alive) {
+    if (!metrics) return send_all(client, METRICS_DISABLED, sizeof(METRICS_DISABLED) - 1);
+    return metrics->send_response(client, keep_alive);
+}
+
+void RequestHandler::append_metrics_response(std::string& out, bool keep_alive) {
+    if (!metrics) {
+        out.append(METRICS_DISABLED, sizeof(METRICS_DISABLED) - 1);
+        return;
+    }
+    metrics->append_response(out, keep_alive);
 }
 
 void RequestHandler::send_forbidden(int client) {
-    const char* response = "HTTP/1.1 403 Forbidden\r\n"
-                          "Content-Type: text/html\r\n"
-                          "Content-Length: 45\r\n"
-                          "\r\n"
-                          "<html><body><h1>403 Forbidden</h1></body></html>";
-    send(client, response, strlen(response), 0);
+    std::string response = forbidden_response();
+    send(client, response.c_str(), response.size(), 0);
 }
 
 void RequestHandler::send_error(int client, const std::string& message) {
-    std::string response = "HTTP/1.1 500 Internal Server Error\r\n"
-                          "Content-Type: text/plain\r\n"
-                          "Content-Length: " + std::to_string(message.size()) + "\r\n"
-                          "\r\n" + message;
+    std::string response = error_response(message);
     send(client, response.c_str(), response.size(), 0);
 }
 
-bool RequestHandler::handle_https_connect(int client, const std::string& request, 
-                                          const std::string& client_ip) {
-    size_t p1 = request.find(" ");
-    size_t p2 = request.find(" ", p1 + 1);
-    if (p1 == std::string::npos || p2 == std::string::npos) {
+bool RequestHandler::handle_https_connect(int client, const RequestParser& request, 
+                                          const std::string& client_ip,
+                                          const std::string& early_data) {
+    std::string host;
+    int port;
+    split_host_port(std::string(request.host()), 443, host, port);
+    if (host.empty()) {
         send_error(client, "Malformed CONNECT request");
         return false;
     }
-    
-    std::string hostport = request.substr(p1 + 1, p2 - p1 - 1);
-    size_t colon = hostport.find(":");
-    std::string host = hostport.substr(0, colon);
-    int port = (colon != std::string::npos) ? std::stoi(hostport.substr(colon + 1)) : 443;
 
-    if (config->is_blocked(host)) {
+    if (config->is_blocked(host, port)) {
         logger->log_request(client_ip, host, "BLOCKED_HTTPS");
         stats->record_blocked_request();
         send_forbidden(client);
@@ -152,12 +394,18 @@ bool RequestHandler::handle_https_connect(int client, const std::string& request
 
     const char* established = "HTTP/1.1 200 Connection Established\r\n\r\n";
     send(client, established, strlen(established), 0);
+    
+    // Bytes the client sent right behind the CONNECT header belong to the tunnel
+    if (!early_data.empty() && !send_all(remote, early_data.c_str(), early_data.size())) {
+        close(remote);
+        return false;
+    }
 
     logger->log_request(client_ip, host, "HTTPS_TUNNEL");
     logger->log_url(client_ip, "https://" + host, "CONNECT");
     stats->record_request(host, client_ip);
 
-    tunnel(client, remote);
+    tunnel(client, remote, host);
     
     auto end_time = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
@@ -167,22 +415,172 @@ bool RequestHandler::handle_https_connect(int client, const std::string& request
     return true;
 }
 
-bool RequestHandler::handle_http_request(int client, const std::string& request, 
-                                        const std::string& client_ip) {
-    std::string host = extract_host(request);
+// Moves the request body from pending and then the client socket to remote
+// (or discards it if remote is -1) one buffer at a time. Bytes behind the
+// body stay in pending. Returns false if the client went away or sent a
+// malformed body; an origin that stops accepting it clears upstream_ok.
+bool RequestHandler::forward_body(int client, int remote, BodyFramer& body, std::string& pending,
+                                  size_t& forwarded, bool& upstream_ok) {
+    if (!pending.empty() && !body.complete()) {
+        size_t used = body.feed(pending.data(), pending.size());
+        if (remote >= 0 && upstream_ok) {
+            upstream_ok = send_all(remote, pending.data(), used);
+            if (upstream_ok) forwarded += used;
+        }
+        pending.erase(0, used);
+    }
+
+    char buffer[BUFFER_SIZE];
+    while (!body.complete() && !body.failed()) {
+        ssize_t n = recv(client, buffer, BUFFER_SIZE, 0);
+        if (n <= 0) return false;
+        size_t used = body.feed(buffer, n);
+        if (remote >= 0 && upstream_ok) {
+            upstream_ok = send_all(remote, buffer, used);
+            if (upstream_ok) forwarded += used;
+        }
+        if (used < (size_t)n) pending.append(buffer + used, n - used);
+    }
+    return body.complete();
+}
+
+bool RequestHandler::fetch_upstream(int client, const std::string& origin, int port,
+                                    const std::string& upstream_request, BodyFramer& body,
+                                    std::string& pending, bool head_request, bool revalidating,
+                                    CacheTee& tee, FetchResult& result) {
+    result.complete = false;
+    result.self_delimited = false;
+    result.client_ok = true;
+    result.body_complete = true;
+    result.body_bytes = 0;
+    result.not_modified = false;
+
+    // A body read from the client cannot be replayed, so such requests
+    // always go out on a fresh connection
+    bool has_body = !body.complete();
+
+    // A pooled connection may have been closed by the origin while idle;
+    // that only shows up once we use it, so such a failure gets one retry
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int remote = (pool && !has_body) ? pool->acquire(origin, port) : -1;
+        bool reused = remote >= 0;
+        if (!reused) {
+            remote = connect_to_host(origin, port);
+            if (remote < 0) return false;
+        } else {
+            fcntl(remote, F_SETFL, fcntl(remote, F_GETFL, 0) & ~O_NONBLOCK);
+        }
+
+        // Keep-alive responses don't end with EOF, so never wait forever
+        timeval tv{config->get_connection_timeout(), 0};
+        setsockopt(remote, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        if (!send_all(remote, upstream_request.c_str(), upstream_request.size())) {
+            close(remote);
+            if (reused) continue;
+            logger->error("Failed to send request to remote host");
+            return false;
+        }
+
+        // The origin may answer early (e.g. 413) and stop reading; its
+        // response is still relayed, but the connection is not reused
+        bool upstream_ok = true;
+        if (has_body) {
+            result.body_complete = forward_body(client, remote, body, pending,
+                                                result.body_bytes, upstream_ok);
+            if (!result.body_complete) {
+                close(remote);
+                return true;
+            }
+        }
+
+        // Cut-through: every chunk goes to the client as soon as it arrives,
+        // and a copy is kept only while the response is still cacheable
+        ResponseFramer framer(head_request);
+        char buffer[BUFFER_SIZE];
+        bool trailing_data = false;
+        size_t received = 0;
+        auto phase_start = std::chrono::steady_clock::now();
+        bool holding = revalidating;
+        std::string held;
+
+        while (!framer.complete()) {
+            ssize_t n = recv(remote, buffer, BUFFER_SIZE, 0);
+            if (n <= 0) {
+                if (n == 0) framer.on_eof();
+                break;
+            }
+            if (received == 0) {
+                record_latency(PHASE_TTFB, origin, phase_start);
+                phase_start = std::chrono::steady_clock::now();
+            }
+            size_t used = framer.feed(buffer, n);
+            trailing_data = used < (size_t)n;
+            received += used;
+            tee.feed(buffer, used);
+
+            const char* out = buffer;
+            if (holding) {
+                held.append(buffer, used);
+                if (!framer.headers_done()) continue;
+                holding = false;
+                if (framer.status() == 304) {
+                    result.not_modified = true;
+                    continue;
+                }
+                out = held.data();
+                used = held.size();
+            }
+            if (client >= 0 && !send_all(client, out, used)) {
+                result.client_ok = false;
+                break;
+            }
+        }
+        // Cut off before the status line was complete
+        if (holding && client >= 0 && !held.empty()) {
+            result.client_ok = send_all(client, held.data(), held.size());
+        }
+
+        if (received == 0 && reused) {
+            close(remote);
+            continue;
+        }
+
+        if (received > 0) record_latency(PHASE_TRANSFER, origin, phase_start);
+        result.complete = framer.complete();
+        result.self_delimited = framer.self_delimited();
+        if (pool && result.client_ok && upstream_ok && framer.keep_alive() && !trailing_data) {
+            pool->release(origin, port, remote);
+        } else {
+            close(remote);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool RequestHandler::handle_http_request(int client, const RequestParser& request, 
+                                        const std::string& client_ip, BodyFramer& body,
+                                        std::string& pending) {
+    std::string host(request.host());
     if (host.empty()) {
         send_error(client, "No Host header found");
         return false;
     }
     
-    std::string path = extract_path(request);
+    std::string path(request.path());
     std::string full_url = "http://" + host + path;
-    std::string method = request.substr(0, request.find(" "));
+    std::string method(request.method());
     
     // Log the complete URL
     logger->log_url(client_ip, full_url, method);
 
-    if (config->is_blocked(host)) {
+    std::string origin;
+    int origin_port;
+    split_host_port(host, 80, origin, origin_port);
+
+    if (config->is_blocked(origin, origin_port)) {
         logger->log_request(client_ip, host, "BLOCKED_HTTP");
         stats->record_blocked_request();
         send_forbidden(client);
@@ -190,75 +588,179 @@ bool RequestHandler::handle_http_request(int client, const std::string& request,
     }
 
     // Check cache
-    std::string cached_data;
-    if (cache->get(host, cached_data)) {
-        send(client, cached_data.c_str(), cached_data.size(), 0);
-        logger->log_request(client_ip, host, "CACHED", cached_data.size());
+    bool cacheable = is_cacheable_method(request);
+    if (invalidates_cache(request)) cache->remove(full_url);
+    auto lookup_start = std::chrono::steady_clock::now();
+    CachedResponse cached;
+    auto serve_cached = [&](const char* label) {
+        // Sent straight from the shared cache buffer
+        bool sent = send_all(client, cached->data(), cached->size());
+        if (sent) record_latency(PHASE_CACHE_HIT, origin, lookup_start);
+        logger->log_request(client_ip, host, label, cached->size());
         stats->record_request(host, client_ip);
-        stats->record_cached_request();
-        stats->record_bytes(host, cached_data.size(), 0);
-        return true;
+        stats->record_cached_request(cached->size());
+        stats->record_bytes(host, cached->size(), 0);
+        if (sent) stats->record_zero_copy_response(cached->size());
+        return sent && ResponseFramer::is_self_delimited(*cached);
+    };
+    int stale_seconds = 0;
+    CacheManager::Freshness found = cacheable ? cache->lookup(full_url, cached, stale_seconds)
+                                              : CacheManager::MISS;
+    if (found == CacheManager::FRESH) {
+        return serve_cached("CACHED");
+    }
+
+    // Shortly past expiry the client gets the stale copy right away; one
+    // request per URL starts a background revalidation
+    CachedResponse stale;
+    if (found == CacheManager::STALE) {
+        int window = config->get_stale_while_revalidate();
+        if (window > 0 && stale_seconds <= window && body.complete()) {
+            if (!coalescer || coalescer->try_lead(full_url)) {
+                refresh_in_background(full_url, origin, origin_port,
+                                      upstream_request_header(request, host, pool != nullptr), cached);
+            }
+            stats->record_stale_served();
+            return serve_cached("STALE");
+        }
+        stale = std::move(cached);
+    }
+
+    // One miss per URL goes to the origin; the others wait for it to
+    // store the response, then read the cache again
+    FlightLease lease(nullptr, full_url);
+    if (cacheable && coalescer && body.complete() && config->is_coalescing_enabled()) {
+        bool timed_out;
+        if (coalescer->lead_or_wait(full_url, config->get_coalesce_timeout_ms(), timed_out)) {
+            lease.coalescer = coalescer;
+        } else {
+            stats->record_coalesced_request();
+            if (!timed_out && cache->get(full_url, cached)) return serve_cached("CACHED");
+            stats->record_coalesce_fallback();
+        }
     }
 
     // Fetch from internet
     auto start_time = std::chrono::steady_clock::now();
     
-    int remote = connect_to_host(host, 80);
-    if (remote < 0) {
+    std::string new_req = upstream_request_header(request, host, pool != nullptr);
+    // An expired copy is revalidated instead of fetched again
+    bool revalidating = stale && !is_conditional(request) && add_validators(new_req, *stale);
+
+    if (!body.complete() && expects_continue(request)) {
+        const char* proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (!send_all(client, proceed, strlen(proceed))) return false;
+    }
+
+    CacheTee tee(config->get_max_cache_object_kb() * 1024);
+    FetchResult result;
+    
+    if (!fetch_upstream(client, origin, origin_port, new_req, body, pending, method == "HEAD",
+                        revalidating, tee, result)) {
         send_error(client, "Failed to connect to remote host");
         stats->record_error();
         return false;
     }
 
-    std::string new_req = "GET " + path + " HTTP/1.0\r\n"
-                         "Host: " + host + "\r\n"
-                         "Connection: close\r\n"
-                         "\r\n";
-
-    if (send(remote, new_req.c_str(), new_req.size(), 0) <= 0) {
-        logger->error("Failed to send request to remote host");
-        close(remote);
+    if (!result.body_complete) {
+        logger->warn("Incomplete request body from " + client_ip);
         stats->record_error();
         return false;
     }
 
-    std::string response;
-    char buffer[BUFFER_SIZE];
-    int n;
-    
-    while ((n = recv(remote, buffer, BUFFER_SIZE, 0)) > 0) {
-        response.append(buffer, n);
-    }
-    
-    close(remote);
-
-    if (response.empty()) {
+    if (tee.bytes_seen() == 0) {
         send_error(client, "Empty response from server");
         stats->record_error();
         return false;
     }
 
-    // Cache the response
-    cache->put(host, response, config->get_cache_ttl());
+    if (result.not_modified) {
+        cache->refresh(full_url, stale, config->get_cache_ttl());
+        stats->record_revalidated();
+        cached = std::move(stale);
+        lookup_start = std::chrono::steady_clock::now();
+        return serve_cached("REVALIDATED");
+    }
 
-    // Send to client
-    send(client, response.c_str(), response.size(), 0);
+    // A truncated delivery is not a complete object
+    if (cacheable && result.client_ok && result.complete && tee.is_cacheable()) {
+        cache->put(full_url, tee.take_data(), config->get_cache_ttl());
+    }
     
     auto end_time = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
     
-    logger->log_request(client_ip, host, "FETCHED", response.size());
+    logger->log_request(client_ip, host, "FETCHED", tee.bytes_seen());
     stats->record_request(host, client_ip);
-    stats->record_bytes(host, response.size(), new_req.size());
+    if (cacheable) stats->record_cache_miss(tee.bytes_seen());
+    stats->record_bytes(host, tee.bytes_seen(), new_req.size() + result.body_bytes);
     stats->record_time(host, duration);
 
-    return true;
+    return result.client_ok && result.self_delimited;
 }
 
-void RequestHandler::handle_client(int client) {
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, BUFFER_SIZE);
+void RequestHandler::refresh_in_background(const std::string& url, const std::string& origin,
+                                           int port, std::string upstream_request,
+                                           CachedResponse stale) {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        if (!refresh_stopping && refresh_queue.size() < REFRESH_QUEUE) {
+            if (refresh_workers.empty()) {
+                for (size_t i = 0; i < REFRESH_WORKERS; i++) {
+                    refresh_workers.emplace_back(&RequestHandler::run_refreshes, this);
+                }
+            }
+            refresh_queue.push_back({url, origin, port, std::move(upstream_request),
+                                     std::move(stale)});
+            refresh_cond.notify_one();
+            return;
+        }
+    }
+
+    // The stale copy was served anyway; a later request past expiry retries
+    logger->debug("Background refresh of " + url + " skipped: queue full");
+    if (coalescer) coalescer->finish(url);
+}
+
+void RequestHandler::run_refreshes() {
+    std::unique_lock<std::mutex> lock(refresh_mutex);
+    while (true) {
+        refresh_cond.wait(lock, [this] { return refresh_stopping || !refresh_queue.empty(); });
+        if (refresh_stopping) return;
+        RefreshJob job = std::move(refresh_queue.front());
+        refresh_queue.pop_front();
+
+        lock.unlock();
+        refresh(job);
+        lock.lock();
+    }
+}
+
+void RequestHandler::refresh(RefreshJob& job) {
+    bool revalidating = add_validators(job.upstream_request, *job.stale);
+    BodyFramer body;
+    std::string pending;
+    CacheTee tee(config->get_max_cache_object_kb() * 1024);
+    FetchResult result;
+
+    if (fetch_upstream(-1, job.origin, job.port, job.upstream_request, body, pending, false,
+                       revalidating, tee, result)) {
+        if (result.not_modified) {
+            cache->refresh(job.url, job.stale, config->get_cache_ttl());
+            if (stats) stats->record_revalidated();
+        } else if (result.complete && tee.is_cacheable()) {
+            cache->put(job.url, tee.take_data(), config->get_cache_ttl());
+        }
+        logger->debug("Background refresh of " + job.url +
+                      (result.not_modified ? ": not modified" : ": refetched"));
+    } else {
+        logger->warn("Background refresh failed for " + job.url);
+    }
+
+    if (coalescer) coalescer->finish(job.url);
+}
 
+void RequestHandler::handle_client(int client) {
     sockaddr_in addr;
     socklen_t len = sizeof(addr);
     if (getpeername(client, (sockaddr*)&addr, &len) < 0) {
@@ -269,35 +771,82 @@ void RequestHandler::handle_client(int client) {
     
     std::string client_ip = inet_ntoa(addr.sin_addr);
 
-    int bytes = recv(client, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes <= 0) {
-        close(client);
-        return;
-    }
+    // Between requests a persistent connection may sit idle this long
+    timeval tv{config->get_connection_timeout(), 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    
+    if (stats) stats->record_client_connection();
+
+    // Holds bytes read but not yet served, so pipelined requests that
+    // arrive in one segment are answered in order
+    std::string pending;
+    std::string header;  // current request's header block, capacity reused
+    RequestParser request(MAX_HEADER_SIZE);
+    char buffer[BUFFER_SIZE];
+    bool keep_open = true;
+    int served = 0;
+
+    while (keep_open) {
+        request.reset();
+        RequestParser::Status status = request.parse(pending);
+        while (status == RequestParser::INCOMPLETE) {
+            ssize_t n = recv(client, buffer, BUFFER_SIZE, 0);
+            if (n <= 0) {
+                // Client closed or idle timeout expired
+                close(client);
+                return;
+            }
+            pending.append(buffer, n);
+            status = request.parse(pending);
+        }
 
-    std::string request(buffer, bytes);
+        if (status != RequestParser::COMPLETE) {
+            logger->warn(std::string(status == RequestParser::TOO_LARGE ? "Request header too large"
+                                                                        : "Malformed request") +
+                         " from " + client_ip);
+            std::string response = parse_error_response(status);
+            send_all(client, response.c_str(), response.size());
+            break;
+        }
 
-    // Check for /stats endpoint (direct access without proxy)
-    if (request.find("GET /stats") == 0 || request.find("GET /stats ") != std::string::npos) {
-        if (!stats) {
-            std::string response = "HTTP/1.1 404 Not Found\r\n\r\nStats not enabled";
-            send(client, response.c_str(), response.size(), 0);
-        } else {
-            std::string stats_json = stats->get_json_stats();
-            std::string response = "HTTP/1.1 200 OK\r\n"
-                                  "Content-Type: application/json\r\n"
-                                  "Content-Length: " + std::to_string(stats_json.size()) + "\r\n"
-                                  "\r\n" + stats_json;
-            send(client, response.c_str(), response.size(), 0);
+        // Move the header out so the views stay valid while pending changes
+        header.assign(pending, 0, request.header_size());
+        pending.erase(0, request.header_size());
+        request.rebase(header.data());
+
+        if (stats) stats->record_client_request(served > 0);
+        served++;
+
+        // Check for /stats endpoint (direct access without proxy)
+        if (is_stats_request(request)) {
+            std::string response = is_latency_request(request) ? latency_response()
+                                                               : stats_response();
+            keep_open = send_all(client, response.c_str(), response.size()) &&
+                        request.keep_alive();
+            continue;
         }
-    }
-    // Handle HTTPS CONNECT
-    else if (request.find("CONNECT") == 0) {
-        handle_https_connect(client, request, client_ip);
-    }
-    // Handle HTTP
-    else {
-        handle_http_request(client, request, client_ip);
+
+        if (is_metrics_request(request)) {
+            keep_open = send_metrics(client, request.keep_alive()) && request.keep_alive();
+            continue;
+        }
+
+        // Handle HTTPS CONNECT; the tunnel owns the connection from here on
+        if (request.is_connect()) {
+            handle_https_connect(client, request, client_ip, pending);
+            break;
+        }
+
+        // Handle HTTP. A body that was not forwarded (cache hit, error) is
+        // skipped to find where the next pipelined request starts.
+        BodyFramer body;
+        frame_body(request, body);
+        keep_open = handle_http_request(client, request, client_ip, body, pending) &&
+                    request.keep_alive();
+
+        size_t skipped = 0;
+        bool discard = false;
+        keep_open = keep_open && forward_body(client, -1, body, pending, skipped, discard);
     }
 
     close(client);
@@ -0,0 +1,204 @@
+#include "../include/request_parser.h"
+#include <cstring>
+
+static inline char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+// Case-insensitive substring search; needle must be lower case
+static bool contains_token(std::string_view haystack, std::string_view needle) {
+    if (needle.size() > haystack.size()) return false;
+    for (size_t i = 0; i + needle.size() <= haystack.size(); i++) {
+        size_t j = 0;
+        while (j < needle.size() && lower(haystack[i + j]) == needle[j]) j++;
+        if (j == needle.size()) return true;
+    }
+    return false;
+}
+
+static bool starts_with_nocase(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() &&
+           RequestParser::iequals(text.substr(0, prefix.size()), prefix);
+}
+
+bool RequestParser::iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+RequestParser::RequestParser(size_t max_bytes)
+    : max_header_bytes(max_bytes) {
+    reset();
+}
+
+void RequestParser::reset() {
+    base = nullptr;
+    state = REQUEST_LINE;
+    result = INCOMPLETE;
+    scanned = 0;
+    line_start = 0;
+    method_span = target_span = path_span = authority_span = host_span = Span{0, 0};
+    minor_version = 0;
+    header_total = 0;
+    has_content_length = false;
+    content_length_value = 0;
+    has_transfer_encoding = false;
+    chunked_body = false;
+    connection_close = false;
+    connection_keep_alive = false;
+}
+
+RequestParser::Status RequestParser::parse(std::string_view buffer) {
+    if (result != INCOMPLETE) return result;
+    base = buffer.data();
+
+    while (scanned < buffer.size()) {
+        const char* newline = static_cast<const char*>(
+            memchr(base + scanned, '\n', buffer.size() - scanned));
+        if (!newline) {
+            scanned = buffer.size();
+            break;
+        }
+
+        size_t end = newline - base;
+        scanned = end + 1;
+        if (scanned > max_header_bytes) return result = TOO_LARGE;
+        if (end > line_start && base[end - 1] == '\r') end--;
+
+        Status line_status = INCOMPLETE;
+        if (end == line_start) {
+            // Blank lines before the request line are tolerated (RFC 7230 3.5)
+            if (state == HEADER_LINE) {
+                state = DONE;
+                // Any other final coding leaves the body length unknown
+                // (RFC 9112 6.3)
+                if (has_transfer_encoding && !chunked_body) return result = BAD_REQUEST;
+                return result = COMPLETE;
+            }
+        } else if (state == REQUEST_LINE) {
+            line_status = parse_request_line(line_start, end);
+            state = HEADER_LINE;
+        } else {
+            line_status = parse_header_line(line_start, end);
+        }
+        if (line_status != INCOMPLETE) return result = line_status;
+        line_start = scanned;
+    }
+
+    if (scanned > max_header_bytes) return result = TOO_LARGE;
+    return result = INCOMPLETE;
+}
+
+RequestParser::Status RequestParser::parse_request_line(size_t start, size_t end) {
+    std::string_view line(base + start, end - start);
+
+    size_t first_space = line.find(' ');
+    size_t last_space = line.rfind(' ');
+    if (first_space == std::string_view::npos || first_space == 0 ||
+        last_space <= first_space + 1) {
+        return BAD_REQUEST;
+    }
+
+    std::string_view version = line.substr(last_space + 1);
+    if (version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0 ||
+        version[7] < '0' || version[7] > '9') {
+        return BAD_REQUEST;
+    }
+    minor_version = version[7] - '0';
+
+    method_span = Span{(uint32_t)start, (uint32_t)first_space};
+    target_span = Span{(uint32_t)(start + first_space + 1), (uint32_t)(last_space - first_space - 1)};
+    std::string_view target = view(target_span);
+
+    if (target[0] == '/' || target == "*") {
+        path_span = target_span;
+    } else if (method() == "CONNECT") {
+        authority_span = target_span;
+    } else if (starts_with_nocase(target, "http://") || starts_with_nocase(target, "https://")) {
+        size_t authority = target.find("//") + 2;
+        size_t path = target.find_first_of("/?", authority);
+        if (path == std::string_view::npos) path = target.size();
+        authority_span = Span{(uint32_t)(target_span.offset + authority), (uint32_t)(path - authority)};
+        path_span = Span{(uint32_t)(target_span.offset + path), (uint32_t)(target.size() - path)};
+    } else {
+        return BAD_REQUEST;
+    }
+    return INCOMPLETE;
+}
+
+RequestParser::Status RequestParser::parse_header_line(size_t start, size_t end) {
+    // Obsolete line folding is rejected rather than unfolded (RFC 7230 3.2.4)
+    if (base[start] == ' ' || base[start] == '\t') return BAD_REQUEST;
+
+    const char* colon = static_cast<const char*>(memchr(base + start, ':', end - start));
+    if (!colon) return BAD_REQUEST;
+    size_t name_end = colon - base;
+    if (name_end == start || base[name_end - 1] == ' ' || base[name_end - 1] == '\t') {
+        return BAD_REQUEST;
+    }
+
+    size_t value_start = name_end + 1;
+    while (value_start < end && (base[value_start] == ' ' || base[value_start] == '\t')) value_start++;
+    size_t value_end = end;
+    while (value_end > value_start && (base[value_end - 1] == ' ' || base[value_end - 1] == '\t')) value_end--;
+
+    if (header_total == MAX_HEADERS) return TOO_LARGE;
+    Header& header = headers[header_total++];
+    header.name = Span{(uint32_t)start, (uint32_t)(name_end - start)};
+    header.value = Span{(uint32_t)value_start, (uint32_t)(value_end - value_start)};
+
+    std::string_view name = view(header.name);
+    std::string_view value = view(header.value);
+
+    if (iequals(name, "host")) {
+        if (host_span.length > 0) return BAD_REQUEST;
+        host_span = header.value;
+    } else if (iequals(name, "content-length")) {
+        if (value.empty()) return BAD_REQUEST;
+        uint64_t length = 0;
+        for (char ch : value) {
+            if (ch < '0' || ch > '9' || length > (UINT64_MAX - 9) / 10) return BAD_REQUEST;
+            length = length * 10 + (ch - '0');
+        }
+        if (has_content_length && length != content_length_value) return BAD_REQUEST;
+        has_content_length = true;
+        content_length_value = length;
+    } else if (iequals(name, "transfer-encoding")) {
+        // Only the last coding of the last header counts
+        size_t comma = value.rfind(',');
+        std::string_view last = comma == std::string_view::npos ? value : value.substr(comma + 1);
+        while (!last.empty() && (last[0] == ' ' || last[0] == '\t')) last.remove_prefix(1);
+        has_transfer_encoding = true;
+        chunked_body = iequals(last, "chunked");
+    } else if (iequals(name, "connection") || iequals(name, "proxy-connection")) {
+        connection_close = connection_close || contains_token(value, "close");
+        connection_keep_alive = connection_keep_alive || contains_token(value, "keep-alive");
+    }
+    return INCOMPLETE;
+}
+
+std::string RequestParser::path() const {
+    if (path_span.length > 0 && base[path_span.offset] == '/') return std::string(view(path_span));
+    if (target() == "*") return std::string(target());
+    // CONNECT, or an absolute-form target without a path but maybe a query
+    return "/" + std::string(view(path_span));
+}
+
+std::string_view RequestParser::host() const {
+    return authority_span.length > 0 ? view(authority_span) : view(host_span);
+}
+
+bool RequestParser::keep_alive() const {
+    if (connection_close) return false;
+    return minor_version >= 1 || connection_keep_alive;
+}
+
+std::string_view RequestParser::header(std::string_view name) const {
+    for (size_t i = 0; i < header_total; i++) {
+        if (iequals(header_name(i), name)) return header_value(i);
+    }
+    return std::string_view();
+}
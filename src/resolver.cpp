@@ -0,0 +1,618 @@
+#include "../include/resolver.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <random>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_AAAA 28
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_MAX_PACKET 4096
+#define FALLBACK_TTL 60
+#define MAX_CACHE_ENTRIES 10000
+
+socklen_t ResolvedAddress::to_sockaddr(int port, sockaddr_storage& out) const {
+    memset(&out, 0, sizeof(out));
+    if (family == AF_INET6) {
+        sockaddr_in6* addr = reinterpret_cast<sockaddr_in6*>(&out);
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(port);
+        memcpy(&addr->sin6_addr, bytes, 16);
+        return sizeof(sockaddr_in6);
+    }
+    sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(&out);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    memcpy(&addr->sin_addr, bytes, 4);
+    return sizeof(sockaddr_in);
+}
+
+static std::string lowercase(const std::string& s) {
+    std::string out = s;
+    std::transform(out.begin(), out.end(), out.begin(),
+                   [](unsigned char ch) { return std::tolower(ch); });
+    return out;
+}
+
+static bool parse_literal(const std::string& host, ResolvedAddress& addr) {
+    std::string bare = host;
+    if (bare.size() > 2 && bare.front() == '[' && bare.back() == ']') {
+        bare = bare.substr(1, bare.size() - 2);
+    }
+    if (inet_pton(AF_INET, bare.c_str(), addr.bytes) == 1) {
+        addr.family = AF_INET;
+        return true;
+    }
+    if (inet_pton(AF_INET6, bare.c_str(), addr.bytes) == 1) {
+        addr.family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+// ---- DNS wire format -------------------------------------------------------
+
+static bool build_query(uint16_t id, const std::string& host, uint16_t qtype, std::string& out) {
+    out.clear();
+    out.push_back(id >> 8);
+    out.push_back(id & 0xff);
+    out.append("\x01\x00", 2);          // standard query, recursion desired
+    out.append("\x00\x01", 2);          // one question
+    out.append(std::string(6, '\0'));   // no answer/authority/additional
+
+    size_t start = 0;
+    while (start < host.size()) {
+        size_t dot = host.find('.', start);
+        if (dot == std::string::npos) dot = host.size();
+        size_t label = dot - start;
+        if (label == 0 || label > 63) return false;
+        out.push_back((char)label);
+        out.append(host, start, label);
+        start = dot + 1;
+    }
+    if (out.size() - 12 > 254) return false;
+    out.push_back('\0');
+
+    out.push_back(qtype >> 8);
+    out.push_back(qtype & 0xff);
+    out.append("\x00\x01", 2);          // class IN
+    return true;
+}
+
+// True if the response's question section is the one in query (a packet
+// from build_query), names compared case-insensitively
+static bool echoes_question(const unsigned char* buf, size_t len, const std::string& query) {
+    if (len < query.size() || buf[4] != 0 || buf[5] != 1) return false;
+    for (size_t i = 12; i < query.size(); i++) {
+        // Label lengths are below 64, so tolower() only folds name bytes
+        if (std::tolower(buf[i]) != std::tolower((unsigned char)query[i])) return false;
+    }
+    return true;
+}
+
+// From the kernel CSPRNG: sequential IDs let an off-path attacker who
+// sees one predict the next
+static uint16_t random_id() {
+    uint16_t id;
+    if (getrandom(&id, sizeof(id), 0) != (ssize_t)sizeof(id)) {
+        id = (uint16_t)std::random_device()();
+    }
+    return id;
+}
+
+// Returns the offset just past the (possibly compressed) name, or 0 on error
+static size_t skip_name(const unsigned char* buf, size_t len, size_t pos) {
+    while (pos < len) {
+        unsigned char label = buf[pos];
+        if (label == 0) return pos + 1;
+        if ((label & 0xc0) == 0xc0) return pos + 2 <= len ? pos + 2 : 0;
+        pos += label + 1;
+    }
+    return 0;
+}
+
+static uint16_t read16(const unsigned char* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t read32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// ---- Resolver --------------------------------------------------------------
+
+Resolver::Resolver(Logger* log, Statistics* stats_mgr, const std::string& server,
+                   const std::string& hosts_file, int timeout_milliseconds,
+                   uint32_t negative_ttl_seconds, uint32_t max_ttl_seconds)
+    : logger(log), stats(stats_mgr), wake_fd(-1), nameserver_len(0),
+      timeout_ms(std::max(100, timeout_milliseconds)), max_attempts(2),
+      negative_ttl(negative_ttl_seconds), max_ttl(max_ttl_seconds),
+      running(false), fallback_threads(0) {
+    if (!hosts_file.empty()) {
+        load_hosts_file(hosts_file);
+    }
+
+    if (configure_nameserver(server)) {
+        // Queries open their own sockets; this one only checks that we can
+        int probe = open_socket();
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (probe >= 0 && wake_fd >= 0) {
+            running = true;
+            worker = std::thread(&Resolver::run, this);
+        } else {
+            logger->warn("DNS socket setup failed, using getaddrinfo fallback");
+            if (wake_fd >= 0) close(wake_fd);
+            wake_fd = -1;
+        }
+        if (probe >= 0) close(probe);
+    } else {
+        logger->warn("No DNS nameserver configured, using getaddrinfo fallback");
+    }
+}
+
+Resolver::~Resolver() {
+    stop();
+    // getaddrinfo helpers touch this object until they finish
+    while (fallback_threads.load() > 0) {
+        usleep(10000);
+    }
+}
+
+void Resolver::stop() {
+    bool was_running = running.exchange(false);
+    if (was_running && worker.joinable()) {
+        worker.join();
+    }
+
+    // Nobody will answer the remaining queries now; fail them
+    std::vector<ResolveCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(resolver_mutex);
+        for (auto& pair : inflight) {
+            PendingQuery* query = pair.second;
+            for (auto& cb : query->waiters) callbacks.push_back(cb);
+            if (query->sock >= 0) retired_sockets.push_back(query->sock);
+            delete query;
+        }
+        inflight.clear();
+        by_id.clear();
+
+        // The worker has exited, so nothing polls these any more
+        for (int fd : retired_sockets) close(fd);
+        retired_sockets.clear();
+        if (wake_fd >= 0) close(wake_fd);
+        wake_fd = -1;
+    }
+    std::vector<ResolvedAddress> none;
+    for (auto& cb : callbacks) cb(none);
+}
+
+int Resolver::open_socket() {
+    int fd = socket(nameserver.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (sockaddr*)&nameserver, nameserver_len) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool Resolver::configure_nameserver(const std::string& server) {
+    std::string spec = server;
+    if (spec.empty()) {
+        std::ifstream conf("/etc/resolv.conf");
+        std::string line;
+        while (getline(conf, line)) {
+            std::istringstream iss(line);
+            std::string key, value;
+            if (iss >> key >> value && key == "nameserver") {
+                spec = value;
+                break;
+            }
+        }
+    }
+    if (spec.empty()) return false;
+
+    // "ip", "ip:port", "[v6]:port" or a bare v6 address
+    std::string ip = spec;
+    int port = 53;
+    if (spec.front() == '[') {
+        size_t close_bracket = spec.find(']');
+        if (close_bracket == std::string::npos) return false;
+        ip = spec.substr(1, close_bracket - 1);
+        if (close_bracket + 1 < spec.size() && spec[close_bracket + 1] == ':') {
+            port = atoi(spec.c_str() + close_bracket + 2);
+        }
+    } else if (std::count(spec.begin(), spec.end(), ':') == 1) {
+        size_t colon = spec.find(':');
+        ip = spec.substr(0, colon);
+        port = atoi(spec.c_str() + colon + 1);
+    }
+
+    ResolvedAddress addr;
+    if (!parse_literal(ip, addr) || port <= 0 || port > 65535) {
+        logger->warn("Invalid DNS server: " + spec);
+        return false;
+    }
+    nameserver_len = addr.to_sockaddr(port, nameserver);
+    logger->info("DNS resolver using nameserver " + spec);
+    return true;
+}
+
+void Resolver::load_hosts_file(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        logger->warn("Could not open hosts file: " + path);
+        return;
+    }
+
+    std::string line;
+    while (getline(file, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+
+        std::istringstream iss(line);
+        std::string ip, name;
+        if (!(iss >> ip)) continue;
+
+        ResolvedAddress addr;
+        if (!parse_literal(ip, addr)) continue;
+        while (iss >> name) {
+            hosts[lowercase(name)].push_back(addr);
+        }
+    }
+}
+
+bool Resolver::lookup(const std::string& host_name, std::vector<ResolvedAddress>& out,
+                      ResolveCallback done) {
+    out.clear();
+
+    ResolvedAddress literal;
+    if (parse_literal(host_name, literal)) {
+        out.push_back(literal);
+        return true;
+    }
+
+    std::string host = lowercase(host_name);
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(resolver_mutex);
+
+    auto hosts_it = hosts.find(host);
+    if (hosts_it != hosts.end()) {
+        out = hosts_it->second;
+        if (stats) stats->record_dns_lookup(true);
+        return true;
+    }
+
+    auto cache_it = cache.find(host);
+    if (cache_it != cache.end()) {
+        if (now < cache_it->second.expires) {
+            out = cache_it->second.addresses;
+            if (stats) stats->record_dns_lookup(true);
+            return true;
+        }
+        cache.erase(cache_it);
+    }
+
+    if (stats) stats->record_dns_lookup(false);
+
+    // Someone is already asking: wait for the same answer
+    auto pending_it = inflight.find(host);
+    if (pending_it != inflight.end()) {
+        pending_it->second->waiters.push_back(done);
+        if (stats) stats->record_dns_coalesced();
+        return false;
+    }
+
+    PendingQuery* query = new PendingQuery();
+    query->host = host;
+    query->sock = -1;
+    query->a_done = false;
+    query->aaaa_done = false;
+    query->nxdomain = false;
+    query->min_ttl = max_ttl;
+    query->negative_ttl = negative_ttl;
+    query->attempts = 0;
+    query->started = now;
+    query->waiters.push_back(done);
+    inflight[host] = query;
+
+    if (!running) {
+        fallback_threads++;
+        std::thread(&Resolver::fallback_lookup, this, host).detach();
+        return false;
+    }
+
+    do {
+        query->id_a = random_id();
+    } while (by_id.count(query->id_a));
+    do {
+        query->id_aaaa = random_id();
+    } while (query->id_aaaa == query->id_a || by_id.count(query->id_aaaa));
+    by_id[query->id_a] = query;
+    by_id[query->id_aaaa] = query;
+
+    query->sock = open_socket();
+    if (query->sock < 0 || !send_queries(query)) {
+        // Name can't be encoded or the socket failed; fail it right away
+        if (query->sock >= 0) retired_sockets.push_back(query->sock);
+        by_id.erase(query->id_a);
+        by_id.erase(query->id_aaaa);
+        inflight.erase(host);
+        delete query;
+        return true;
+    }
+
+    // The worker adds the new socket to its poll set
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        logger->warn("Failed to wake DNS worker");
+    }
+    return false;
+}
+
+bool Resolver::resolve(const std::string& host, std::vector<ResolvedAddress>& out) {
+    auto promise = std::make_shared<std::promise<std::vector<ResolvedAddress>>>();
+    std::future<std::vector<ResolvedAddress>> future = promise->get_future();
+
+    if (!lookup(host, out, [promise](const std::vector<ResolvedAddress>& addresses) {
+            promise->set_value(addresses);
+        })) {
+        out = future.get();
+    }
+    return !out.empty();
+}
+
+// Caller holds resolver_mutex
+bool Resolver::send_queries(PendingQuery* query) {
+    std::string packet;
+    query->attempts++;
+    query->last_sent = std::chrono::steady_clock::now();
+
+    if (!query->a_done) {
+        if (!build_query(query->id_a, query->host, DNS_TYPE_A, packet)) return false;
+        if (send(query->sock, packet.data(), packet.size(), 0) < 0 && errno != EAGAIN) return false;
+    }
+    if (!query->aaaa_done) {
+        if (!build_query(query->id_aaaa, query->host, DNS_TYPE_AAAA, packet)) return false;
+        if (send(query->sock, packet.data(), packet.size(), 0) < 0 && errno != EAGAIN) return false;
+    }
+    return true;
+}
+
+void Resolver::run() {
+    unsigned char buf[DNS_MAX_PACKET];
+    std::vector<pollfd> pfds;
+
+    while (running) {
+        pfds.assign(1, pollfd{wake_fd, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(resolver_mutex);
+            for (int fd : retired_sockets) close(fd);
+            retired_sockets.clear();
+            for (auto& pair : inflight) {
+                if (pair.second->sock >= 0) pfds.push_back(pollfd{pair.second->sock, POLLIN, 0});
+            }
+        }
+
+        int ready = poll(pfds.data(), pfds.size(), 50);
+        if (ready > 0) {
+            uint64_t value;
+            while (read(wake_fd, &value, sizeof(value)) > 0) {}
+            for (size_t i = 1; i < pfds.size(); i++) {
+                if (!(pfds[i].revents & POLLIN)) continue;
+                ssize_t n;
+                while ((n = recv(pfds[i].fd, buf, sizeof(buf), 0)) > 0) {
+                    handle_response(pfds[i].fd, buf, n);
+                }
+            }
+        }
+
+        check_timeouts();
+    }
+}
+
+void Resolver::handle_response(int fd, const unsigned char* buf, size_t len) {
+    if (len < 12 || !(buf[2] & 0x80)) return;  // too short or not a response
+
+    uint16_t id = read16(buf);
+    int rcode = buf[3] & 0x0f;
+    uint16_t ancount = read16(buf + 6);
+    uint16_t nscount = read16(buf + 8);
+
+    std::vector<ResolveCallback> callbacks;
+    std::vector<ResolvedAddress> result;
+    {
+        std::lock_guard<std::mutex> lock(resolver_mutex);
+
+        auto it = by_id.find(id);
+        if (it == by_id.end()) return;  // late or spoofed answer
+        PendingQuery* query = it->second;
+        if (query->sock != fd) return;  // sent to another query's port
+        bool is_a = (id == query->id_a);
+
+        // A forged answer must also guess the name and type asked
+        std::string question;
+        if (!build_query(id, query->host, is_a ? DNS_TYPE_A : DNS_TYPE_AAAA, question) ||
+            !echoes_question(buf, len, question)) {
+            return;
+        }
+        size_t pos = question.size();
+
+        for (int i = 0; i < ancount + nscount; i++) {
+            pos = skip_name(buf, len, pos);
+            if (pos == 0 || pos + 10 > len) return;
+            uint16_t type = read16(buf + pos);
+            uint32_t ttl = read32(buf + pos + 4);
+            uint16_t rdlength = read16(buf + pos + 8);
+            pos += 10;
+            if (pos + rdlength > len) return;
+
+            if (i < ancount && type == DNS_TYPE_A && rdlength == 4) {
+                ResolvedAddress addr{AF_INET, {0}};
+                memcpy(addr.bytes, buf + pos, 4);
+                query->v4.push_back(addr);
+                query->min_ttl = std::min(query->min_ttl, ttl);
+            } else if (i < ancount && type == DNS_TYPE_AAAA && rdlength == 16) {
+                ResolvedAddress addr{AF_INET6, {0}};
+                memcpy(addr.bytes, buf + pos, 16);
+                query->v6.push_back(addr);
+                query->min_ttl = std::min(query->min_ttl, ttl);
+            } else if (i >= ancount && type == DNS_TYPE_SOA) {
+                // RFC 2308: negative TTL is min(SOA TTL, SOA MINIMUM)
+                size_t p = skip_name(buf, len, pos);
+                if (p) p = skip_name(buf, len, p);
+                if (p && p + 20 <= pos + rdlength) {
+                    uint32_t minimum = read32(buf + p + 16);
+                    query->negative_ttl = std::min(ttl, minimum);
+                }
+            }
+            pos += rdlength;
+        }
+
+        if (is_a) {
+            query->a_done = true;
+            if (rcode == DNS_RCODE_NXDOMAIN) query->nxdomain = true;
+        } else {
+            query->aaaa_done = true;
+        }
+
+        // NXDOMAIN for the name makes the other record type moot
+        if (!query->nxdomain && !(query->a_done && query->aaaa_done)) return;
+        complete(query, callbacks, result);
+    }
+
+    for (auto& cb : callbacks) cb(result);
+}
+
+void Resolver::check_timeouts() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::vector<ResolveCallback>, std::vector<ResolvedAddress>>> finished;
+
+    {
+        std::lock_guard<std::mutex> lock(resolver_mutex);
+        std::vector<PendingQuery*> expired;
+
+        for (auto& pair : inflight) {
+            PendingQuery* query = pair.second;
+            if (now - query->last_sent < std::chrono::milliseconds(timeout_ms)) continue;
+            // Out of retries, or A answered and only AAAA is slow
+            if (query->attempts >= max_attempts || !query->v4.empty()) {
+                expired.push_back(query);
+            } else {
+                send_queries(query);
+            }
+        }
+
+        for (PendingQuery* query : expired) {
+            finished.emplace_back();
+            complete(query, finished.back().first, finished.back().second);
+        }
+    }
+
+    for (auto& item : finished) {
+        for (auto& cb : item.first) cb(item.second);
+    }
+}
+
+// Caller holds resolver_mutex. Removes the query and caches its answer.
+void Resolver::complete(PendingQuery* query, std::vector<ResolveCallback>& callbacks,
+                        std::vector<ResolvedAddress>& result) {
+    auto now = std::chrono::steady_clock::now();
+
+    result = query->v4;
+    result.insert(result.end(), query->v6.begin(), query->v6.end());
+
+    // A timeout is not an answer; only cache failures the server confirmed
+    if (!result.empty() || query->a_done) {
+        uint32_t ttl = result.empty() ? query->negative_ttl : query->min_ttl;
+        ttl = std::min(ttl, max_ttl);
+        if (cache.size() >= MAX_CACHE_ENTRIES) {
+            for (auto it = cache.begin(); it != cache.end();) {
+                if (it->second.expires <= now) it = cache.erase(it);
+                else ++it;
+            }
+            if (cache.size() >= MAX_CACHE_ENTRIES) cache.clear();
+        }
+        if (ttl > 0) {
+            cache[query->host] = {result, now + std::chrono::seconds(ttl)};
+        }
+    }
+
+    if (stats) {
+        stats->record_dns_latency(std::chrono::duration_cast<std::chrono::microseconds>(
+            now - query->started));
+    }
+    if (result.empty()) {
+        logger->debug("DNS lookup failed for: " + query->host);
+    }
+
+    callbacks.swap(query->waiters);
+    if (query->sock >= 0) retired_sockets.push_back(query->sock);
+    if (query->id_a != query->id_aaaa) {
+        by_id.erase(query->id_a);
+        by_id.erase(query->id_aaaa);
+    }
+    inflight.erase(query->host);
+    delete query;
+}
+
+void Resolver::fallback_lookup(const std::string& host) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* info = nullptr;
+
+    std::vector<ResolvedAddress> v4, v6;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &info) == 0) {
+        for (addrinfo* ai = info; ai; ai = ai->ai_next) {
+            ResolvedAddress addr{ai->ai_family, {0}};
+            if (ai->ai_family == AF_INET) {
+                memcpy(addr.bytes, &((sockaddr_in*)ai->ai_addr)->sin_addr, 4);
+                v4.push_back(addr);
+            } else if (ai->ai_family == AF_INET6) {
+                memcpy(addr.bytes, &((sockaddr_in6*)ai->ai_addr)->sin6_addr, 16);
+                v6.push_back(addr);
+            }
+        }
+        freeaddrinfo(info);
+    }
+
+    std::vector<ResolveCallback> callbacks;
+    std::vector<ResolvedAddress> result;
+    {
+        std::lock_guard<std::mutex> lock(resolver_mutex);
+        auto it = inflight.find(host);
+        if (it != inflight.end()) {
+            PendingQuery* query = it->second;
+            query->v4 = v4;
+            query->v6 = v6;
+            query->a_done = true;
+            query->aaaa_done = true;
+            query->min_ttl = FALLBACK_TTL;
+            query->id_a = query->id_aaaa = 0;  // not registered in by_id
+            complete(query, callbacks, result);
+        }
+    }
+
+    for (auto& cb : callbacks) cb(result);
+    fallback_threads--;
+}
+
+size_t Resolver::cache_size() {
+    std::lock_guard<std::mutex> lock(resolver_mutex);
+    return cache.size();
+}
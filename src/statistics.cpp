@@ -4,132 +4,722 @@
 #include <algorithm>
 #include <vector>
 
-Statistics::Statistics() 
-    : total_requests(0), total_cached(0), total_blocked(0),
-      total_errors(0), total_bytes_sent(0), total_bytes_received(0),
-      start_time(std::chrono::system_clock::now()) {
+// Live instances, so an exiting thread only hands its shard back to a
+// Statistics object that still exists. Never destroyed: thread exit can
+// run after static destructors.
+static std::mutex& live_mutex() {
+    static std::mutex* mutex = new std::mutex();
+    return *mutex;
+}
+
+static std::unordered_map<uint64_t, Statistics*>& live_instances() {
+    static auto* instances = new std::unordered_map<uint64_t, Statistics*>();
+    return *instances;
+}
+
+static std::atomic<uint64_t> next_instance_id(1);
+
+// The shards this thread owns, one per Statistics instance it has recorded into
+struct ThreadShardCache {
+    struct Lease {
+        uint64_t instance_id;
+        Statistics::ThreadShard* shard;
+    };
+    std::vector<Lease> leases;
+
+    ~ThreadShardCache() {
+        std::lock_guard<std::mutex> lock(live_mutex());
+        for (const Lease& lease : leases) {
+            auto it = live_instances().find(lease.instance_id);
+            if (it != live_instances().end()) {
+                it->second->release_shard(lease.shard);
+            }
+        }
+    }
+};
+
+static thread_local ThreadShardCache shard_cache;
+
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+    // Only the owning thread writes, so load + store needs no locked RMW
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Host names come from clients, so they are escaped as JSON strings
+static void append_json_string(std::ostringstream& oss, const std::string& value) {
+    static const char hex[] = "0123456789abcdef";
+    oss << '"';
+    for (char ch : value) {
+        unsigned char c = (unsigned char)ch;
+        if (ch == '\\' || ch == '"') {
+            oss << '\\' << ch;
+        } else if (c < 0x20) {
+            oss << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        } else {
+            oss << ch;
+        }
+    }
+    oss << '"';
+}
+
+static void append_latency(std::ostringstream& oss, const LatencyHistogram::Snapshot& snap) {
+    oss << "{\"count\": " << snap.total
+        << ", \"mean_ms\": " << snap.mean() / 1000.0
+        << ", \"p50_ms\": " << snap.percentile(50) / 1000.0
+        << ", \"p90_ms\": " << snap.percentile(90) / 1000.0
+        << ", \"p99_ms\": " << snap.percentile(99) / 1000.0
+        << ", \"p999_ms\": " << snap.percentile(99.9) / 1000.0
+        << ", \"max_ms\": " << snap.max_us / 1000.0 << "}";
+}
+
+Statistics::Statistics()
+    : instance_id(next_instance_id++), dns_max_lookup_us(0),
+      start_time(std::chrono::system_clock::now()), latency_samples(0), latency_epoch(1),
+      listener_count(0) {
+    for (auto& slot : host_latency) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+    for (auto& counter : host_sketch) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(live_mutex());
+    live_instances()[instance_id] = this;
+}
+
+Statistics::~Statistics() {
+    {
+        std::lock_guard<std::mutex> lock(live_mutex());
+        live_instances().erase(instance_id);
+    }
+
+    for (ThreadShard* shard : shards) {
+        for (HostCounters* node = shard->hosts.load(); node;) {
+            HostCounters* next = node->next;
+            delete node;
+            node = next;
+        }
+        for (ClientCounter* node = shard->clients.load(); node;) {
+            ClientCounter* next = node->next;
+            delete node;
+            node = next;
+        }
+        delete shard;
+    }
+    for (auto& slot : host_latency) {
+        delete slot.load();
+    }
+    for (auto& retired : retired_latency) {
+        delete retired.second;
+    }
+}
+
+Statistics::ThreadShard& Statistics::local() {
+    for (const auto& lease : shard_cache.leases) {
+        if (lease.instance_id == instance_id) return *lease.shard;
+    }
+
+    ThreadShard* shard;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (!free_shards.empty()) {
+            shard = free_shards.back();
+            free_shards.pop_back();
+        } else {
+            shard = new ThreadShard();
+            for (auto& counter : shard->counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+            shards.push_back(shard);
+        }
+    }
+    shard_cache.leases.push_back({instance_id, shard});
+    return *shard;
+}
+
+// Called from the exiting thread with live_mutex held
+void Statistics::release_shard(ThreadShard* shard) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    free_shards.push_back(shard);
+}
+
+void Statistics::add(Counter counter, uint64_t amount) {
+    bump(local().counters[counter], amount);
+}
+
+uint64_t Statistics::sum(Counter counter) const {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t total = 0;
+    for (const ThreadShard* shard : shards) {
+        total += shard->counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Statistics::snapshot(uint64_t* totals) const {
+    std::fill(totals, totals + COUNTER_COUNT, 0);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const ThreadShard* shard : shards) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            totals[i] += shard->counters[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+Statistics::HostCounters& Statistics::host_counters(ThreadShard& shard, const std::string& host) {
+    auto it = shard.host_index.find(host);
+    if (it != shard.host_index.end()) return *it->second;
+
+    HostCounters* node = new HostCounters();
+    node->host = host;
+    node->next = shard.hosts.load(std::memory_order_relaxed);
+    shard.hosts.store(node, std::memory_order_release);
+    shard.host_index[host] = node;
+    return *node;
+}
+
+std::unordered_map<std::string, HostStats> Statistics::collect_hosts() const {
+    std::unordered_map<std::string, HostStats> merged;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const ThreadShard* shard : shards) {
+        for (const HostCounters* node = shard->hosts.load(std::memory_order_acquire); node;
+             node = node->next) {
+            HostStats& host = merged[node->host];
+            host.requests += node->requests.load(std::memory_order_relaxed);
+            host.bytes_sent += node->bytes_sent.load(std::memory_order_relaxed);
+            host.bytes_received += node->bytes_received.load(std::memory_order_relaxed);
+            host.total_time += std::chrono::milliseconds(node->time_ms.load(std::memory_order_relaxed));
+        }
+    }
+    return merged;
+}
+
+// Caller has announced its latency epoch or holds latency_mutex
+Statistics::HostLatency* Statistics::find_host_latency(const std::string& host, size_t hash) const {
+    for (int probe = 0; probe < LATENCY_PROBE; probe++) {
+        HostLatency* entry = host_latency[(hash + probe) % LATENCY_HOST_SLOTS].load();
+        if (entry && entry->hash == hash && entry->host == host) return entry;
+    }
+    return nullptr;
+}
+
+// A sample for a host without a slot. Records it into a free slot of the
+// host's run, or into the run's least busy slot if the sketch says this
+// host is busier; otherwise it stays global only.
+void Statistics::admit_host_latency(const std::string& host, size_t hash, LatencyPhase phase,
+                                    uint64_t us) {
+    uint64_t estimate = sketch_increment(hash);
+    std::unique_lock<std::mutex> lock(latency_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+
+    size_t target = 0;
+    HostLatency* coldest = nullptr;
+    for (int probe = 0; probe < LATENCY_PROBE; probe++) {
+        size_t slot = (hash + probe) % LATENCY_HOST_SLOTS;
+        HostLatency* entry = host_latency[slot].load();
+        if (!entry) {
+            target = slot;
+            coldest = nullptr;
+            break;
+        }
+        if (entry->hash == hash && entry->host == host) {
+            // Admitted by another thread meanwhile
+            entry->hits.fetch_add(1, std::memory_order_relaxed);
+            entry->phases[phase].record(us);
+            return;
+        }
+        if (!coldest || entry->hits.load(std::memory_order_relaxed) <
+                            coldest->hits.load(std::memory_order_relaxed)) {
+            coldest = entry;
+            target = slot;
+        }
+    }
+    if (coldest && estimate <= 2 * coldest->hits.load(std::memory_order_relaxed)) return;
+
+    // Allocated only once the slot is ours
+    HostLatency* entry = new HostLatency();
+    entry->host = host;
+    entry->hash = hash;
+    entry->hits.store(estimate, std::memory_order_relaxed);
+    entry->phases[phase].record(us);
+    HostLatency* replaced = host_latency[target].exchange(entry);
+    if (replaced) {
+        retired_latency.push_back({latency_epoch.fetch_add(1), replaced});
+        reclaim_host_latency();
+    }
+}
+
+uint64_t Statistics::sketch_increment(size_t hash) {
+    static const uint64_t SEEDS[LATENCY_SKETCH_ROWS] = {
+        0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+    };
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < LATENCY_SKETCH_ROWS; row++) {
+        uint64_t h = ((uint64_t)hash ^ (row + 1)) * SEEDS[row];
+        std::atomic<uint32_t>& counter =
+            host_sketch[row * LATENCY_SKETCH_WIDTH + (h >> 32) % LATENCY_SKETCH_WIDTH];
+        estimate = std::min<uint64_t>(estimate, counter.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+    return estimate;
+}
+
+// Halves every count so past traffic fades; skipped if slots are busy and
+// retried on the next sample
+void Statistics::age_host_latency() {
+    std::unique_lock<std::mutex> lock(latency_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+
+    latency_samples.store(0, std::memory_order_relaxed);
+    for (auto& counter : host_sketch) {
+        counter.store(counter.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    for (auto& slot : host_latency) {
+        HostLatency* entry = slot.load();
+        if (entry) entry->hits.store(entry->hits.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+}
+
+// A thread that could still hold a replaced entry announced an epoch no
+// later than the one the entry was retired in; free the rest. Caller
+// holds latency_mutex.
+void Statistics::reclaim_host_latency() {
+    uint64_t oldest = UINT64_MAX;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const ThreadShard* shard : shards) {
+            uint64_t epoch = shard->latency_epoch.load();
+            if (epoch != 0) oldest = std::min(oldest, epoch);
+        }
+    }
+
+    auto kept = retired_latency.begin();
+    for (auto& retired : retired_latency) {
+        if (retired.first < oldest) delete retired.second;
+        else *kept++ = retired;
+    }
+    retired_latency.erase(kept, retired_latency.end());
 }
 
 void Statistics::record_request(const std::string& host, const std::string& client_ip) {
-    total_requests++;
-    
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    per_host_stats[host].requests++;
-    ip_request_count[client_ip]++;
+    ThreadShard& shard = local();
+    bump(shard.counters[REQUESTS], 1);
+    bump(host_counters(shard, host).requests, 1);
+
+    auto it = shard.client_index.find(client_ip);
+    if (it == shard.client_index.end()) {
+        ClientCounter* node = new ClientCounter();
+        node->ip = client_ip;
+        node->next = shard.clients.load(std::memory_order_relaxed);
+        shard.clients.store(node, std::memory_order_release);
+        it = shard.client_index.emplace(client_ip, node).first;
+    }
+    bump(it->second->requests, 1);
 }
 
-void Statistics::record_cached_request() {
-    total_cached++;
+void Statistics::record_cached_request(size_t bytes) {
+    add(CACHED);
+    add(CACHE_HIT_BYTES, bytes);
+}
+
+void Statistics::record_cache_miss(size_t bytes) {
+    add(CACHE_MISSES);
+    add(CACHE_MISS_BYTES, bytes);
 }
 
 void Statistics::record_blocked_request() {
-    total_blocked++;
+    add(BLOCKED);
 }
 
 void Statistics::record_error() {
-    total_errors++;
+    add(ERRORS);
 }
 
 void Statistics::record_bytes(const std::string& host, size_t sent, size_t received) {
-    total_bytes_sent += sent;
-    total_bytes_received += received;
-    
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    per_host_stats[host].bytes_sent += sent;
-    per_host_stats[host].bytes_received += received;
+    ThreadShard& shard = local();
+    bump(shard.counters[BYTES_SENT], sent);
+    bump(shard.counters[BYTES_RECEIVED], received);
+
+    HostCounters& counters = host_counters(shard, host);
+    bump(counters.bytes_sent, sent);
+    bump(counters.bytes_received, received);
 }
 
 void Statistics::record_time(const std::string& host, std::chrono::milliseconds duration) {
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    per_host_stats[host].total_time += duration;
+    bump(host_counters(local(), host).time_ms, duration.count());
+}
+
+void Statistics::record_pool_hit() {
+    add(POOL_HITS);
+}
+
+void Statistics::record_pool_miss() {
+    add(POOL_MISSES);
+}
+
+void Statistics::record_client_connection() {
+    add(CLIENT_CONNECTIONS);
+}
+
+void Statistics::record_client_request(bool reused_connection) {
+    ThreadShard& shard = local();
+    bump(shard.counters[CLIENT_REQUESTS], 1);
+    if (reused_connection) bump(shard.counters[CLIENT_REUSED_REQUESTS], 1);
+}
+
+void Statistics::record_dns_lookup(bool cache_hit) {
+    add(cache_hit ? DNS_HITS : DNS_MISSES);
+}
+
+void Statistics::record_dns_coalesced() {
+    add(DNS_COALESCED);
+}
+
+void Statistics::record_dns_latency(std::chrono::microseconds duration) {
+    unsigned long long us = duration.count();
+    ThreadShard& shard = local();
+    bump(shard.counters[DNS_QUERIES], 1);
+    bump(shard.counters[DNS_LOOKUP_US], us);
+
+    // Upstream queries are rare enough that one shared max is fine
+    unsigned long long prev = dns_max_lookup_us.load();
+    while (us > prev && !dns_max_lookup_us.compare_exchange_weak(prev, us)) {
+    }
+}
+
+void Statistics::record_zero_copy_response(size_t bytes) {
+    ThreadShard& shard = local();
+    bump(shard.counters[ZERO_COPY_RESPONSES], 1);
+    bump(shard.counters[ZERO_COPY_BYTES], bytes);
+}
+
+void Statistics::record_disk_cache_read(size_t bytes) {
+    ThreadShard& shard = local();
+    bump(shard.counters[DISK_READS], 1);
+    bump(shard.counters[DISK_READ_BYTES], bytes);
+}
+
+void Statistics::record_disk_cache_write(size_t bytes) {
+    ThreadShard& shard = local();
+    bump(shard.counters[DISK_WRITES], 1);
+    bump(shard.counters[DISK_WRITTEN_BYTES], bytes);
+}
+
+void Statistics::record_log_dropped() {
+    add(LOG_DROPPED);
+}
+
+void Statistics::record_coalesced_request() {
+    add(COALESCED);
+}
+
+void Statistics::record_coalesce_fallback() {
+    add(COALESCE_FALLBACKS);
+}
+
+void Statistics::record_revalidated() {
+    add(REVALIDATED);
+}
+
+void Statistics::record_stale_served() {
+    add(STALE_SERVED);
+}
+
+void Statistics::record_latency(LatencyPhase phase, const std::string& host,
+                                std::chrono::microseconds duration) {
+    uint64_t us = duration.count() > 0 ? duration.count() : 0;
+    latency[phase].record(us);
+
+    size_t hash = std::hash<std::string>()(host);
+    ThreadShard& shard = local();
+    // Announced before loading a slot, so a replaced entry we may hold is
+    // not freed under us
+    shard.latency_epoch.store(latency_epoch.load());
+    HostLatency* entry = find_host_latency(host, hash);
+    if (entry) {
+        entry->hits.fetch_add(1, std::memory_order_relaxed);
+        entry->phases[phase].record(us);
+    }
+    shard.latency_epoch.store(0, std::memory_order_release);
+
+    if (!entry) admit_host_latency(host, hash, phase, us);
+    if (latency_samples.fetch_add(1, std::memory_order_relaxed) + 1 >= LATENCY_AGE_SAMPLES) {
+        age_host_latency();
+    }
+}
+
+void Statistics::set_listener_count(int count) {
+    listener_count = std::min(std::max(count, 0), MAX_LISTENERS);
+}
+
+void Statistics::record_accept(int listener) {
+    if (listener < 0 || listener >= MAX_LISTENERS) return;
+    listener_accepts[listener].accepts.fetch_add(1, std::memory_order_relaxed);
 }
 
 std::string Statistics::get_summary() const {
+    uint64_t totals[COUNTER_COUNT];
+    snapshot(totals);
+
     std::ostringstream oss;
     double uptime = get_uptime_seconds();
-    
+
     oss << "\n========== PROXY SERVER STATISTICS ==========\n";
     oss << "Uptime: " << std::fixed << std::setprecision(2) << uptime << " seconds\n";
-    oss << "Total Requests: " << total_requests.load() << "\n";
-    oss << "  - Cached: " << total_cached.load() << "\n";
-    oss << "  - Blocked: " << total_blocked.load() << "\n";
-    oss << "  - Errors: " << total_errors.load() << "\n";
-    oss << "Bytes Sent: " << total_bytes_sent.load() << " bytes\n";
-    oss << "Bytes Received: " << total_bytes_received.load() << " bytes\n";
-    
-    if (total_requests.load() > 0) {
-        double cache_rate = (double)total_cached.load() / total_requests.load() * 100.0;
+    oss << "Total Requests: " << totals[REQUESTS] << "\n";
+    oss << "  - Cached: " << totals[CACHED] << "\n";
+    oss << "  - Coalesced: " << totals[COALESCED] << "\n";
+    oss << "  - Revalidated: " << totals[REVALIDATED] << "\n";
+    oss << "  - Served stale: " << totals[STALE_SERVED] << "\n";
+    oss << "  - Blocked: " << totals[BLOCKED] << "\n";
+    oss << "  - Errors: " << totals[ERRORS] << "\n";
+    oss << "Bytes Sent: " << totals[BYTES_SENT] << " bytes\n";
+    oss << "Bytes Received: " << totals[BYTES_RECEIVED] << " bytes\n";
+    oss << "Upstream Pool: " << totals[POOL_HITS] << " reused, "
+        << totals[POOL_MISSES] << " new connections\n";
+    oss << "DNS: " << totals[DNS_HITS] << " cache hits, "
+        << totals[DNS_MISSES] << " misses\n";
+
+    if (totals[REQUESTS] > 0) {
+        double cache_rate = (double)totals[CACHED] / totals[REQUESTS] * 100.0;
         oss << "Cache Hit Rate: " << std::fixed << std::setprecision(2) << cache_rate << "%\n";
     }
-    
+    if (totals[CACHED] + totals[CACHE_MISSES] > 0) {
+        double objects = (double)totals[CACHED] / (totals[CACHED] + totals[CACHE_MISSES]) * 100.0;
+        uint64_t bytes = totals[CACHE_HIT_BYTES] + totals[CACHE_MISS_BYTES];
+        double byte_rate = bytes > 0 ? (double)totals[CACHE_HIT_BYTES] / bytes * 100.0 : 0.0;
+        oss << "Cache Hit Ratio: " << std::fixed << std::setprecision(2) << objects
+            << "% of objects, " << byte_rate << "% of bytes\n";
+    }
+
     oss << "============================================\n";
     return oss.str();
 }
 
 std::string Statistics::get_json_stats() const {
+    uint64_t totals[COUNTER_COUNT];
+    snapshot(totals);
+
     std::ostringstream oss;
     oss << "{\n";
     oss << "  \"uptime_seconds\": " << get_uptime_seconds() << ",\n";
-    oss << "  \"total_requests\": " << total_requests.load() << ",\n";
-    oss << "  \"cached_requests\": " << total_cached.load() << ",\n";
-    oss << "  \"blocked_requests\": " << total_blocked.load() << ",\n";
-    oss << "  \"errors\": " << total_errors.load() << ",\n";
-    oss << "  \"bytes_sent\": " << total_bytes_sent.load() << ",\n";
-    oss << "  \"bytes_received\": " << total_bytes_received.load() << "\n";
+    oss << "  \"total_requests\": " << totals[REQUESTS] << ",\n";
+    oss << "  \"cached_requests\": " << totals[CACHED] << ",\n";
+    oss << "  \"blocked_requests\": " << totals[BLOCKED] << ",\n";
+    oss << "  \"errors\": " << totals[ERRORS] << ",\n";
+    oss << "  \"bytes_sent\": " << totals[BYTES_SENT] << ",\n";
+    oss << "  \"bytes_received\": " << totals[BYTES_RECEIVED] << ",\n";
+    oss << "  \"upstream_pool_hits\": " << totals[POOL_HITS] << ",\n";
+    oss << "  \"upstream_pool_misses\": " << totals[POOL_MISSES] << ",\n";
+
+    unsigned long long connections = totals[CLIENT_CONNECTIONS];
+    unsigned long long requests = totals[CLIENT_REQUESTS];
+    unsigned long long reused = totals[CLIENT_REUSED_REQUESTS];
+    oss << "  \"client_connections\": " << connections << ",\n";
+    oss << "  \"client_requests\": " << requests << ",\n";
+    oss << "  \"client_reused_requests\": " << reused << ",\n";
+    oss << "  \"requests_per_connection\": "
+        << (connections > 0 ? (double)requests / connections : 0.0) << ",\n";
+    oss << "  \"connection_reuse_ratio\": "
+        << (requests > 0 ? (double)reused / requests : 0.0) << ",\n";
+
+    unsigned long long hits = totals[DNS_HITS];
+    unsigned long long misses = totals[DNS_MISSES];
+    unsigned long long queries = totals[DNS_QUERIES];
+    oss << "  \"dns_cache_hits\": " << hits << ",\n";
+    oss << "  \"dns_cache_misses\": " << misses << ",\n";
+    oss << "  \"dns_hit_rate\": "
+        << (hits + misses > 0 ? (double)hits / (hits + misses) : 0.0) << ",\n";
+    oss << "  \"dns_coalesced_lookups\": " << totals[DNS_COALESCED] << ",\n";
+    oss << "  \"dns_queries\": " << queries << ",\n";
+    oss << "  \"dns_avg_lookup_ms\": "
+        << (queries > 0 ? totals[DNS_LOOKUP_US] / 1000.0 / queries : 0.0) << ",\n";
+    oss << "  \"dns_max_lookup_ms\": " << dns_max_lookup_us.load() / 1000.0 << ",\n";
+    oss << "  \"coalesced_requests\": " << totals[COALESCED] << ",\n";
+    oss << "  \"coalesce_fallbacks\": " << totals[COALESCE_FALLBACKS] << ",\n";
+    oss << "  \"cache_revalidations\": " << totals[REVALIDATED] << ",\n";
+    oss << "  \"stale_responses\": " << totals[STALE_SERVED] << ",\n";
+
+    // Over cacheable requests only: hits against fetches that could have
+    // been hits
+    unsigned long long cache_hits = totals[CACHED];
+    unsigned long long cache_misses = totals[CACHE_MISSES];
+    unsigned long long hit_bytes = totals[CACHE_HIT_BYTES];
+    unsigned long long miss_bytes = totals[CACHE_MISS_BYTES];
+    oss << "  \"cache_hit_bytes\": " << hit_bytes << ",\n";
+    oss << "  \"cache_misses\": " << cache_misses << ",\n";
+    oss << "  \"cache_miss_bytes\": " << miss_bytes << ",\n";
+    oss << "  \"cache_object_hit_ratio\": "
+        << (cache_hits + cache_misses > 0 ? (double)cache_hits / (cache_hits + cache_misses) : 0.0)
+        << ",\n";
+    oss << "  \"cache_byte_hit_ratio\": "
+        << (hit_bytes + miss_bytes > 0 ? (double)hit_bytes / (hit_bytes + miss_bytes) : 0.0)
+        << ",\n";
+    oss << "  \"zero_copy_responses\": " << totals[ZERO_COPY_RESPONSES] << ",\n";
+    oss << "  \"zero_copy_bytes\": " << totals[ZERO_COPY_BYTES] << ",\n";
+    oss << "  \"disk_cache_hits\": " << totals[DISK_READS] << ",\n";
+    oss << "  \"disk_cache_read_bytes\": " << totals[DISK_READ_BYTES] << ",\n";
+    oss << "  \"disk_cache_writes\": " << totals[DISK_WRITES] << ",\n";
+    oss << "  \"disk_cache_written_bytes\": " << totals[DISK_WRITTEN_BYTES] << ",\n";
+    oss << "  \"log_dropped_lines\": " << totals[LOG_DROPPED] << ",\n";
+
+    // One entry per listening socket; an even spread means SO_REUSEPORT is
+    // balancing accepts across the listeners
+    oss << "  \"listener_accepts\": [";
+    for (int i = 0; i < get_listener_count(); i++) {
+        oss << (i > 0 ? ", " : "") << get_listener_accepts(i);
+    }
+    oss << "],\n";
+
+    LatencyHistogram::Snapshot snap;
+    oss << "  \"latency\": {\n";
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        latency[phase].snapshot(snap);
+        oss << "    \"" << latency_phase_name((LatencyPhase)phase) << "\": ";
+        append_latency(oss, snap);
+        oss << (phase + 1 < PHASE_COUNT ? ",\n" : "\n");
+    }
+    oss << "  }\n";
+    oss << "}\n";
+    return oss.str();
+}
+
+std::string Statistics::get_latency_json(int top_hosts) const {
+    LatencyHistogram::Snapshot snap;
+    std::ostringstream oss;
+
+    oss << "{\n  \"global\": {\n";
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        latency[phase].snapshot(snap);
+        oss << "    \"" << latency_phase_name((LatencyPhase)phase) << "\": ";
+        append_latency(oss, snap);
+        oss << (phase + 1 < PHASE_COUNT ? ",\n" : "\n");
+    }
+    oss << "  },\n";
+
+    // Busiest hosts first, by samples across all phases
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    std::vector<std::pair<uint64_t, const HostLatency*>> hosts;
+    for (const auto& slot : host_latency) {
+        const HostLatency* entry = slot.load(std::memory_order_acquire);
+        if (!entry) continue;
+        uint64_t samples = 0;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            entry->phases[phase].snapshot(snap);
+            samples += snap.total;
+        }
+        if (samples > 0) hosts.push_back({samples, entry});
+    }
+    std::sort(hosts.begin(), hosts.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    if ((int)hosts.size() > top_hosts) hosts.resize(std::max(top_hosts, 0));
+
+    oss << "  \"hosts\": {";
+    for (size_t i = 0; i < hosts.size(); i++) {
+        oss << (i == 0 ? "\n" : ",\n") << "    ";
+        append_json_string(oss, hosts[i].second->host);
+        oss << ": {\n";
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            hosts[i].second->phases[phase].snapshot(snap);
+            oss << "      \"" << latency_phase_name((LatencyPhase)phase) << "\": ";
+            append_latency(oss, snap);
+            oss << (phase + 1 < PHASE_COUNT ? ",\n" : "\n");
+        }
+        oss << "    }";
+    }
+    oss << (hosts.empty() ? "}\n" : "\n  }\n");
     oss << "}\n";
     return oss.str();
 }
 
 std::string Statistics::get_top_hosts(int limit) const {
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    
+    std::unordered_map<std::string, HostStats> per_host_stats = collect_hosts();
+
     std::vector<std::pair<std::string, unsigned long long>> hosts;
     for (const auto& pair : per_host_stats) {
         hosts.push_back({pair.first, pair.second.requests});
     }
-    
-    std::sort(hosts.begin(), hosts.end(), 
+
+    std::sort(hosts.begin(), hosts.end(),
               [](const auto& a, const auto& b) { return a.second > b.second; });
-    
+
     std::ostringstream oss;
     oss << "\nTop " << std::min(limit, (int)hosts.size()) << " Hosts by Request Count:\n";
     oss << "----------------------------------------\n";
-    
+
     int count = 0;
     for (const auto& host : hosts) {
         if (count++ >= limit) break;
         oss << count << ". " << host.first << ": " << host.second << " requests\n";
     }
-    
+
     return oss.str();
 }
 
 std::string Statistics::get_client_stats() const {
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    
+    std::unordered_map<std::string, unsigned long long> ip_request_count;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const ThreadShard* shard : shards) {
+            for (const ClientCounter* node = shard->clients.load(std::memory_order_acquire); node;
+                 node = node->next) {
+                ip_request_count[node->ip] += node->requests.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
     std::ostringstream oss;
     oss << "\nClient IP Statistics:\n";
     oss << "----------------------------------------\n";
-    
+
     for (const auto& pair : ip_request_count) {
         oss << pair.first << ": " << pair.second << " requests\n";
     }
-    
+
     return oss.str();
 }
 
 void Statistics::reset() {
-    total_requests = 0;
-    total_cached = 0;
-    total_blocked = 0;
-    total_errors = 0;
-    total_bytes_sent = 0;
-    total_bytes_received = 0;
-    
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    per_host_stats.clear();
-    ip_request_count.clear();
-    
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (ThreadShard* shard : shards) {
+            for (auto& counter : shard->counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+            for (HostCounters* node = shard->hosts.load(); node; node = node->next) {
+                node->requests = 0;
+                node->bytes_sent = 0;
+                node->bytes_received = 0;
+                node->time_ms = 0;
+            }
+            for (ClientCounter* node = shard->clients.load(); node; node = node->next) {
+                node->requests = 0;
+            }
+        }
+    }
+    dns_max_lookup_us = 0;
+    for (auto& listener : listener_accepts) {
+        listener.accepts = 0;
+    }
+
+    for (auto& histogram : latency) {
+        histogram.reset();
+    }
+    // Not under registry_mutex: reclaiming takes it with latency_mutex held
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        latency_samples = 0;
+        for (auto& counter : host_sketch) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        for (auto& slot : host_latency) {
+            HostLatency* entry = slot.load();
+            if (!entry) continue;
+            entry->hits = 0;
+            for (auto& histogram : entry->phases) {
+                histogram.reset();
+            }
+        }
+    }
+
     start_time = std::chrono::system_clock::now();
 }
 
@@ -0,0 +1,279 @@
+#include "../include/uring.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+IoUring::IoUring()
+    : ring_fd(-1), features(0), sq_head(nullptr), sq_tail(nullptr), sq_mask(0), sq_entries(0),
+      sqes(nullptr), sqe_tail(0), cq_head(nullptr), cq_tail(nullptr), cq_mask(0),
+      cqes(nullptr), sq_ring(MAP_FAILED), sq_ring_size(0), cq_ring(MAP_FAILED), cq_ring_size(0),
+      sqes_size(0), buf_ring(nullptr), buf_ring_size(0), buffers(nullptr), buf_count(0),
+      buf_size(0), buf_group(0), buf_tail(0) {
+}
+
+IoUring::~IoUring() {
+    // Closing the ring fd cancels whatever is still in flight
+    if (ring_fd >= 0) close(ring_fd);
+    if (buf_ring) munmap(buf_ring, buf_ring_size);
+    delete[] buffers;
+    if (sqes) munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+}
+
+bool IoUring::init(unsigned entries, std::string& error) {
+    io_uring_params params{};
+    // Completions outnumber submissions with multishot requests
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ring_fd < 0) {
+        error = std::string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+    features = params.features;
+    if (!(features & IORING_FEAT_EXT_ARG) || !(features & IORING_FEAT_NODROP)) {
+        error = "kernel lacks IORING_FEAT_EXT_ARG/NODROP";
+        return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        error = std::string("mmap of SQ ring: ") + strerror(errno);
+        return false;
+    }
+    cq_ring = single_mmap ? sq_ring
+                          : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+        error = std::string("mmap of CQ ring: ") + strerror(errno);
+        return false;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring_fd, IORING_OFF_SQES);
+    if (sqe_memory == MAP_FAILED) {
+        error = std::string("mmap of SQEs: ") + strerror(errno);
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // SQE slots are used in order, so the index array is the identity
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++) array[i] = i;
+    sqe_tail = *sq_tail;
+    return true;
+}
+
+bool IoUring::setup_buffers(uint16_t group, unsigned count, size_t size, std::string& error) {
+    buf_ring_size = count * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        error = std::string("mmap of buffer ring: ") + strerror(errno);
+        return false;
+    }
+    buf_ring = static_cast<io_uring_buf*>(ring);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        error = std::string("IORING_REGISTER_PBUF_RING: ") + strerror(errno);
+        return false;
+    }
+
+    buffers = new char[count * size];
+    buf_count = count;
+    buf_size = size;
+    buf_group = group;
+    buf_tail = 0;
+    for (unsigned i = 0; i < count; i++) recycle((uint16_t)i);
+    return true;
+}
+
+void IoUring::recycle(uint16_t id) {
+    io_uring_buf& slot = buf_ring[buf_tail & (buf_count - 1)];
+    slot.addr = (uint64_t)(uintptr_t)buffer(id);
+    slot.len = (uint32_t)buf_size;
+    slot.bid = id;
+    buf_tail++;
+    // The ring's tail overlays the first entry's resv field
+    __atomic_store_n(&buf_ring[0].resv, buf_tail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    // A full queue is flushed to the kernel to make room
+    if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        submit();
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe_tail++;
+    return sqe;
+}
+
+bool IoUring::prep_poll(int fd, uint32_t events, uint64_t user_data) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IoUring::prep_accept(int fd, uint64_t user_data) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IoUring::prep_recv(int fd, uint64_t user_data) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buf_group;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IoUring::prep_cancel(uint64_t target_user_data) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target_user_data;
+    sqe->user_data = 0;
+    return true;
+}
+
+bool IoUring::prep_cancel_and_close(int fd) {
+    // Both SQEs are needed, so make room for the pair up front
+    if (sqe_tail + 2 - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > sq_entries) submit();
+
+    io_uring_sqe* cancel = get_sqe();
+    if (!cancel) return false;
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->fd = fd;
+    cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    cancel->flags = IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS;
+    cancel->user_data = 0;
+
+    io_uring_sqe* closing = get_sqe();
+    if (!closing) return false;
+    closing->opcode = IORING_OP_CLOSE;
+    closing->fd = fd;
+    closing->flags = IOSQE_CQE_SKIP_SUCCESS;
+    closing->user_data = 0;
+    return true;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg,
+                   size_t arg_size) {
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+    } while (ret < 0 && errno == EINTR && !(flags & IORING_ENTER_GETEVENTS));
+    return ret;
+}
+
+// The kernel takes at most the SQEs it has not consumed yet, so the count
+// passed is simply everything between its head and our tail
+int IoUring::submit() {
+    unsigned pending = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0) return 0;
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    return enter(pending, 0, 0, nullptr, 0);
+}
+
+int IoUring::wait(int timeout_ms) {
+    unsigned pending = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+
+    __kernel_timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    int ret = enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret < 0 && (errno == ETIME || errno == EINTR)) ret = 0;
+    return ret;
+}
+
+bool IoUring::supported(std::string& reason) {
+    IoUring ring;
+    if (!ring.init(8, reason) || !ring.setup_buffers(0, 2, 64, reason)) return false;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        reason = std::string("socketpair: ") + strerror(errno);
+        return false;
+    }
+
+    // A multishot recv that stays armed (F_MORE) after delivering into a
+    // provided buffer needs 6.0; everything else used here is older
+    bool ok = false;
+    if (ring.prep_recv(fds[0], 1) && ring.submit() == 1 && write(fds[1], "x", 1) == 1) {
+        for (int attempt = 0; attempt < 10 && !ok && reason.empty(); attempt++) {
+            ring.wait(100);
+            ring.drain([&](const io_uring_cqe& cqe) {
+                if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER) && (cqe.flags & IORING_CQE_F_MORE)) {
+                    ok = true;
+                } else {
+                    reason = "multishot recv not supported (" + std::to_string(cqe.res) + ")";
+                }
+            });
+        }
+        if (!ok && reason.empty()) reason = "multishot recv never completed";
+    } else {
+        reason = "could not submit a multishot recv";
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return ok;
+}
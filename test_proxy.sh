@@ -93,6 +93,62 @@ else
 fi
 echo ""
 
+# Test 8: Tunnel peer resets mid-transfer
+# Needs the local origin (make build/origin_stub). The client half-closes,
+# then resets while the origin is still streaming; the proxy must survive
+# writing into the dead socket.
+echo -e "${BLUE}[TEST 8]${NC} Testing CONNECT tunnel reset by the client mid-transfer..."
+if [ -x build/origin_stub ] && command -v python3 >/dev/null; then
+    ./build/origin_stub 18080 0 1 >/dev/null 2>&1 &
+    STUB_PID=$!
+    sleep 0.3
+    for i in 1 2 3 4 5; do
+        python3 - <<'EOF' 2>/dev/null
+import socket, struct
+s = socket.create_connection(("localhost", 9090))
+s.sendall(b"CONNECT 127.0.0.1:18080 HTTP/1.1\r\nHost: 127.0.0.1:18080\r\n\r\n")
+s.recv(4096)
+s.sendall(b"GET /obj/33554432 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+s.shutdown(socket.SHUT_WR)
+s.recv(65536)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+s.close()
+EOF
+    done
+    sleep 0.5
+    kill $STUB_PID
+    ALIVE=$(curl -s -o /dev/null -w "%{http_code}" $PROXY/stats --max-time 5)
+    if [ "$ALIVE" == "200" ]; then
+        echo -e "${GREEN}✓ PASS${NC} - Proxy still serving after tunnel resets"
+    else
+        echo -e "${RED}✗ FAIL${NC} - Proxy stopped answering after tunnel resets"
+    fi
+else
+    echo -e "${YELLOW}⚠ SKIP${NC} - Needs build/origin_stub and python3"
+fi
+echo ""
+
+# Test 9: /metrics on an origin is proxied, not answered locally
+echo -e "${BLUE}[TEST 9]${NC} Testing absolute-form /metrics request is proxied..."
+if [ -x build/origin_stub ]; then
+    ./build/origin_stub 18080 0 1 >/dev/null 2>&1 &
+    STUB_PID=$!
+    sleep 0.3
+    # The stub answers 404 for anything but /obj/; the proxy's own
+    # exposition would be a 200 ending in "# EOF"
+    ORIGIN_METRICS=$(curl -x $PROXY -s -o /dev/null -w "%{http_code}" http://127.0.0.1:18080/metrics --max-time 10)
+    LOCAL_METRICS=$(curl -s $PROXY/metrics --max-time 10 | tail -1)
+    kill $STUB_PID
+    if [ "$ORIGIN_METRICS" == "404" ] && [ "$LOCAL_METRICS" == "# EOF" ]; then
+        echo -e "${GREEN}✓ PASS${NC} - Origin /metrics forwarded, local /metrics served"
+    else
+        echo -e "${RED}✗ FAIL${NC} - Origin /metrics got $ORIGIN_METRICS, local /metrics ended with '$LOCAL_METRICS'"
+    fi
+else
+    echo -e "${YELLOW}⚠ SKIP${NC} - Needs build/origin_stub"
+fi
+echo ""
+
 # Summary
 echo "╔════════════════════════════════════════════════╗"
 echo "║     TEST SUMMARY                               ║"